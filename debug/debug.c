@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include "value/value.h"
 #include "object/object.h"
+#include "vm/vm.h"
 
 void disassembleChunk(Chunk* chunk, const ZChar* name)
 {
@@ -29,12 +30,81 @@ static ZInt32 byteInstruction(const ZChar* name, Chunk* chunk, ZInt32 offset)
 
 static ZInt32 jumpInstruction(const ZChar* name, ZInt32 sign, Chunk* chunk, ZInt32 offset)
 {
-    ZUInt16 jump = (ZUInt16)(chunk->code[offset + 1] << 8);
-    jump |= chunk->code[offset + 2];
-    printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+    // jump offsets are 24-bit (JUMP_OFFSET_SIZE bytes)
+    ZInt32 jump = (chunk->code[offset + 1] << 16) | (chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+    printf("%-16s %4d -> %d\n", name, offset, offset + 4 + sign * jump);
+    return offset + 4;
+}
+
+// 'selon' dispatch: one line per case, operands are big-endian, targets absolute
+static ZInt32 switchInstruction(const ZChar* name, Chunk* chunk, ZInt32 offset)
+{
+    ZUInt8* code = chunk->code;
+    OpCode op = (OpCode)code[offset++];
+    ZInt32 low = 0;
+    if (OP_SWITCH_TABLE == op)
+    {
+        low = (ZInt32)(((ZUInt32)code[offset] << 24) | (code[offset + 1] << 16) | (code[offset + 2] << 8) | code[offset + 3]);
+        offset += 4;
+    }
+    ZInt32 count = (code[offset] << 8) | code[offset + 1];
+    ZInt32 fallback = (code[offset + 2] << 16) | (code[offset + 3] << 8) | code[offset + 4];
+    offset += 5;
+    printf("%-16s %4d defaut -> %d\n", name, count, fallback);
+
+    for (ZInt32 i = 0; i < count; i++)
+    {
+        printf("%04d    |           ", offset);
+        if (OP_SWITCH_TABLE == op)
+        {
+            printf("%d", low + i);
+        }
+        else if (OP_SWITCH_SEARCH == op)
+        {
+            printf("%d", (ZInt32)(((ZUInt32)code[offset] << 24) | (code[offset + 1] << 16) | (code[offset + 2] << 8) | code[offset + 3]));
+            offset += 4;
+        }
+        else
+        {
+            printValue(chunk->constants.values[(code[offset] << 8) | code[offset + 1]]);
+            offset += 2;
+        }
+        printf(" -> %d\n", (code[offset] << 16) | (code[offset + 1] << 8) | code[offset + 2]);
+        offset += 3;
+    }
+    return offset;
+}
+
+static ZInt32 globalInstruction(const ZChar* name, Chunk* chunk, ZInt32 offset)
+{
+    ZUInt16 slot = (ZUInt16)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-16s %4d '", name, slot);
+    printValue(vm->globalNames.values[slot]);
+    printf("'\n");
     return offset + 3;
 }
 
+static ZInt32 localConstantInstruction(const ZChar* name, Chunk* chunk, ZInt32 offset)
+{
+    ZUInt8 slot = chunk->code[offset + 1];
+    ZUInt8 constant = chunk->code[offset + 2];
+    printf("%-16s %4d %4d '", name, slot, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
+static ZInt32 localConstantJumpInstruction(const ZChar* name, Chunk* chunk, ZInt32 offset)
+{
+    ZUInt8 slot = chunk->code[offset + 1];
+    ZUInt8 constant = chunk->code[offset + 2];
+    ZInt32 jump = (chunk->code[offset + 3] << 16) | (chunk->code[offset + 4] << 8) | chunk->code[offset + 5];
+    printf("%-16s %4d %4d '", name, slot, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' %4d -> %d\n", offset, offset + 6 + jump);
+    return offset + 6;
+}
+
 static ZInt32 constantInstruction(const ZChar* name, Chunk* chunk, ZInt32 offset)
 {
     ZUInt8 constant = chunk->code[offset + 1];
@@ -74,11 +144,11 @@ ZInt32 disassembleInstruction(Chunk* chunk, ZInt32 offset)
     case OP_GET_LOCAL:
         return byteInstruction("OP_GET_LOCAL", chunk, offset);
     case OP_SET_GLOBAL:
-        return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+        return globalInstruction("OP_SET_GLOBAL", chunk, offset);
     case OP_GET_GLOBAL:
-        return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+        return globalInstruction("OP_GET_GLOBAL", chunk, offset);
     case OP_DEFINE_GLOBAL:
-        return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+        return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
     case OP_EQUAL:
         return simpleInstruction("OP_EQUAL", offset);
     case OP_GREATER:
@@ -103,10 +173,20 @@ ZInt32 disassembleInstruction(Chunk* chunk, ZInt32 offset)
         return jumpInstruction("OP_JUMP", 1, chunk, offset);
     case OP_JUMP_IF_FALSE:
         return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_JUMP_IF_TRUE:
+        return jumpInstruction("OP_JUMP_IF_TRUE", 1, chunk, offset);
     case OP_LOOP:
         return jumpInstruction("OP_LOOP", -1, chunk, offset);
+    case OP_SWITCH_TABLE:
+        return switchInstruction("OP_SWITCH_TABLE", chunk, offset);
+    case OP_SWITCH_SEARCH:
+        return switchInstruction("OP_SWITCH_SEARCH", chunk, offset);
+    case OP_SWITCH_STRING:
+        return switchInstruction("OP_SWITCH_STRING", chunk, offset);
     case OP_MODULO:
         return simpleInstruction("OP_MODULO", offset);
+    case OP_POWER:
+        return simpleInstruction("OP_POWER", offset);
     case OP_DUP:
         return simpleInstruction("OP_DUP", offset);
     case OP_INCREMENT:
@@ -115,6 +195,8 @@ ZInt32 disassembleInstruction(Chunk* chunk, ZInt32 offset)
         return simpleInstruction("OP_DECREMENT", offset);
     case OP_CALL:
         return byteInstruction("OP_CALL", chunk, offset);
+    case OP_TAIL_CALL:
+        return byteInstruction("OP_TAIL_CALL", chunk, offset);
     case OP_CLOSURE:
     {
         offset++;
@@ -141,8 +223,173 @@ ZInt32 disassembleInstruction(Chunk* chunk, ZInt32 offset)
         return simpleInstruction("OP_CLOSE_UPVALUE", offset);
     case OP_RETURN:
         return simpleInstruction("OP_RETURN", offset);
+    case OP_ADD_CONSTANT:
+        return constantInstruction("OP_ADD_CONSTANT", chunk, offset);
+    case OP_SUBTRACT_CONSTANT:
+        return constantInstruction("OP_SUBTRACT_CONSTANT", chunk, offset);
+    case OP_LESS_CONSTANT:
+        return constantInstruction("OP_LESS_CONSTANT", chunk, offset);
+    case OP_GREATER_CONSTANT:
+        return constantInstruction("OP_GREATER_CONSTANT", chunk, offset);
+    case OP_EQUAL_CONSTANT:
+        return constantInstruction("OP_EQUAL_CONSTANT", chunk, offset);
+    case OP_LOCAL_ADD_CONSTANT:
+        return localConstantInstruction("OP_LOCAL_ADD_CONSTANT", chunk, offset);
+    case OP_LOCAL_SUBTRACT_CONSTANT:
+        return localConstantInstruction("OP_LOCAL_SUBTRACT_CONSTANT", chunk, offset);
+    case OP_LOCAL_LESS_CONSTANT:
+        return localConstantInstruction("OP_LOCAL_LESS_CONSTANT", chunk, offset);
+    case OP_SET_LOCAL_POP:
+        return byteInstruction("OP_SET_LOCAL_POP", chunk, offset);
+    case OP_POP_JUMP_IF_FALSE:
+        return jumpInstruction("OP_POP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_POP_JUMP_IF_TRUE:
+        return jumpInstruction("OP_POP_JUMP_IF_TRUE", 1, chunk, offset);
+    case OP_JUMP_IF_FALSE_OR_POP:
+        return jumpInstruction("OP_JUMP_IF_FALSE_OR_POP", 1, chunk, offset);
+    case OP_JUMP_IF_TRUE_OR_POP:
+        return jumpInstruction("OP_JUMP_IF_TRUE_OR_POP", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_LESS:
+        return jumpInstruction("OP_JUMP_IF_NOT_LESS", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_GREATER:
+        return jumpInstruction("OP_JUMP_IF_NOT_GREATER", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_EQUAL:
+        return jumpInstruction("OP_JUMP_IF_NOT_EQUAL", 1, chunk, offset);
+    case OP_JUMP_IF_LOCAL_NOT_LESS_CONSTANT:
+        return localConstantJumpInstruction("OP_JUMP_IF_LOCAL_NOT_LESS_CONSTANT", chunk, offset);
     default:
         printf("Unknown opcode %d\n", instruction);
         return offset + 1;
     }
-}
\ No newline at end of file
+}
+
+#ifdef PROFILE_OPCODES
+/*
+@Note: Dynamic opcode profile. Every executed instruction bumps the count of
+       the pair and the triple it ends, and the totals are printed to stderr
+       at exit, one "paire"/"triplet" line each. debug/opcode_profile.py runs
+       a whole corpus of scripts and merges these lines to rank the sequences
+       worth fusing into superinstructions.
+*/
+static const ZChar *opcodeNames[] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_NULL] = "OP_NULL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_POP] = "OP_POP",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_LESS] = "OP_LESS",
+    [OP_ADD] = "OP_ADD",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_MODULO] = "OP_MODULO",
+    [OP_POWER] = "OP_POWER",
+    [OP_NOT] = "OP_NOT",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_INCREMENT] = "OP_INCREMENT",
+    [OP_DECREMENT] = "OP_DECREMENT",
+    [OP_DUP] = "OP_DUP",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_JUMP] = "OP_JUMP",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_JUMP_IF_TRUE] = "OP_JUMP_IF_TRUE",
+    [OP_LOOP] = "OP_LOOP",
+    [OP_SWITCH_TABLE] = "OP_SWITCH_TABLE",
+    [OP_SWITCH_SEARCH] = "OP_SWITCH_SEARCH",
+    [OP_SWITCH_STRING] = "OP_SWITCH_STRING",
+    [OP_SWAP] = "OP_SWAP",
+    [OP_CALL] = "OP_CALL",
+    [OP_TAIL_CALL] = "OP_TAIL_CALL",
+    [OP_CLOSURE] = "OP_CLOSURE",
+    [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+    [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+    [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE",
+    [OP_RETURN] = "OP_RETURN",
+    [OP_ADD_CONSTANT] = "OP_ADD_CONSTANT",
+    [OP_SUBTRACT_CONSTANT] = "OP_SUBTRACT_CONSTANT",
+    [OP_LESS_CONSTANT] = "OP_LESS_CONSTANT",
+    [OP_GREATER_CONSTANT] = "OP_GREATER_CONSTANT",
+    [OP_EQUAL_CONSTANT] = "OP_EQUAL_CONSTANT",
+    [OP_LOCAL_ADD_CONSTANT] = "OP_LOCAL_ADD_CONSTANT",
+    [OP_LOCAL_SUBTRACT_CONSTANT] = "OP_LOCAL_SUBTRACT_CONSTANT",
+    [OP_LOCAL_LESS_CONSTANT] = "OP_LOCAL_LESS_CONSTANT",
+    [OP_SET_LOCAL_POP] = "OP_SET_LOCAL_POP",
+    [OP_POP_JUMP_IF_FALSE] = "OP_POP_JUMP_IF_FALSE",
+    [OP_POP_JUMP_IF_TRUE] = "OP_POP_JUMP_IF_TRUE",
+    [OP_JUMP_IF_FALSE_OR_POP] = "OP_JUMP_IF_FALSE_OR_POP",
+    [OP_JUMP_IF_TRUE_OR_POP] = "OP_JUMP_IF_TRUE_OR_POP",
+    [OP_JUMP_IF_NOT_LESS] = "OP_JUMP_IF_NOT_LESS",
+    [OP_JUMP_IF_NOT_GREATER] = "OP_JUMP_IF_NOT_GREATER",
+    [OP_JUMP_IF_NOT_EQUAL] = "OP_JUMP_IF_NOT_EQUAL",
+    [OP_JUMP_IF_LOCAL_NOT_LESS_CONSTANT] = "OP_JUMP_IF_LOCAL_NOT_LESS_CONSTANT",
+};
+
+#define TRIPLE_TABLE_SIZE (1 << 14)
+
+static ZUInt64 pairCounts[UINT8_COUNT][UINT8_COUNT];
+static ZUInt32 tripleKeys[TRIPLE_TABLE_SIZE];   // (a << 16 | b << 8 | c) + 1, 0 is empty
+static ZUInt64 tripleCounts[TRIPLE_TABLE_SIZE];
+static ZInt32 history[2] = {-1, -1};           // the two previous opcodes, -1 before the first
+
+static const ZChar *opcodeName(ZInt32 instruction)
+{
+    const ZInt32 count = (ZInt32)(sizeof(opcodeNames) / sizeof(opcodeNames[0]));
+    if (instruction < count && NULL != opcodeNames[instruction])
+    {
+        return opcodeNames[instruction];
+    }
+    return "OP_INCONNU";
+}
+
+void profileInstruction(ZUInt8 instruction)
+{
+    if (history[1] >= 0)
+    {
+        pairCounts[history[1]][instruction]++;
+    }
+    if (history[0] >= 0)
+    {
+        ZUInt32 key = (((ZUInt32)history[0] << 16) | ((ZUInt32)history[1] << 8) | instruction) + 1;
+        ZUInt32 index = (key * 2654435761u) & (TRIPLE_TABLE_SIZE - 1);
+        while (tripleKeys[index] != 0 && tripleKeys[index] != key)
+        {
+            index = (index + 1) & (TRIPLE_TABLE_SIZE - 1);
+        }
+        tripleKeys[index] = key;
+        tripleCounts[index]++;
+    }
+    history[0] = history[1];
+    history[1] = instruction;
+}
+
+void dumpOpcodeProfile()
+{
+    for (ZInt32 a = 0; a < UINT8_COUNT; a++)
+    {
+        for (ZInt32 b = 0; b < UINT8_COUNT; b++)
+        {
+            if (pairCounts[a][b] != 0)
+            {
+                fprintf(stderr, "paire %llu %s %s\n",
+                        (unsigned long long)pairCounts[a][b], opcodeName(a), opcodeName(b));
+            }
+        }
+    }
+    for (ZInt32 i = 0; i < TRIPLE_TABLE_SIZE; i++)
+    {
+        if (tripleKeys[i] != 0)
+        {
+            ZUInt32 key = tripleKeys[i] - 1;
+            fprintf(stderr, "triplet %llu %s %s %s\n", (unsigned long long)tripleCounts[i],
+                    opcodeName(key >> 16), opcodeName((key >> 8) & 0xff), opcodeName(key & 0xff));
+        }
+    }
+}
+#endif
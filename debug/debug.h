@@ -7,4 +7,9 @@
 void disassembleChunk(Chunk* chunk, const ZChar* name);
 ZInt32 disassembleInstruction(Chunk* chunk, ZInt32 offset);
 
+#ifdef PROFILE_OPCODES
+void profileInstruction(ZUInt8 instruction);
+void dumpOpcodeProfile();
+#endif
+
 #endif
\ No newline at end of file
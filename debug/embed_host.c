@@ -0,0 +1,131 @@
+/*
+@Note: A small host program for the embedding API of embed.h: it defines
+       a native of its own, compiles scripts once, runs them again and
+       again with and without resetGlobals(), and checks what they print.
+       Exits with 0 when every check passes.
+           make embed-host
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/common.h"
+#include "embed/embed.h"
+#include "vm/vm.h"
+
+#ifdef DEBUG_PRINT_CODE
+ZBool FLAG_PRINT_CODE = false;
+#endif
+
+#ifdef DEBUG_TRACE_EXECUTION
+ZBool FLAG_TRACE_EXECUTION = false;
+#endif
+
+#ifdef DEBUG_LOG_GC
+ZBool FLAG_LOG_GC = false;
+#endif
+
+static ZInt32 request = 0;   // what the host hands to the script through 'requete'
+static ZInt32 failures = 0;
+
+static Value requestNative(VM *vm, ZInt32 argCount, Value *args)
+{
+    return INT_VAL(request);
+}
+
+// what the VM printed since the last call, compared with 'expected'
+static void expectOutput(VM *host, ZChar **output, size_t *length, const ZChar *what, const ZChar *expected)
+{
+    fflush(host->out);
+    if (strlen(expected) != *length || 0 != memcmp(*output, expected, *length))
+    {
+        fprintf(stderr, "ÉCHEC %s: attendu \"%s\", obtenu \"%.*s\"\n", what, expected, (int)*length, *output);
+        failures++;
+    }
+    fclose(host->out);
+    free(*output);
+    host->out = open_memstream(output, length);
+}
+
+static void expectResult(const ZChar *what, InterpretResult result, InterpretResult expected)
+{
+    if (result != expected)
+    {
+        fprintf(stderr, "ÉCHEC %s: résultat %d au lieu de %d\n", what, result, expected);
+        failures++;
+    }
+}
+
+static void runHost()
+{
+    VM host;
+    initVM(&host);
+    defineNative(&host, "requete", requestNative);
+
+    ZChar *output = NULL;
+    size_t length = 0;
+    ZChar *errors = NULL;
+    size_t errorsLength = 0;
+    host.out = open_memstream(&output, &length);
+    host.err = open_memstream(&errors, &errorsLength);
+
+    Program *handler = compileProgram(&host,
+        "var total = 0;\n"
+        "total = total + requete() * 10;\n"
+        "afficher total, \" \", plancher(2.5), \"\\n\";\n");
+    Program *follower = compileProgram(&host,
+        "total = total + 1;\n"
+        "afficher total, \"\\n\";\n");
+    if (NULL == handler || NULL == follower)
+    {
+        fprintf(stderr, "ÉCHEC compilation\n");
+        exit(1);
+    }
+
+    // one compilation, many runs, each from fresh globals
+    for (request = 1; request <= 3; request++)
+    {
+        resetGlobals(&host);
+        expectResult("requête", runProgram(&host, handler), INTERPRET_OK);
+    }
+    expectOutput(&host, &output, &length, "requêtes", "10 2\n20 2\n30 2\n");
+
+    // without resetGlobals() a program sees what the previous one left
+    expectResult("suite", runProgram(&host, follower), INTERPRET_OK);
+    expectResult("suite", runProgram(&host, follower), INTERPRET_OK);
+    expectOutput(&host, &output, &length, "suite", "31\n32\n");
+
+    // after it, 'total' is undefined again but 'requete' is still there
+    resetGlobals(&host);
+    expectResult("globale effacée", runProgram(&host, follower), INTERPRET_RUNTIME_ERROR);
+    request = 7;
+    expectResult("native gardée", runProgram(&host, handler), INTERPRET_OK);
+    expectOutput(&host, &output, &length, "native gardée", "70 2\n");
+
+    if (NULL != compileProgram(&host, "afficher (1;\n"))
+    {
+        fprintf(stderr, "ÉCHEC une erreur de compilation donne un programme\n");
+        failures++;
+    }
+
+    freeProgram(&host, follower);
+    freeProgram(&host, handler);
+    fclose(host.out);
+    fclose(host.err);
+    free(output);
+    free(errors);
+    freeVM(&host);
+}
+
+int main(int argc, const char *argv[])
+{
+    // twice, to check that a VM can be set up again once freed
+    runHost();
+    runHost();
+    if (0 != failures)
+    {
+        return 1;
+    }
+    printf("embed-host: tout est correct\n");
+    return 0;
+}
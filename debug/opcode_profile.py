@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""
+Rank opcode pairs and triples over a corpus of zia scripts.
+
+The interpreter must be built with the opcode profiler:
+    make build FLAGS="-DPROFILE_OPCODES" BINARY=zia_profil.out
+    python3 debug/opcode_profile.py zia_profil.out tests/
+
+Each run prints "paire <n> A B" and "triplet <n> A B C" lines on stderr;
+they are summed over every script and the most frequent ones are shown.
+"""
+import argparse
+import subprocess
+import sys
+from collections import Counter
+from glob import glob
+import os
+
+
+def collect(binary, scripts, timeout):
+    pairs, triples = Counter(), Counter()
+    for script in scripts:
+        try:
+            proc = subprocess.run([binary, script], capture_output=True, text=True,
+                                  timeout=timeout)
+        except subprocess.TimeoutExpired:
+            print(f"ignoré (trop long): {script}", file=sys.stderr)
+            continue
+        for line in proc.stderr.splitlines():
+            parts = line.split()
+            if len(parts) == 4 and parts[0] == "paire":
+                pairs[tuple(parts[2:])] += int(parts[1])
+            elif len(parts) == 5 and parts[0] == "triplet":
+                triples[tuple(parts[2:])] += int(parts[1])
+    return pairs, triples
+
+
+def report(title, counter, top):
+    total = sum(counter.values()) or 1
+    print(f"== {title} ==")
+    for sequence, count in counter.most_common(top):
+        print(f"{count:>14} {100.0 * count / total:6.2f}%  {' '.join(sequence)}")
+    print()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("binary", help="interpreter built with -DPROFILE_OPCODES")
+    parser.add_argument("paths", nargs="+", help=".zia files or directories to scan")
+    parser.add_argument("--top", type=int, default=25)
+    parser.add_argument("--timeout", type=float, default=60.0)
+    args = parser.parse_args()
+
+    scripts = []
+    for path in args.paths:
+        if os.path.isdir(path):
+            scripts += sorted(glob(os.path.join(path, "**", "*.zia"), recursive=True))
+        else:
+            scripts.append(path)
+
+    pairs, triples = collect(args.binary, scripts, args.timeout)
+    report(f"paires ({len(scripts)} scripts)", pairs, args.top)
+    report(f"triplets ({len(scripts)} scripts)", triples, args.top)
+
+
+if __name__ == "__main__":
+    main()
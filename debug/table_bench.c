@@ -0,0 +1,263 @@
+/*
+@Note: Micro-benchmark of the hash tables: table.c against the linear
+       probing table it replaced, kept below as 'legacy'. Both are filled
+       with the same keys, then timed on inserts, lookups of present keys
+       and lookups of absent ones, at several loads and two sizes (one
+       that fits in the caches, one that does not).
+           make bench-table
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common/common.h"
+#include "memory/memory.h"
+#include "object/object.h"
+#include "table/table.h"
+#include "vm/vm.h"
+
+#ifdef DEBUG_PRINT_CODE
+ZBool FLAG_PRINT_CODE = false;
+#endif
+
+#ifdef DEBUG_TRACE_EXECUTION
+ZBool FLAG_TRACE_EXECUTION = false;
+#endif
+
+#ifdef DEBUG_LOG_GC
+ZBool FLAG_LOG_GC = false;
+#endif
+
+#define BENCH_LOOKUPS 4000000  // lookups timed per measure, whatever the table size
+
+// --- the previous table: modulo, linear probing, grown at 3/4 ---
+
+#define LEGACY_MAX_LOAD 0.75
+
+typedef struct
+{
+    ZInt32 count;
+    ZInt32 capacity;
+    Entry* entries;
+}LegacyTable;
+
+static Entry* legacyFindEntry(Entry* entries, ZInt32 capacity, ObjString* key)
+{
+    ZUInt32 index = key->hash % capacity;
+    Entry* tombStone = NULL;
+    for (;;)
+    {
+        Entry* entry = &entries[index];
+        if (NULL == entry->key)
+        {
+            if (IS_NIL(entry->value))
+            {
+                return NULL != tombStone ? tombStone : entry;
+            }
+            if (NULL == tombStone)
+            {
+                tombStone = entry;
+            }
+        }
+        else if (entry->key == key)
+        {
+            return entry;
+        }
+        index = (index + 1) % capacity;
+    }
+}
+
+static void legacyAdjustCapacity(LegacyTable* table, ZInt32 capacity)
+{
+    Entry* entries = (Entry*)malloc(sizeof(Entry) * capacity);
+    for (ZInt32 i = 0; i < capacity; i++)
+    {
+        entries[i].key = NULL;
+        entries[i].value = NUL_VAL;
+    }
+
+    table->count = 0;
+    for (ZInt32 i = 0; i < table->capacity; i++)
+    {
+        Entry* entry = &table->entries[i];
+        if (NULL == entry->key)
+        {
+            continue;
+        }
+        *legacyFindEntry(entries, capacity, entry->key) = *entry;
+        table->count++;
+    }
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+__attribute__((noinline)) static void legacySet(LegacyTable* table, ObjString* key, Value value)
+{
+    if (table->count + 1 > table->capacity * LEGACY_MAX_LOAD)
+    {
+        legacyAdjustCapacity(table, GROW_CAPACITY(table->capacity));
+    }
+    Entry* entry = legacyFindEntry(table->entries, table->capacity, key);
+    if (NULL == entry->key && IS_NIL(entry->value))
+    {
+        table->count++;
+    }
+    entry->key = key;
+    entry->value = value;
+}
+
+__attribute__((noinline)) static ZBool legacyGet(LegacyTable* table, ObjString* key, Value* value)
+{
+    if (table->count == 0)
+    {
+        return ZFALSE;
+    }
+    Entry* entry = legacyFindEntry(table->entries, table->capacity, key);
+    if (NULL == entry->key)
+    {
+        return ZFALSE;
+    }
+    *value = entry->value;
+    return ZTRUE;
+}
+
+// --- keys ---
+
+// a string laid out as the VM's own but outside the collected heap, so no collection can free it
+static ObjString* benchKey(const ZChar* prefix, ZInt32 number)
+{
+    ZChar text[32];
+    ZInt32 length = snprintf(text, sizeof(text), "%s%d", prefix, number);
+    ObjString* key = (ObjString*)calloc(1, sizeof(ObjString) + length + 1);
+    key->obj.type = OBJ_STRING;
+    key->length = length;
+    key->chars = key->inlineChars;
+    memcpy(key->chars, text, length + 1);
+    stringHash(key);
+    return key;
+}
+
+static ZInt64 nowNanos()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ZInt64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static ZReal64 nanosPer(ZInt64 start, ZInt64 count)
+{
+    return (ZReal64)(nowNanos() - start) / count;
+}
+
+// sums what the lookups found, so the compiler cannot drop them
+static volatile ZInt64 benchSink;
+
+static void benchLoad(ObjString** keys, ObjString** absent, ZInt32 count)
+{
+    Table table;
+    LegacyTable legacy = { 0, 0, NULL };
+    initTable(&table);
+    ZInt32 rounds = BENCH_LOOKUPS / count + 1;
+    ZInt64 found = 0;
+    Value value;
+
+    ZInt64 start = nowNanos();
+    for (ZInt32 i = 0; i < count; i++)
+    {
+        tableSet(&table, keys[i], INT_VAL(i));
+    }
+    ZReal64 insert = nanosPer(start, count);
+    start = nowNanos();
+    for (ZInt32 i = 0; i < count; i++)
+    {
+        legacySet(&legacy, keys[i], INT_VAL(i));
+    }
+    ZReal64 legacyInsert = nanosPer(start, count);
+
+    start = nowNanos();
+    for (ZInt32 r = 0; r < rounds; r++)
+    {
+        for (ZInt32 i = 0; i < count; i++)
+        {
+            found += tableGet(&table, keys[i], &value);
+        }
+    }
+    ZReal64 hit = nanosPer(start, (ZInt64)rounds * count);
+    start = nowNanos();
+    for (ZInt32 r = 0; r < rounds; r++)
+    {
+        for (ZInt32 i = 0; i < count; i++)
+        {
+            found += legacyGet(&legacy, keys[i], &value);
+        }
+    }
+    ZReal64 legacyHit = nanosPer(start, (ZInt64)rounds * count);
+
+    start = nowNanos();
+    for (ZInt32 r = 0; r < rounds; r++)
+    {
+        for (ZInt32 i = 0; i < count; i++)
+        {
+            found += tableGet(&table, absent[i], &value);
+        }
+    }
+    ZReal64 miss = nanosPer(start, (ZInt64)rounds * count);
+    start = nowNanos();
+    for (ZInt32 r = 0; r < rounds; r++)
+    {
+        for (ZInt32 i = 0; i < count; i++)
+        {
+            found += legacyGet(&legacy, absent[i], &value);
+        }
+    }
+    ZReal64 legacyMiss = nanosPer(start, (ZInt64)rounds * count);
+    benchSink += found;
+
+    printf("%8d  %5.1f%% %5.1f%%  %7.1f %7.1f  %7.1f %7.1f  %7.1f %7.1f\n", count,
+           100.0 * count / table.capacity, 100.0 * count / legacy.capacity,
+           insert, legacyInsert, hit, legacyHit, miss, legacyMiss);
+
+    freeTable(&table);
+    free(legacy.entries);
+}
+
+int main(int argc, const char* argv[])
+{
+    static VM benchVM;
+    initVM(&benchVM);
+
+    // table sizes, then the share of each filled before it is measured
+    const ZInt32 capacities[] = { 8 * 1024, 128 * 1024 };
+    const ZReal64 loads[] = { 0.25, 0.5, 0.7, 0.85 };
+    ZInt32 maxCount = capacities[1];
+
+    ObjString** keys = (ObjString**)malloc(sizeof(ObjString*) * maxCount);
+    ObjString** absent = (ObjString**)malloc(sizeof(ObjString*) * maxCount);
+    for (ZInt32 i = 0; i < maxCount; i++)
+    {
+        keys[i] = benchKey("cle-", i);
+        absent[i] = benchKey("absente-", i);
+    }
+
+    printf("ns par opération, table actuelle puis ancienne\n");
+    printf("%8s  %13s  %15s  %15s  %15s\n", "clés", "charge", "insertion", "trouvée", "absente");
+    for (ZInt32 c = 0; c < 2; c++)
+    {
+        for (ZInt32 l = 0; l < 4; l++)
+        {
+            benchLoad(keys, absent, (ZInt32)(capacities[c] * loads[l]));
+        }
+    }
+
+    for (ZInt32 i = 0; i < maxCount; i++)
+    {
+        free(keys[i]);
+        free(absent[i]);
+    }
+    free(keys);
+    free(absent);
+    freeVM(&benchVM);
+    return 0;
+}
@@ -0,0 +1,436 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batch/batch.h"
+#include "cache/cache.h"
+#include "compiler/compiler.h"
+#include "image/image.h"
+#include "memory/memory.h"
+#include "vm/vm.h"
+
+#define BATCH_MAX_JOBS 256
+
+void initBatchList(BatchList* list)
+{
+    list->paths = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+void freeBatchList(BatchList* list)
+{
+    for (ZInt32 i = 0; i < list->count; i++)
+    {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    initBatchList(list);
+}
+
+void addBatchPath(BatchList* list, const ZChar* path)
+{
+    if (list->capacity < list->count + 1)
+    {
+        list->capacity = GROW_CAPACITY(list->capacity);
+        list->paths = (ZChar**)realloc(list->paths, sizeof(ZChar*) * list->capacity);
+    }
+    ZChar* copy = strdup(path);
+    if (NULL == list->paths || NULL == copy)
+    {
+        exit(1);
+    }
+    list->paths[list->count++] = copy;
+}
+
+// one path per line; blank lines and lines starting with '#' are skipped
+ZBool addBatchManifest(BatchList* list, const ZChar* manifest)
+{
+    FILE* file = fopen(manifest, "r");
+    if (NULL == file)
+    {
+        fprintf(stderr, "Impossible d'ouvrir la liste \"%s\".\n", manifest);
+        return ZFALSE;
+    }
+
+    ZChar line[4096];
+    while (NULL != fgets(line, sizeof(line), file))
+    {
+        size_t length = strcspn(line, "\r\n");
+        line[length] = '\0';
+        if (0 == length || '#' == line[0])
+        {
+            continue;
+        }
+        addBatchPath(list, line);
+    }
+    fclose(file);
+    return ZTRUE;
+}
+
+// the whole file, NULL once the error is reported on 'err'
+static ZChar* readFile(FILE* err, const ZChar* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (NULL == file)
+    {
+        fprintf(err, "Impossible d'ouvrir le fichier \"%s\".\n", path);
+        return NULL;
+    }
+
+    //Moves the file cursor to the end of the file so we can measure its size.
+    fseek(file, 0L, SEEK_END);
+    //Returns the current position of the cursor — which, since we are at the end, gives the total file size in bytes.
+    size_t fileSize = ftell(file);
+    //Moves the file cursor back to the beginning, so we can read from the start.
+    rewind(file);
+
+    ZChar* buffer = (ZChar*)malloc(fileSize + 1);
+    if (NULL == buffer)
+    {
+        fprintf(err, "Mémoire insuffisante pour lire \"%s\".\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    size_t bytesRead = fread(buffer, sizeof(ZChar), fileSize, file);
+    fclose(file);
+    if (bytesRead < fileSize)
+    {
+        fprintf(err, "Impossible de lire le fichier \"%s\".\n", path);
+        free(buffer);
+        return NULL;
+    }
+
+    buffer[bytesRead] = '\0';
+    return buffer;
+}
+
+ZInt32 runScript(VM* context, const ZChar* path, ZBool useCache)
+{
+    if (ZTRUE == isImagePath(path))
+    {
+        ObjClosure* entry = loadImage(context, path);
+        if (NULL == entry)
+        {
+            fprintf(context->err, "Impossible de charger l'image \"%s\".\n", path);
+            return 74;
+        }
+        return INTERPRET_RUNTIME_ERROR == interpretClosure(context, entry) ? 70 : 0;
+    }
+
+    ZChar* source = readFile(context->err, path);
+    if (NULL == source)
+    {
+        return 74;
+    }
+
+    ObjFunction* function = (ZTRUE == useCache) ? loadCache(context, path, source) : NULL;
+    if (NULL == function)
+    {
+        function = compile(context, source);
+        if (NULL == function)
+        {
+            free(source);
+            return 65;
+        }
+        if (ZTRUE == useCache)
+        {
+            writeCache(context, path, source, function);
+        }
+    }
+    InterpretResult result = interpretFunction(context, function);
+    free(source);
+
+    return INTERPRET_RUNTIME_ERROR == result ? 70 : 0;
+}
+
+// --- batch ---
+
+static ZInt64 batchNanos()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ZInt64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+typedef struct
+{
+    const ZChar* path;
+    ZInt32 status;
+    ZChar* out;           // what the script printed, kept until it is written out in order
+    size_t outLength;
+    ZChar* err;
+    size_t errLength;
+    ZInt64 nanos;
+    ZBool done;           // under Batch.lock
+}BatchScript;
+
+/*
+@Note: Each worker starts with an equal run of consecutive scripts, which
+       it takes from the front. A worker whose run is used up steals the
+       back half of the longest run left, so the scripts near the front,
+       whose output is written first, keep going first.
+*/
+typedef struct
+{
+    pthread_mutex_t lock;
+    ZInt32 next;          // first script of the run not taken yet
+    ZInt32 end;           // one past the last script of the run
+}BatchQueue;
+
+typedef struct Batch Batch;
+
+typedef struct
+{
+    Batch* batch;
+    ZInt32 self;
+    pthread_t thread;
+}BatchWorker;
+
+struct Batch
+{
+    BatchScript* scripts;
+    ZInt32 count;
+    BatchQueue* queues;
+    BatchWorker* workers;
+    ZInt32 jobs;
+    const VM* settings;
+    ZBool useCache;
+    pthread_mutex_t lock;
+    pthread_cond_t done;  // signaled whenever a script is done
+};
+
+static ZInt32 takeScript(BatchQueue* queue)
+{
+    ZInt32 index = -1;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->next < queue->end)
+    {
+        index = queue->next;
+        __atomic_store_n(&queue->next, index + 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return index;
+}
+
+// moves the back half of the longest other run into ours, ZFALSE once there is nothing left
+static ZBool stealScripts(Batch* batch, ZInt32 self)
+{
+    for (;;)
+    {
+        ZInt32 victim = -1;
+        ZInt32 longest = 0;
+        for (ZInt32 i = 0; i < batch->jobs; i++)
+        {
+            BatchQueue* queue = &batch->queues[i];
+            ZInt32 left = __atomic_load_n(&queue->end, __ATOMIC_SEQ_CST) - __atomic_load_n(&queue->next, __ATOMIC_SEQ_CST);
+            if (i != self && left > longest)
+            {
+                victim = i;
+                longest = left;
+            }
+        }
+        if (victim < 0)
+        {
+            return ZFALSE;
+        }
+
+        BatchQueue* queue = &batch->queues[victim];
+        pthread_mutex_lock(&queue->lock);
+        ZInt32 end = queue->end;
+        ZInt32 start = end - (end - queue->next) / 2;
+        if (start == end && queue->next < end)
+        {
+            start = end - 1;  // the last script of a run can be stolen as well
+        }
+        __atomic_store_n(&queue->end, start, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&queue->lock);
+
+        if (start < end)
+        {
+            BatchQueue* own = &batch->queues[self];
+            pthread_mutex_lock(&own->lock);
+            __atomic_store_n(&own->next, start, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&own->end, end, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&own->lock);
+            return ZTRUE;
+        }
+        // another worker got there first, look again
+    }
+}
+
+static void runBatchScript(Batch* batch, BatchScript* script, VM* context)
+{
+    FILE* out = open_memstream(&script->out, &script->outLength);
+    FILE* err = open_memstream(&script->err, &script->errLength);
+    if (NULL == out || NULL == err)
+    {
+        exit(1);
+    }
+
+    ZInt64 start = batchNanos();
+    initVM(context);
+    context->gcInitialHeap = batch->settings->gcInitialHeap;
+    context->nextGC = context->gcInitialHeap;
+    context->gcGrowthFactor = batch->settings->gcGrowthFactor;
+    context->gcStepBudget = batch->settings->gcStepBudget;
+    context->gcThreads = batch->settings->gcThreads;
+    context->out = out;
+    context->err = err;
+    ZInt32 status = runScript(context, script->path, batch->useCache);
+    freeVM(context);
+    ZInt64 nanos = batchNanos() - start;
+    fclose(out);
+    fclose(err);
+
+    pthread_mutex_lock(&batch->lock);
+    script->status = status;
+    script->nanos = nanos;
+    script->done = ZTRUE;
+    pthread_cond_broadcast(&batch->done);
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static void* batchWorker(void* argument)
+{
+    BatchWorker* worker = (BatchWorker*)argument;
+    Batch* batch = worker->batch;
+
+    // the VM is reinitialized for every script, only its memory is reused
+    VM* context = (VM*)malloc(sizeof(VM));
+    if (NULL == context)
+    {
+        exit(1);
+    }
+    for (;;)
+    {
+        ZInt32 index = takeScript(&batch->queues[worker->self]);
+        if (index < 0)
+        {
+            if (ZFALSE == stealScripts(batch, worker->self))
+            {
+                break;
+            }
+            continue;
+        }
+        runBatchScript(batch, &batch->scripts[index], context);
+    }
+    free(context);
+    return NULL;
+}
+
+// writes the output of each script in order, as soon as it and those before it are done
+static void writeOutputs(Batch* batch)
+{
+    for (ZInt32 i = 0; i < batch->count; i++)
+    {
+        BatchScript* script = &batch->scripts[i];
+        pthread_mutex_lock(&batch->lock);
+        while (ZFALSE == script->done)
+        {
+            pthread_cond_wait(&batch->done, &batch->lock);
+        }
+        pthread_mutex_unlock(&batch->lock);
+
+        fwrite(script->out, 1, script->outLength, stdout);
+        fflush(stdout);
+        fwrite(script->err, 1, script->errLength, stderr);
+        free(script->out);
+        free(script->err);
+        script->out = NULL;
+        script->err = NULL;
+    }
+}
+
+static ZInt32 writeReport(Batch* batch, ZInt32 started, ZInt64 nanos)
+{
+    ZInt32 status = 0;
+    ZInt32 failed = 0;
+    fprintf(stderr, "-- lot: %d scripts, %d threads, %.1f ms --\n", batch->count, started, nanos / 1e6);
+    for (ZInt32 i = 0; i < batch->count; i++)
+    {
+        BatchScript* script = &batch->scripts[i];
+        fprintf(stderr, "%3d %10.3f ms  %s\n", script->status, script->nanos / 1e6, script->path);
+        if (0 != script->status)
+        {
+            failed++;
+            status = script->status > status ? script->status : status;
+        }
+    }
+    fprintf(stderr, "-- %d réussis, %d en échec --\n", batch->count - failed, failed);
+    return status;
+}
+
+ZInt32 runBatch(BatchList* list, ZInt32 jobs, const VM* settings, ZBool useCache)
+{
+    if (0 == list->count)
+    {
+        return 0;
+    }
+    jobs = jobs < 1 ? 1 : (jobs > BATCH_MAX_JOBS ? BATCH_MAX_JOBS : jobs);
+    jobs = jobs > list->count ? list->count : jobs;
+
+    Batch batch;
+    batch.count = list->count;
+    batch.jobs = jobs;
+    batch.settings = settings;
+    batch.useCache = useCache;
+    batch.scripts = (BatchScript*)calloc(list->count, sizeof(BatchScript));
+    batch.queues = (BatchQueue*)calloc(jobs, sizeof(BatchQueue));
+    batch.workers = (BatchWorker*)calloc(jobs, sizeof(BatchWorker));
+    if (NULL == batch.scripts || NULL == batch.queues || NULL == batch.workers)
+    {
+        exit(1);
+    }
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.done, NULL);
+    for (ZInt32 i = 0; i < list->count; i++)
+    {
+        batch.scripts[i].path = list->paths[i];
+    }
+    for (ZInt32 i = 0; i < jobs; i++)
+    {
+        pthread_mutex_init(&batch.queues[i].lock, NULL);
+        batch.queues[i].next = (ZInt32)((ZInt64)list->count * i / jobs);
+        batch.queues[i].end = (ZInt32)((ZInt64)list->count * (i + 1) / jobs);
+        batch.workers[i].batch = &batch;
+        batch.workers[i].self = i;
+    }
+
+    ZInt64 start = batchNanos();
+    ZInt32 started = 0;
+    for (ZInt32 i = 0; i < jobs; i++)
+    {
+        if (0 != pthread_create(&batch.workers[i].thread, NULL, batchWorker, &batch.workers[i]))
+        {
+            // the runs of the workers that did not start are stolen by the others
+            break;
+        }
+        started++;
+    }
+    if (0 == started)
+    {
+        batchWorker(&batch.workers[0]);
+    }
+
+    writeOutputs(&batch);
+    for (ZInt32 i = 0; i < started; i++)
+    {
+        pthread_join(batch.workers[i].thread, NULL);
+    }
+    ZInt32 status = writeReport(&batch, started > 0 ? started : 1, batchNanos() - start);
+
+    for (ZInt32 i = 0; i < jobs; i++)
+    {
+        pthread_mutex_destroy(&batch.queues[i].lock);
+    }
+    pthread_mutex_destroy(&batch.lock);
+    pthread_cond_destroy(&batch.done);
+    free(batch.scripts);
+    free(batch.queues);
+    free(batch.workers);
+    return status;
+}
@@ -0,0 +1,33 @@
+#ifndef ZIA_BATCH_H
+#define ZIA_BATCH_H
+
+#include "common/common.h"
+#include "common/commonTypes.h"
+#include "vm/vm.h"
+
+/*
+@Note: Batch mode, zia --batch [--jobs=<n>] a.zia b.zia @liste: many
+       scripts run on a pool of threads, each in a VM of its own. What a
+       script prints is kept aside and written out in the order the
+       scripts were given, once every script before it is done, followed
+       by a report of the exit status and the time of each one.
+*/
+typedef struct
+{
+    ZChar** paths;     // copies, freed with the list
+    ZInt32 count;
+    ZInt32 capacity;
+}BatchList;
+
+void initBatchList(BatchList* list);
+void freeBatchList(BatchList* list);
+void addBatchPath(BatchList* list, const ZChar* path);
+ZBool addBatchManifest(BatchList* list, const ZChar* manifest);
+
+// exit code of one script or image run in 'context': 0, 65 (compile), 70 (runtime) or 74 (unreadable)
+ZInt32 runScript(VM* context, const ZChar* path, ZBool useCache);
+
+// runs every script with the collector settings of 'settings', returns the highest exit code
+ZInt32 runBatch(BatchList* list, ZInt32 jobs, const VM* settings, ZBool useCache);
+
+#endif
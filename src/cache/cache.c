@@ -0,0 +1,501 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache/cache.h"
+#include "memory/memory.h"
+#include "value/value.h"
+#include "vm/vm.h"
+
+/*
+@Note: Layout of a .ziac file, in the byte order of the machine that wrote
+       it, which the magic number gives away:
+         CacheHeader
+         the global names, one per slot in slot order
+         the script function
+       A function is its arity, its upvalue count, its stack size, its
+       name, the count of code bytes and the bytes themselves, padding to
+       4, the line of each byte as a 32-bit integer, then its constants.
+       A constant is a kind byte and its payload; nested functions are
+       written in place, so the whole file is read front to back. Strings
+       are a 32-bit length and their bytes, CACHE_NO_STRING standing for a
+       missing name.
+       Upvalue descriptors are operands of OP_CLOSURE: they are part of
+       the code. Bytecode does not survive a change of opcodes, so
+       CACHE_VERSION has to be bumped along with them. Nor does it survive
+       a change of hashString(): OP_SWITCH_STRING tables are sorted by the
+       hash of their keys. The header keeps hashFingerprint() for that.
+*/
+#define CACHE_MAGIC     0x4341495au  // "ZIAC" read as a little-endian word
+#define CACHE_VERSION   4
+#define CACHE_NO_STRING 0xffffffffu
+#define CACHE_MAX_DEPTH 256          // nesting of functions a file may claim
+
+// builds whose Values are laid out differently do not share a cache
+#ifdef NAN_BOXING
+#define CACHE_BUILD 1
+#else
+#define CACHE_BUILD 0
+#endif
+
+typedef struct
+{
+    ZUInt32 magic;
+    ZUInt32 version;
+    ZUInt32 build;
+    ZUInt32 globalCount;
+    ZUInt32 hashes;          // hashFingerprint() of the writer
+    ZUInt32 unused;
+    ZUInt64 sourceLength;
+    ZUInt64 sourceHash;
+}CacheHeader;
+
+typedef enum
+{
+    CACHE_NUL,
+    CACHE_TRUE,
+    CACHE_FALSE,
+    CACHE_REAL,
+    CACHE_INT,
+    CACHE_STRING,
+    CACHE_FUNCTION,
+}CacheConstant;
+
+// FNV-1a over the whole source: much cheaper than compiling it
+static ZUInt64 hashSource(const ZChar* source, size_t length)
+{
+    ZUInt64 hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (ZUInt8)source[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static void fillHeader(CacheHeader* header, const ZChar* source)
+{
+    memset(header, 0, sizeof(CacheHeader));
+    header->magic = CACHE_MAGIC;
+    header->version = CACHE_VERSION;
+    header->build = CACHE_BUILD;
+    header->hashes = hashFingerprint();
+    header->sourceLength = strlen(source);
+    header->sourceHash = hashSource(source, header->sourceLength);
+}
+
+// the cache of "x.zia" is "x.ziac"; other names are not cached
+static ZBool cachePath(const ZChar* path, ZChar* cached, size_t size)
+{
+    size_t length = strlen(path);
+    if (length < 4 || 0 != strcmp(path + length - 4, ".zia") || length + 2 > size)
+    {
+        return ZFALSE;
+    }
+    memcpy(cached, path, length);
+    cached[length] = 'c';
+    cached[length + 1] = NULL_CHAR;
+    return ZTRUE;
+}
+
+// --- writing ---
+
+typedef struct
+{
+    FILE* file;
+    size_t offset;
+    ZBool failed;
+}CacheWriter;
+
+static void writeBytes(CacheWriter* writer, const void* bytes, size_t count)
+{
+    if (count > 0 && fwrite(bytes, 1, count, writer->file) != count)
+    {
+        writer->failed = ZTRUE;
+    }
+    writer->offset += count;
+}
+
+static void writeU32(CacheWriter* writer, ZUInt32 value)
+{
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writePadding(CacheWriter* writer)
+{
+    static const ZUInt8 zeros[4] = { 0 };
+    writeBytes(writer, zeros, (4 - writer->offset % 4) % 4);
+}
+
+static void writeString(CacheWriter* writer, ObjString* string)
+{
+    if (NULL == string)
+    {
+        writeU32(writer, CACHE_NO_STRING);
+        return;
+    }
+    writeU32(writer, (ZUInt32)string->length);
+    writeBytes(writer, flattenString(string)->chars, string->length);
+}
+
+static void writeFunction(CacheWriter* writer, ObjFunction* function);
+
+static void writeConstant(CacheWriter* writer, Value value)
+{
+    ZUInt8 kind;
+    if (IS_NIL(value))
+    {
+        kind = CACHE_NUL;
+        writeBytes(writer, &kind, 1);
+    }
+    else if (IS_BOOL(value))
+    {
+        kind = AS_BOOL(value) ? CACHE_TRUE : CACHE_FALSE;
+        writeBytes(writer, &kind, 1);
+    }
+    else if (IS_INT(value))
+    {
+        ZInt64 integer = AS_INT(value);
+        kind = CACHE_INT;
+        writeBytes(writer, &kind, 1);
+        writeBytes(writer, &integer, sizeof(integer));
+    }
+    else if (IS_REAL(value))
+    {
+        ZReal64 real = AS_REAL(value);
+        kind = CACHE_REAL;
+        writeBytes(writer, &kind, 1);
+        writeBytes(writer, &real, sizeof(real));
+    }
+    else if (IS_STRING(value))
+    {
+        kind = CACHE_STRING;
+        writeBytes(writer, &kind, 1);
+        writeString(writer, AS_STRING(value));
+    }
+    else if (IS_FUNCTION(value))
+    {
+        kind = CACHE_FUNCTION;
+        writeBytes(writer, &kind, 1);
+        writeFunction(writer, AS_FUNCTION(value));
+    }
+    else
+    {
+        // nothing else comes out of the compiler; such a file would not load anyway
+        writer->failed = ZTRUE;
+    }
+}
+
+static void writeFunction(CacheWriter* writer, ObjFunction* function)
+{
+    Chunk* chunk = &function->chunk;
+    writeU32(writer, (ZUInt32)function->arity);
+    writeU32(writer, (ZUInt32)function->upvalueCount);
+    writeU32(writer, (ZUInt32)function->maxStack);
+    writeString(writer, function->name);
+    writeU32(writer, (ZUInt32)chunk->count);
+    writeBytes(writer, chunk->code, chunk->count);
+    writePadding(writer);
+    writeBytes(writer, chunk->lines, sizeof(ZInt32) * chunk->count);
+    writeU32(writer, (ZUInt32)chunk->constants.count);
+    for (ZInt32 i = 0; i < chunk->constants.count; i++)
+    {
+        writeConstant(writer, chunk->constants.values[i]);
+    }
+}
+
+/*
+@Note: The file is written under a temporary name and renamed into place,
+       so a script started meanwhile sees the old cache or the new one,
+       never half of it. A directory we cannot write to just means no cache.
+*/
+void writeCache(VM* context, const ZChar* path, const ZChar* source, ObjFunction* function)
+{
+    ZChar cached[4096];
+    ZChar temporary[4096 + 32];
+    if (!cachePath(path, cached, sizeof(cached)))
+    {
+        return;
+    }
+    // unique per process and per write: threads of a --batch may write the same cache at once
+    static ZInt32 writes = 0;
+    snprintf(temporary, sizeof(temporary), "%s.%ld.%d", cached, (long)getpid(),
+             __atomic_add_fetch(&writes, 1, __ATOMIC_SEQ_CST));
+
+    CacheWriter writer = { fopen(temporary, "wb"), 0, ZFALSE };
+    if (NULL == writer.file)
+    {
+        return;
+    }
+
+    CacheHeader header;
+    fillHeader(&header, source);
+    header.globalCount = (ZUInt32)context->globalNames.count;
+    writeBytes(&writer, &header, sizeof(header));
+    for (ZInt32 i = 0; i < context->globalNames.count; i++)
+    {
+        writeString(&writer, AS_STRING(context->globalNames.values[i]));
+    }
+    VM* previous = vm;
+    vm = context;
+    writeFunction(&writer, function);
+    vm = previous;
+
+    if (0 != fclose(writer.file) || ZTRUE == writer.failed || 0 != rename(temporary, cached))
+    {
+        remove(temporary);
+    }
+}
+
+// --- reading ---
+
+typedef struct
+{
+    const ZUInt8* start;
+    const ZUInt8* current;
+    const ZUInt8* end;
+    ZBool failed;
+}CacheReader;
+
+// the next 'count' bytes of the file, NULL once it is found truncated
+static const ZUInt8* readBytes(CacheReader* reader, size_t count)
+{
+    if (ZTRUE == reader->failed || (size_t)(reader->end - reader->current) < count)
+    {
+        reader->failed = ZTRUE;
+        return NULL;
+    }
+    const ZUInt8* bytes = reader->current;
+    reader->current += count;
+    return bytes;
+}
+
+static ZUInt32 readU32(CacheReader* reader)
+{
+    ZUInt32 value = 0;
+    const ZUInt8* bytes = readBytes(reader, sizeof(value));
+    if (NULL != bytes)
+    {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+static void skipPadding(CacheReader* reader)
+{
+    readBytes(reader, (4 - (size_t)(reader->current - reader->start) % 4) % 4);
+}
+
+// an interned string, as the compiler would have made it; NULL for none or on error
+static ObjString* readString(CacheReader* reader)
+{
+    ZUInt32 length = readU32(reader);
+    if (CACHE_NO_STRING == length)
+    {
+        return NULL;
+    }
+    const ZUInt8* chars = readBytes(reader, length);
+    return NULL != chars ? copyString((const ZChar*)chars, (ZInt32)length) : NULL;
+}
+
+static ObjFunction* readFunction(CacheReader* reader, ZInt32 depth);
+
+static Value readConstant(CacheReader* reader, ZInt32 depth)
+{
+    const ZUInt8* kind = readBytes(reader, 1);
+    if (NULL == kind)
+    {
+        return NUL_VAL;
+    }
+
+    switch (*kind)
+    {
+    case CACHE_NUL:
+        return NUL_VAL;
+    case CACHE_TRUE:
+        return BOOL_VAL(ZTRUE);
+    case CACHE_FALSE:
+        return BOOL_VAL(ZFALSE);
+    case CACHE_INT:
+    case CACHE_REAL:
+    {
+        const ZUInt8* bytes = readBytes(reader, 8);
+        if (NULL == bytes)
+        {
+            return NUL_VAL;
+        }
+        if (CACHE_INT == *kind)
+        {
+            ZInt64 integer;
+            memcpy(&integer, bytes, sizeof(integer));
+            if (!INT_FITS(integer))
+            {
+                reader->failed = ZTRUE;
+                return NUL_VAL;
+            }
+            return INT_VAL(integer);
+        }
+        ZReal64 real;
+        memcpy(&real, bytes, sizeof(real));
+        return NUMBER_VAL(real);
+    }
+    case CACHE_STRING:
+    {
+        ObjString* string = readString(reader);
+        if (NULL == string)
+        {
+            reader->failed = ZTRUE;
+            return NUL_VAL;
+        }
+        return OBJ_VAL(string);
+    }
+    case CACHE_FUNCTION:
+    {
+        ObjFunction* function = readFunction(reader, depth + 1);
+        return NULL != function ? OBJ_VAL(function) : NUL_VAL;
+    }
+    default:
+        reader->failed = ZTRUE;
+        return NUL_VAL;
+    }
+}
+
+/*
+@Note: The function stays on the VM stack while its constants are built,
+       nested functions included, as any of them may start a collection.
+       Its chunk borrows the code and line bytes of the mapping.
+*/
+static ObjFunction* readFunction(CacheReader* reader, ZInt32 depth)
+{
+    if (depth > CACHE_MAX_DEPTH)
+    {
+        reader->failed = ZTRUE;
+        return NULL;
+    }
+
+    ObjFunction* function = newFunction();
+    push(OBJ_VAL(function));
+    function->arity = (ZInt32)readU32(reader);
+    function->upvalueCount = (ZInt32)readU32(reader);
+    function->maxStack = (ZInt32)readU32(reader);
+    function->name = readString(reader);
+    writeBarrier((Obj*)function, NULL != function->name ? OBJ_VAL(function->name) : NUL_VAL);
+
+    ZUInt32 count = readU32(reader);
+    const ZUInt8* code = readBytes(reader, count);
+    skipPadding(reader);
+    const ZUInt8* lines = readBytes(reader, sizeof(ZInt32) * (size_t)count);
+    if (ZTRUE == reader->failed || 0 == count || function->maxStack <= function->arity || function->maxStack > STACK_MAX)
+    {
+        reader->failed = ZTRUE;
+        pop();
+        return NULL;
+    }
+    function->chunk.code = (ZUInt8*)code;
+    function->chunk.lines = (ZInt32*)lines;
+    function->chunk.count = (ZInt32)count;
+
+    ZUInt32 constantCount = readU32(reader);
+    for (ZUInt32 i = 0; i < constantCount && ZFALSE == reader->failed; i++)
+    {
+        Value value = readConstant(reader, depth);
+        addConstant(&function->chunk, value);
+        writeBarrier((Obj*)function, value);
+    }
+
+    pop();
+    return ZTRUE == reader->failed ? NULL : function;
+}
+
+// the global slots of the file must be the ones this VM hands out for the same names
+static ZBool readGlobals(CacheReader* reader, ZUInt32 count)
+{
+    for (ZUInt32 i = 0; i < count; i++)
+    {
+        ObjString* name = readString(reader);
+        if (NULL == name || (ZInt32)i != globalSlot(name))
+        {
+            return ZFALSE;
+        }
+    }
+    return ZTRUE;
+}
+
+ObjFunction* loadCache(VM* context, const ZChar* path, const ZChar* source)
+{
+    ZChar cached[4096];
+    if (!cachePath(path, cached, sizeof(cached)))
+    {
+        return NULL;
+    }
+
+    int fd = open(cached, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    struct stat status;
+    if (0 != fstat(fd, &status) || (size_t)status.st_size < sizeof(CacheHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)status.st_size;
+    void* base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == base)
+    {
+        return NULL;
+    }
+
+    CacheHeader header;
+    CacheHeader expected;
+    memcpy(&header, base, sizeof(header));
+    fillHeader(&expected, source);
+    expected.globalCount = header.globalCount;
+
+    ObjFunction* function = NULL;
+    if (0 == memcmp(&header, &expected, sizeof(header)))
+    {
+        CacheReader reader = { (const ZUInt8*)base, (const ZUInt8*)base + sizeof(header), (const ZUInt8*)base + size, ZFALSE };
+        VM* previous = vm;
+        vm = context;
+        if (ZTRUE == readGlobals(&reader, header.globalCount))
+        {
+            function = readFunction(&reader, 0);
+        }
+        vm = previous;
+        if (reader.current != reader.end)
+        {
+            function = NULL;
+        }
+    }
+
+    MappedCache* mapping = NULL != function ? (MappedCache*)malloc(sizeof(MappedCache)) : NULL;
+    if (NULL == mapping)
+    {
+        // functions read before the failure are garbage and never run: their code can go
+        munmap(base, size);
+        return NULL;
+    }
+    mapping->base = base;
+    mapping->size = size;
+    mapping->next = context->mappedCaches;
+    context->mappedCaches = mapping;
+    return function;
+}
+
+void unmapCaches()
+{
+    while (NULL != vm->mappedCaches)
+    {
+        MappedCache* mapping = vm->mappedCaches;
+        vm->mappedCaches = mapping->next;
+        munmap(mapping->base, mapping->size);
+        free(mapping);
+    }
+}
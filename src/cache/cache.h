@@ -0,0 +1,25 @@
+#ifndef ZIA_CACHE_H
+#define ZIA_CACHE_H
+
+#include "common/common.h"
+#include "common/commonTypes.h"
+#include "object/object.h"
+#include "vm/vm.h"
+
+/*
+@Note: A compiled script is kept next to its source, "x.zia" in "x.ziac",
+       and reused as long as the source is unchanged. The loaded chunks
+       point into the mapped file, which stays mapped until freeVM().
+*/
+typedef struct MappedCache
+{
+    void* base;
+    size_t size;
+    struct MappedCache* next;
+}MappedCache;
+
+ObjFunction* loadCache(VM* context, const ZChar* path, const ZChar* source);
+void writeCache(VM* context, const ZChar* path, const ZChar* source, ObjFunction* function);
+void unmapCaches();
+
+#endif
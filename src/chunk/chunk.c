@@ -14,8 +14,11 @@ void initChunk(Chunk* chunk)
 
 void freeChunk(Chunk * chunk)
 {
-    FREE_ARRAY(ZUInt8, chunk->code, chunk->capacity);
-    FREE_ARRAY(ZUInt32, chunk->lines, chunk->capacity);
+    if (chunk->capacity > 0)
+    {
+        FREE_ARRAY(ZUInt8, chunk->code, chunk->capacity);
+        FREE_ARRAY(ZUInt32, chunk->lines, chunk->capacity);
+    }
     freeValueArray(&chunk->constants);
     initChunk(chunk);
 }
@@ -36,18 +36,44 @@ typedef enum
     OP_JUMP_IF_FALSE,
     OP_JUMP_IF_TRUE,
     OP_LOOP,
-    OP_SWITCH,
-    OP_CASE,
-    OP_DEFAULT,
+    OP_SWITCH_TABLE,
+    OP_SWITCH_SEARCH,
+    OP_SWITCH_STRING,
     OP_SWAP,
     OP_CALL,
+    OP_TAIL_CALL,
     OP_CLOSURE,
     OP_GET_UPVALUE,
     OP_SET_UPVALUE,
     OP_CLOSE_UPVALUE,
     OP_RETURN,
+
+    // superinstructions, fused by the compiler (see emitBinaryOp/emitPop)
+    OP_ADD_CONSTANT,
+    OP_SUBTRACT_CONSTANT,
+    OP_LESS_CONSTANT,
+    OP_GREATER_CONSTANT,
+    OP_EQUAL_CONSTANT,
+    OP_LOCAL_ADD_CONSTANT,
+    OP_LOCAL_SUBTRACT_CONSTANT,
+    OP_LOCAL_LESS_CONSTANT,
+    OP_SET_LOCAL_POP,
+
+    // branches that consume their test (see emitJumpIfFalsePop)
+    OP_POP_JUMP_IF_FALSE,
+    OP_POP_JUMP_IF_TRUE,
+    OP_JUMP_IF_FALSE_OR_POP,
+    OP_JUMP_IF_TRUE_OR_POP,
+    OP_JUMP_IF_NOT_LESS,
+    OP_JUMP_IF_NOT_GREATER,
+    OP_JUMP_IF_NOT_EQUAL,
+    OP_JUMP_IF_LOCAL_NOT_LESS_CONSTANT,
 }OpCode;
 
+/*
+@Note: A chunk with code but no capacity borrows its code and lines, from
+       a mapped .ziac file: it is never written to nor freed.
+*/
 typedef struct
 {
     ZInt32 count;
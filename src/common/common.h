@@ -19,6 +19,11 @@
 #define DEBUG_STRESS_GC             // FLAG triggers GC EVERY time it can. Used to find GC-Bugs, that only happen when GC-triggers etc.
 #define DEBUG_LOG_GC                // FLAG to enable Diagnostics print outs for Garbage Collection
 
+#define COMPUTED_GOTO               // FLAG to dispatch bytecode through a labels-as-values table instead of a switch
+//#define PROFILE_OPCODES           // FLAG (or -DPROFILE_OPCODES) to count executed opcode pairs/triples and print them at exit
+//#define NAN_BOXING                // FLAG (or -DNAN_BOXING) to store Values as 8-byte NaN-boxed doubles instead of a 16-byte tagged union
+#define PARALLEL_MARK               // FLAG to let collections trace the heap on several threads, see ZIA_GC_THREADS (-DSINGLE_THREAD_MARK leaves it out)
+
 #define UINT8_COUNT (UINT8_MAX + 1) // Hard limit on how many locals can exist at the same time (IN THE SAME SCOPE)
 
 //#undef DEBUG_PRINT_CODE             // comment this out: to enable debug printing
@@ -27,6 +32,16 @@
 #undef DEBUG_STRESS_GC              // comment this out: to enable GC every step
 ///#undef DEBUG_LOG_GC                 // comment this out: to enable loging of GC steps
 
+// labels-as-values is a GCC/Clang extension: other compilers (or -DSWITCH_DISPATCH) get the portable switch
+#if !defined(__GNUC__) || defined(SWITCH_DISPATCH)
+#undef COMPUTED_GOTO
+#endif
+
+// parallel marking needs POSIX threads and the GCC/Clang atomics; the WebAssembly build has neither
+#if !defined(__GNUC__) || defined(__EMSCRIPTEN__) || defined(SINGLE_THREAD_MARK)
+#undef PARALLEL_MARK
+#endif
+
 // flag-variables, set in main-implementations, to toggle on/off GC. (ex. in Wasm-Web-Frontend)
 #ifdef DEBUG_PRINT_CODE
 extern bool FLAG_PRINT_CODE;
@@ -5,19 +5,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
 #include "memory/memory.h"
+#include "vm/vm.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 
 #define MAX_NESTED_LOOPS 10
-#define MAX_CASES 10
+#define MAX_NESTED_SWITCHES 10
 #define MAX_ARGS 255
 
 typedef void (*ParseFn)(ZBool canAssign);
 
-static ZUInt8 identifierConstant(Token *name);
+static ZInt32 identifierGlobal(Token *name);
 static void postIncrementDecrement(ZUInt8 getOp, ZUInt8 setOp, ZInt32 arg, ZUInt8 operation);
 static void synchronize();
 static ZUInt8 argumentList();
@@ -80,11 +82,29 @@ typedef struct
 
 typedef struct
 {
-    ZInt32 *switchBreakJumps;
-    ZInt32 switchBreakCount;
+    ZInt32 *breakJumps;   // 'quitter' jumps to the end of the 'selon'
+    ZInt32 breakCount;
+    ZInt32 breakCapacity;
+
+    ZInt32 scopeDepth;    // scope holding the hidden discriminant local
+    ZInt32 loopDepth;     // loops around the 'selon': a 'quitter' in a deeper loop leaves that loop
+} Switch;
+
+typedef struct
+{
+    // support up to MAX_NESTED_SWITCHES nested 'selon'
+    Switch switches[MAX_NESTED_SWITCHES];
     ZInt32 switchDepth;
 } SwitchContext;
 
+typedef struct
+{
+    ZInt64 key;        // integer label, or the hash of a string label
+    ObjString *string; // string label, NULL for an integer one
+    ZInt32 constant;   // constant slot of the string label
+    ZInt32 target;     // offset of the case body
+} SwitchCase;
+
 typedef struct
 {
     // support up to MAX_NESTED_LOOPS nested loop;
@@ -103,36 +123,43 @@ typedef struct Compiler
     ZInt32 scopeDepth;
     LoopContext loopContext;
     SwitchContext switchContext;
+    ZInt32 lastCall; // offset of the most recent OP_CALL, -1 if none
+    // superinstruction bookkeeping: offsets of the latest candidates, -1 if none
+    ZInt32 lastGetLocal;
+    ZInt32 lastSetLocal;
+    ZInt32 lastConstant;
+    ZInt32 lastCompare; // OP_LESS/GREATER/EQUAL or OP_LOCAL_LESS_CONSTANT, for compare-and-branch
+    ZInt32 lastNot;
+    ZInt32 lastTarget; // highest offset a jump lands on, nothing before it may be fused across it
 } Compiler;
 
-typedef struct
+// the source being compiled, one per compile(); it lives on the stack and the VM points to it meanwhile
+typedef struct Parser
 {
+    Scanner scanner;
     Token current;
     Token previous;
     ZBool hadError;
     ZBool panicMode;
 } Parser;
 
-Parser parser;
-Compiler *current = NULL;
-
 static Chunk *currentChunk()
 {
-    return &current->function->chunk;
+    return &vm->compiler->function->chunk;
 }
 
 static void errorAt(Token *token, const ZChar *message)
 {
-    if (parser.panicMode)
+    if (vm->parser->panicMode)
     {
         return;
     }
 
-    parser.panicMode = true;
-    fprintf(stderr, "[ligne %d] Erreur", token->line);
+    vm->parser->panicMode = true;
+    fprintf(vm->err, "[ligne %d] Erreur", token->line);
     if (token->type == TOKEN_EOF)
     {
-        fprintf(stderr, " à la fin");
+        fprintf(vm->err, " à la fin");
     }
     else if (token->type == TOKEN_ERROR)
     {
@@ -140,15 +167,15 @@ static void errorAt(Token *token, const ZChar *message)
     }
     else
     {
-        fprintf(stderr, " à '%.*s'", token->length, token->start);
+        fprintf(vm->err, " à '%.*s'", token->length, token->start);
     }
-    fprintf(stderr, " : %s\n", message);
-    parser.hadError = true;
+    fprintf(vm->err, " : %s\n", message);
+    vm->parser->hadError = true;
 }
 
 static void error(const ZChar *message)
 {
-    errorAt(&parser.previous, message);
+    errorAt(&vm->parser->previous, message);
 }
 
 static void errorAtCurrent(const ZChar *format, ...)
@@ -159,27 +186,27 @@ static void errorAtCurrent(const ZChar *format, ...)
     vsnprintf(message, sizeof message, format, args);
     va_end(args);
 
-    errorAt(&parser.current, message);
+    errorAt(&vm->parser->current, message);
 }
 
 static void advance()
 {
-    parser.previous = parser.current;
+    vm->parser->previous = vm->parser->current;
 
     for (;;)
     {
-        parser.current = scanToken();
-        if (parser.current.type != TOKEN_ERROR)
+        vm->parser->current = scanToken(&vm->parser->scanner);
+        if (vm->parser->current.type != TOKEN_ERROR)
         {
             break;
         }
-        errorAtCurrent(parser.current.start);
+        errorAtCurrent(vm->parser->current.start);
     }
 }
 
 static void consume(TokenType type, const ZChar *message)
 {
-    if (parser.current.type == type)
+    if (vm->parser->current.type == type)
     {
         advance();
         return;
@@ -189,7 +216,7 @@ static void consume(TokenType type, const ZChar *message)
 
 static ZBool check(TokenType type)
 {
-    return parser.current.type == type;
+    return vm->parser->current.type == type;
 }
 
 static ZBool match(TokenType type)
@@ -206,7 +233,7 @@ static ZBool match(TokenType type)
 
 static void emitByte(ZUInt8 byte)
 {
-    writeChunk(currentChunk(), byte, parser.previous.line);
+    writeChunk(currentChunk(), byte, vm->parser->previous.line);
 }
 
 static void emitBytes(ZUInt8 byte1, ZUInt8 byte2)
@@ -248,6 +275,7 @@ static void emitReturn()
 static ZUInt8 makeConstant(Value value)
 {
     ZInt32 constant = addConstant(currentChunk(), value);
+    writeBarrier((Obj *)vm->compiler->function, value);
     if (constant > UINT8_MAX)
     {
         error("Trop de constantes dans un seul bloc.");
@@ -258,12 +286,199 @@ static ZUInt8 makeConstant(Value value)
 
 static void emitConstant(Value value)
 {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+    ZUInt8 constant = makeConstant(value);
+    vm->compiler->lastConstant = currentChunk()->count;
+    emitBytes(OP_CONSTANT, constant);
+}
+
+static void emitVariableOp(ZUInt8 op, ZInt32 arg)
+{
+    // global slots take a 16-bit operand, locals and upvalues a single byte
+    if (OP_GET_GLOBAL == op || OP_SET_GLOBAL == op || OP_DEFINE_GLOBAL == op)
+    {
+        emitByte(op);
+        emitBytes((arg >> 8) & 0xff, arg & 0xff);
+        return;
+    }
+
+    if (OP_GET_LOCAL == op)
+    {
+        vm->compiler->lastGetLocal = currentChunk()->count;
+    }
+    else if (OP_SET_LOCAL == op)
+    {
+        vm->compiler->lastSetLocal = currentChunk()->count;
+    }
+    emitBytes(op, (ZUInt8)arg);
+}
+
+// the current offset is the destination of some jump or loop
+static ZInt32 jumpTarget()
+{
+    vm->compiler->lastTarget = currentChunk()->count;
+    return vm->compiler->lastTarget;
+}
+
+/*
+@Note: Superinstructions. The sequences below are the most frequent ones in
+       the opcode profile (build with -DPROFILE_OPCODES and run
+       debug/opcode_profile.py over a corpus):
+           OP_GET_LOCAL s, OP_CONSTANT k, op  ->  OP_LOCAL_<op>_CONSTANT s k
+           OP_CONSTANT k, op                  ->  OP_<op>_CONSTANT k
+           OP_SET_LOCAL s, OP_POP             ->  OP_SET_LOCAL_POP s
+       They are fused as they are emitted, only when the instructions being
+       replaced are the last ones of the chunk and no jump lands inside them.
+*/
+static ZBool canFuse(ZInt32 start, ZInt32 lastOffset)
+{
+    return start >= 0 && start == lastOffset && vm->compiler->lastTarget <= start;
+}
+
+static void emitBinaryOp(ZUInt8 op)
+{
+    ZUInt8 constantOp;
+    ZInt32 localOp = -1;
+    switch (op)
+    {
+    case OP_ADD:
+        constantOp = OP_ADD_CONSTANT;
+        localOp = OP_LOCAL_ADD_CONSTANT;
+        break;
+    case OP_SUBTRACT:
+        constantOp = OP_SUBTRACT_CONSTANT;
+        localOp = OP_LOCAL_SUBTRACT_CONSTANT;
+        break;
+    case OP_LESS:
+        constantOp = OP_LESS_CONSTANT;
+        localOp = OP_LOCAL_LESS_CONSTANT;
+        break;
+    case OP_GREATER:
+        constantOp = OP_GREATER_CONSTANT;
+        break;
+    case OP_EQUAL:
+        constantOp = OP_EQUAL_CONSTANT;
+        break;
+    default:
+        emitByte(op);
+        return;
+    }
+
+    Chunk *chunk = currentChunk();
+    ZInt32 constantStart = chunk->count - 2;
+    if (!canFuse(constantStart, vm->compiler->lastConstant))
+    {
+        if (OP_ADD != op && OP_SUBTRACT != op)
+        {
+            vm->compiler->lastCompare = chunk->count;
+        }
+        emitByte(op);
+        return;
+    }
+
+    ZUInt8 constant = chunk->code[constantStart + 1];
+    ZInt32 localStart = constantStart - 2;
+    if (localOp != -1 && canFuse(localStart, vm->compiler->lastGetLocal))
+    {
+        ZUInt8 slot = chunk->code[localStart + 1];
+        chunk->count = localStart;
+        if (OP_LOCAL_LESS_CONSTANT == localOp)
+        {
+            vm->compiler->lastCompare = localStart;
+        }
+        emitBytes((ZUInt8)localOp, slot);
+        emitByte(constant);
+    }
+    else
+    {
+        chunk->count = constantStart;
+        emitBytes(constantOp, constant);
+    }
+    vm->compiler->lastConstant = -1;
+    vm->compiler->lastGetLocal = -1;
+}
+
+static void emitNot()
+{
+    vm->compiler->lastNot = currentChunk()->count;
+    emitByte(OP_NOT);
+}
+
+/*
+@Note: Branches on a test that nothing else needs (si, tantque, pour, ?:)
+       pop it in the jump itself, and when the test is a comparison that
+       ends the chunk the comparison and the jump become one instruction:
+           OP_LESS, OP_JUMP_IF_FALSE, OP_POP  ->  OP_JUMP_IF_NOT_LESS
+           OP_NOT, OP_JUMP_IF_FALSE, OP_POP   ->  OP_POP_JUMP_IF_TRUE
+       The fall-through path no longer has a value to pop either, so callers
+       must not emit the OP_POP pair any more.
+*/
+static ZInt32 emitJumpIfFalsePop()
+{
+    Chunk *chunk = currentChunk();
+    ZInt32 start = vm->compiler->lastCompare;
+    if (start >= 0 && vm->compiler->lastTarget <= start)
+    {
+        ZUInt8 op = chunk->code[start];
+        ZInt32 length = (OP_LOCAL_LESS_CONSTANT == op) ? 3 : 1;
+        ZInt32 fused = -1;
+        switch (op)
+        {
+        case OP_LESS:
+            fused = OP_JUMP_IF_NOT_LESS;
+            break;
+        case OP_GREATER:
+            fused = OP_JUMP_IF_NOT_GREATER;
+            break;
+        case OP_EQUAL:
+            fused = OP_JUMP_IF_NOT_EQUAL;
+            break;
+        case OP_LOCAL_LESS_CONSTANT:
+            fused = OP_JUMP_IF_LOCAL_NOT_LESS_CONSTANT;
+            break;
+        }
+
+        if (fused != -1 && start + length == chunk->count)
+        {
+            chunk->code[start] = (ZUInt8)fused;
+            vm->compiler->lastCompare = -1;
+            // the offset keeps the comparison's line, runtime errors point at it
+            for (ZInt32 i = 0; i < JUMP_OFFSET_SIZE; i++)
+            {
+                writeChunk(chunk, 0xff, chunk->lines[start]);
+            }
+            return chunk->count - JUMP_OFFSET_SIZE;
+        }
+    }
+
+    ZInt32 notStart = chunk->count - 1;
+    if (canFuse(notStart, vm->compiler->lastNot))
+    {
+        chunk->count = notStart;
+        vm->compiler->lastNot = -1;
+        vm->compiler->lastCompare = -1;
+        return emitJump(OP_POP_JUMP_IF_TRUE);
+    }
+
+    return emitJump(OP_POP_JUMP_IF_FALSE);
+}
+
+// pops the value of an expression statement
+static void emitPop()
+{
+    Chunk *chunk = currentChunk();
+    ZInt32 setStart = chunk->count - 2;
+    if (canFuse(setStart, vm->compiler->lastSetLocal))
+    {
+        chunk->code[setStart] = OP_SET_LOCAL_POP;
+        vm->compiler->lastSetLocal = -1;
+        return;
+    }
+    emitByte(OP_POP);
 }
 
 static void patchJump(ZInt32 offset)
 {
-    ZInt32 jump = currentChunk()->count - offset - JUMP_OFFSET_SIZE;
+    ZInt32 jump = jumpTarget() - offset - JUMP_OFFSET_SIZE;
     if (jump > 0xFFFFFF)
     {
         error("Jump offset too large.");
@@ -275,7 +490,7 @@ static void patchJump(ZInt32 offset)
 
 static void initCompiler(Compiler *compiler, FunctionType type)
 {
-    compiler->enclosing = current;
+    compiler->enclosing = vm->compiler;
     compiler->function = NULL;
     compiler->type = type;
     compiler->localCount = 0;
@@ -294,49 +509,293 @@ static void initCompiler(Compiler *compiler, FunctionType type)
     }
 
     compiler->switchContext.switchDepth = 0;
-    compiler->switchContext.switchBreakJumps = NULL;
-    compiler->switchContext.switchBreakCount = 0;
+    compiler->lastCall = -1;
+    compiler->lastGetLocal = -1;
+    compiler->lastSetLocal = -1;
+    compiler->lastConstant = -1;
+    compiler->lastCompare = -1;
+    compiler->lastNot = -1;
+    compiler->lastTarget = 0;
 
     compiler->function = newFunction();
-    current = compiler;
+    vm->compiler = compiler;
     if (TYPE_SCRIPT != type)
     {
-        current->function->name = copyString(parser.previous.start, parser.previous.length);
+        vm->compiler->function->name = copyString(vm->parser->previous.start, vm->parser->previous.length);
+        writeBarrier((Obj *)vm->compiler->function, OBJ_VAL(vm->compiler->function->name));
     }
 
     // Initialize first local slot
-    Local *local = &current->locals[current->localCount++];
+    Local *local = &vm->compiler->locals[vm->compiler->localCount++];
     local->depth = 0;
     local->isCaptured = ZFALSE;
     local->name.start = "";
     local->name.length = 0;
 }
 
+/*
+@Note: The most stack slots a call of the function uses above its frame,
+       callee and arguments included: call() reserves that much. It is
+       found by walking the finished bytecode from every branch, with the
+       depth each instruction leaves. Code the compiler emits reaches an
+       offset with a single depth, so each offset is walked once; one
+       reached again with another depth is a compiler bug, reported as an
+       error rather than guessed at, since a stack reserved too small
+       would be written past its end.
+*/
+static ZInt32 readOperand(ZUInt8 *code, ZInt32 size)
+{
+    ZInt32 value = 0;
+    for (ZInt32 i = 0; i < size; i++)
+    {
+        value = (value << 8) | code[i];
+    }
+    return value;
+}
+
+typedef struct
+{
+    ZInt32 *depths;   // depth before each offset, -1 where no branch reaches
+    ZInt32 *pending;  // offsets left to walk
+    ZInt32 pendingCount;
+    ZInt32 pendingCapacity;
+    ZInt32 maxDepth;
+    ZBool consistent;  // no offset was reached with two depths
+} StackWalk;
+
+static void reachOffset(StackWalk *walk, ZInt32 offset, ZInt32 depth)
+{
+    if (depth < 0 || walk->depths[offset] >= 0)
+    {
+        if (depth < 0 || walk->depths[offset] != depth)
+        {
+            walk->consistent = ZFALSE;
+        }
+    }
+    else
+    {
+        walk->depths[offset] = depth;
+        if (walk->pendingCount == walk->pendingCapacity)
+        {
+            walk->pendingCapacity *= 2;
+            walk->pending = (ZInt32 *)realloc(walk->pending, sizeof(ZInt32) * walk->pendingCapacity);
+            if (NULL == walk->pending)
+            {
+                exit(1);
+            }
+        }
+        walk->pending[walk->pendingCount++] = offset;
+        if (depth > walk->maxDepth)
+        {
+            walk->maxDepth = depth;
+        }
+    }
+}
+
+// -1 when some offset is reached with two depths
+static ZInt32 maxStackDepth(ObjFunction *function)
+{
+    Chunk *chunk = &function->chunk;
+    StackWalk walk;
+    walk.pendingCapacity = 64;
+    walk.depths = (ZInt32 *)malloc(sizeof(ZInt32) * chunk->count);
+    walk.pending = (ZInt32 *)malloc(sizeof(ZInt32) * walk.pendingCapacity);
+    if (NULL == walk.depths || NULL == walk.pending)
+    {
+        exit(1);
+    }
+    for (ZInt32 i = 0; i < chunk->count; i++)
+    {
+        walk.depths[i] = -1;
+    }
+    walk.pendingCount = 0;
+    walk.maxDepth = 0;
+    walk.consistent = ZTRUE;
+    reachOffset(&walk, 0, function->arity + 1);
+
+    while (walk.pendingCount > 0)
+    {
+        ZInt32 offset = walk.pending[--walk.pendingCount];
+        ZInt32 depth = walk.depths[offset];
+        ZUInt8 *code = chunk->code + offset;
+        ZInt32 next = offset + 1;
+        ZInt32 jump = -1;        // the other offset a branch may go to
+        ZInt32 jumpDepth = depth;
+        switch (code[0])
+        {
+        case OP_NULL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_DUP:
+            depth++;
+            break;
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_GET_UPVALUE:
+            depth++;
+            next += 1;
+            break;
+        case OP_GET_GLOBAL:
+            depth++;
+            next += 2;
+            break;
+        case OP_LOCAL_ADD_CONSTANT:
+        case OP_LOCAL_SUBTRACT_CONSTANT:
+        case OP_LOCAL_LESS_CONSTANT:
+            depth++;
+            next += 2;
+            break;
+        case OP_POP:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO:
+        case OP_POWER:
+            depth--;
+            break;
+        case OP_SET_LOCAL_POP:
+            depth--;
+            next += 1;
+            break;
+        case OP_DEFINE_GLOBAL:
+            depth--;
+            next += 2;
+            break;
+        case OP_SET_GLOBAL:
+            next += 2;
+            break;
+        case OP_SET_LOCAL:
+        case OP_SET_UPVALUE:
+        case OP_ADD_CONSTANT:
+        case OP_SUBTRACT_CONSTANT:
+        case OP_LESS_CONSTANT:
+        case OP_GREATER_CONSTANT:
+        case OP_EQUAL_CONSTANT:
+            next += 1;
+            break;
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            // callee and arguments give way to the result
+            depth -= code[1];
+            next += 1;
+            break;
+        case OP_CLOSURE:
+            depth++;
+            next += 1 + 2 * AS_FUNCTION(chunk->constants.values[code[1]])->upvalueCount;
+            break;
+        case OP_RETURN:
+            next = -1;
+            break;
+        case OP_JUMP:
+            jump = offset + 4 + readOperand(code + 1, 3);
+            next = -1;
+            break;
+        case OP_LOOP:
+            jump = offset + 4 - readOperand(code + 1, 3);
+            next = -1;
+            break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            next += 3;
+            jump = next + readOperand(code + 1, 3);
+            break;
+        case OP_POP_JUMP_IF_FALSE:
+        case OP_POP_JUMP_IF_TRUE:
+            depth--;
+            jumpDepth = depth;
+            next += 3;
+            jump = next + readOperand(code + 1, 3);
+            break;
+        case OP_JUMP_IF_FALSE_OR_POP:
+        case OP_JUMP_IF_TRUE_OR_POP:
+            // the test stays when the branch is taken
+            depth--;
+            next += 3;
+            jump = next + readOperand(code + 1, 3);
+            break;
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_EQUAL:
+            depth -= 2;
+            jumpDepth = depth;
+            next += 3;
+            jump = next + readOperand(code + 1, 3);
+            break;
+        case OP_JUMP_IF_LOCAL_NOT_LESS_CONSTANT:
+            next += 5;
+            jump = next + readOperand(code + 3, 3);
+            break;
+        case OP_SWITCH_TABLE:
+        case OP_SWITCH_SEARCH:
+        case OP_SWITCH_STRING:
+        {
+            // the discriminant is a local: every target starts at the same depth
+            ZInt32 operand = OP_SWITCH_TABLE == code[0] ? 5 : 1;
+            ZInt32 count = readOperand(code + operand, 2);
+            ZInt32 keySize = OP_SWITCH_TABLE == code[0] ? 0 : (OP_SWITCH_SEARCH == code[0] ? 4 : 2);
+            reachOffset(&walk, readOperand(code + operand + 2, 3), depth);
+            ZUInt8 *entry = code + operand + 5;
+            for (ZInt32 i = 0; i < count; i++, entry += keySize + 3)
+            {
+                reachOffset(&walk, readOperand(entry + keySize, 3), depth);
+            }
+            next = -1;
+            break;
+        }
+        default:
+            // OP_SWAP, OP_NOT, OP_NEGATE, OP_INCREMENT, OP_DECREMENT
+            break;
+        }
+
+        if (next >= 0 && next < chunk->count)
+        {
+            reachOffset(&walk, next, depth);
+        }
+        if (jump >= 0 && jump < chunk->count)
+        {
+            reachOffset(&walk, jump, jumpDepth);
+        }
+    }
+
+    free(walk.depths);
+    free(walk.pending);
+    return ZTRUE == walk.consistent ? walk.maxDepth : -1;
+}
+
 static ObjFunction *endCompiler()
 {
     // Clean up all loop tracking resources
-    for (ZInt32 i = 0; i < current->loopContext.loopDepth; i++)
+    for (ZInt32 i = 0; i < vm->compiler->loopContext.loopDepth; i++)
     {
-        if (current->loopContext.loops[i].breakJumps != NULL)
+        if (vm->compiler->loopContext.loops[i].breakJumps != NULL)
         {
-            free(current->loopContext.loops[i].breakJumps);
-            current->loopContext.loops[i].breakJumps = NULL;
+            free(vm->compiler->loopContext.loops[i].breakJumps);
+            vm->compiler->loopContext.loops[i].breakJumps = NULL;
         }
-        current->loopContext.loops[i].breakCount = 0;
-        current->loopContext.loops[i].breakCapacity = 0;
-        current->loopContext.loops[i].incrementStart = 0;
+        vm->compiler->loopContext.loops[i].breakCount = 0;
+        vm->compiler->loopContext.loops[i].breakCapacity = 0;
+        vm->compiler->loopContext.loops[i].incrementStart = 0;
     }
-    current->loopContext.loopDepth = 0;
-
-    // FREE_ARRAY(ZInt32, current->switchContext.switchBreakJumps, current->switchContext.switchBreakCount);
+    vm->compiler->loopContext.loopDepth = 0;
 
     emitReturn();
-    ObjFunction *function = current->function;
+    ObjFunction *function = vm->compiler->function;
+    function->maxStack = maxStackDepth(function);
+    if (function->maxStack < 0)
+    {
+        error("Erreur interne : la profondeur de la pile diffère selon le chemin suivi.");
+    }
 
 #ifdef DEBUG_PRINT_CODE
     if (ZTRUE == FLAG_PRINT_CODE)
     {
-        if (!parser.hadError)
+        if (!vm->parser->hadError)
         {
             disassembleChunk(currentChunk(),
                              function->name != NULL ? function->name->chars : "<script>");
@@ -346,23 +805,23 @@ static ObjFunction *endCompiler()
 
     /*when a Compiler finishes, it pops itself off the stack by restoring
     the previous compiler to be the new current one.*/
-    current = current->enclosing;
+    vm->compiler = vm->compiler->enclosing;
     return function;
 }
 
 static void beginScope()
 {
-    current->scopeDepth++;
+    vm->compiler->scopeDepth++;
 }
 
 static void endScope()
 {
-    current->scopeDepth--;
+    vm->compiler->scopeDepth--;
 
-    while (current->localCount > 0 &&
-           (current->locals[current->localCount - 1].depth > current->scopeDepth))
+    while (vm->compiler->localCount > 0 &&
+           (vm->compiler->locals[vm->compiler->localCount - 1].depth > vm->compiler->scopeDepth))
     {
-        if (ZTRUE == current->locals[current->localCount - 1].isCaptured)
+        if (ZTRUE == vm->compiler->locals[vm->compiler->localCount - 1].isCaptured)
         {
             emitByte(OP_CLOSE_UPVALUE);
         }
@@ -370,13 +829,13 @@ static void endScope()
         {
             emitByte(OP_POP);
         }
-        current->localCount--;
+        vm->compiler->localCount--;
     }
 }
 
 static void beginLoop()
 {
-    Compiler *c = current;
+    Compiler *c = vm->compiler;
     if (c->loopContext.loopDepth >= MAX_NESTED_LOOPS)
     {
         error("Trop de boucles imbriquées");
@@ -388,7 +847,7 @@ static void beginLoop()
     loop->breakCount = 0;
     loop->breakCapacity = 0;
 
-    loop->loopStart = currentChunk()->count;
+    loop->loopStart = jumpTarget();
     loop->loopEnd = -1; // will be set when know that the loop ends
     loop->incrementStart = -1;
     loop->scopeDepth = c->scopeDepth; // Store current scope depth
@@ -396,7 +855,7 @@ static void beginLoop()
 
 static void endLoop()
 {
-    Compiler *c = current;
+    Compiler *c = vm->compiler;
     if (c->loopContext.loopDepth == 0)
     {
         error("No active loop to end");
@@ -416,27 +875,33 @@ static void endLoop()
         free(loop->breakJumps);
 }
 
+// the 'selon' a 'quitter' leaves, NULL when the innermost construct is a loop
+static Switch *breakSwitch()
+{
+    SwitchContext *context = &vm->compiler->switchContext;
+    if (context->switchDepth == 0)
+    {
+        return NULL;
+    }
+
+    Switch *innermost = &context->switches[context->switchDepth - 1];
+    return (innermost->loopDepth == vm->compiler->loopContext.loopDepth) ? innermost : NULL;
+}
+
 static void addBreakJump(ZInt32 jump)
 {
-    Compiler *c = current;
+    Compiler *c = vm->compiler;
 
     // ✅ Check if we are in a switch
-    if (c->switchContext.switchDepth > 0)
+    Switch *sw = breakSwitch();
+    if (sw != NULL)
     {
-        if (c->switchContext.switchBreakJumps == NULL)
+        if (sw->breakCount >= sw->breakCapacity)
         {
-            c->switchContext.switchBreakJumps = malloc(sizeof(ZInt32) * MAX_CASES);
-            c->switchContext.switchBreakCount = 0;
-        }
-
-        if (c->switchContext.switchBreakCount < MAX_CASES)
-        {
-            c->switchContext.switchBreakJumps[c->switchContext.switchBreakCount++] = jump;
-        }
-        else
-        {
-            error("Trop de 'quitter' dans 'selon'.");
+            sw->breakCapacity = sw->breakCapacity < 8 ? 8 : sw->breakCapacity * 2;
+            sw->breakJumps = realloc(sw->breakJumps, sizeof(ZInt32) * sw->breakCapacity);
         }
+        sw->breakJumps[sw->breakCount++] = jump;
         return;
     }
 
@@ -468,35 +933,38 @@ static ZInt32 resolveUpvalue(Compiler *compiler, Token *name);
 
 static void binary(ZBool canAssign)
 {
-    TokenType operatorType = parser.previous.type;
+    TokenType operatorType = vm->parser->previous.type;
     ParseRule *rule = getRule(operatorType);
     parsePrecedence((Precedence)(rule->precedence + 1));
 
     switch (operatorType)
     {
     case TOKEN_BANG_EQUAL:
-        emitBytes(OP_EQUAL, OP_NOT);
+        emitBinaryOp(OP_EQUAL);
+        emitNot();
         break;
     case TOKEN_EQUAL_EQUAL:
-        emitByte(OP_EQUAL);
+        emitBinaryOp(OP_EQUAL);
         break;
     case TOKEN_GREATER:
-        emitByte(OP_GREATER);
+        emitBinaryOp(OP_GREATER);
         break;
     case TOKEN_GREATER_EQUAL:
-        emitBytes(OP_LESS, OP_NOT);
+        emitBinaryOp(OP_LESS);
+        emitNot();
         break;
     case TOKEN_LESS:
-        emitByte(OP_LESS);
+        emitBinaryOp(OP_LESS);
         break;
     case TOKEN_LESS_EQUAL:
-        emitBytes(OP_GREATER, OP_NOT);
+        emitBinaryOp(OP_GREATER);
+        emitNot();
         break;
     case TOKEN_PLUS:
-        emitByte(OP_ADD);
+        emitBinaryOp(OP_ADD);
         break;
     case TOKEN_MINUS:
-        emitByte(OP_SUBTRACT);
+        emitBinaryOp(OP_SUBTRACT);
         break;
     case TOKEN_STAR:
         emitByte(OP_MULTIPLY);
@@ -518,12 +986,13 @@ static void binary(ZBool canAssign)
 static void call(ZBool canAssign)
 {
     ZUInt8 argCount = argumentList();
+    vm->compiler->lastCall = currentChunk()->count;
     emitBytes(OP_CALL, argCount);
 }
 
 static void literal(ZBool canAssign)
 {
-    switch (parser.previous.type)
+    switch (vm->parser->previous.type)
     {
     case TOKEN_FALSE:
         emitByte(OP_FALSE);
@@ -543,15 +1012,13 @@ static void conditional(ZBool canAssign)
 {
 
     // Parse true branch
-    ZInt32 thenJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP); // Pop condition if true
+    ZInt32 thenJump = emitJumpIfFalsePop();
 
     parsePrecedence(PREC_CONDITIONAL);
 
     ZInt32 elseJump = emitJump(OP_JUMP);
 
     patchJump(thenJump);
-    emitByte(OP_POP); // Pop condition if false
 
     consume(TOKEN_COLON, "Un ':' est attendu après '?' dans l'expression ternaire.");
 
@@ -568,15 +1035,27 @@ static void grouping(ZBool canAssign)
 
 static void number(ZBool canAssign)
 {
-    double value = strtod(parser.previous.start, NULL);
+    // a literal without a fractional part is an integer, unless it is too wide for one
+    if (memchr(vm->parser->previous.start, '.', vm->parser->previous.length) == NULL)
+    {
+        errno = 0;
+        ZInt64 value = strtoll(vm->parser->previous.start, NULL, 10);
+        if (errno == 0 && INT_FITS(value))
+        {
+            emitConstant(INT_VAL(value));
+            return;
+        }
+    }
+
+    double value = strtod(vm->parser->previous.start, NULL);
     emitConstant(NUMBER_VAL(value));
 }
 
 static void and_(ZBool canAssign)
 {
-    ZInt32 endJump = emitJump(OP_JUMP_IF_FALSE);
+    // a false left operand is the result, otherwise it is dropped for the right one
+    ZInt32 endJump = emitJump(OP_JUMP_IF_FALSE_OR_POP);
 
-    emitByte(OP_POP);
     parsePrecedence(PREC_AND);
 
     patchJump(endJump);
@@ -584,29 +1063,26 @@ static void and_(ZBool canAssign)
 
 static void or_(ZBool canAssign)
 {
-    ZInt32 elseJump = emitJump(OP_JUMP_IF_FALSE);
-    ZInt32 endJump = emitJump(OP_JUMP);
-
-    patchJump(elseJump);
-    emitByte(OP_POP);
+    ZInt32 endJump = emitJump(OP_JUMP_IF_TRUE_OR_POP);
 
     parsePrecedence(PREC_OR);
     patchJump(endJump);
 }
 
-static void string(bool _canAssign)
+// the string object of the literal just consumed, escapes resolved
+static ObjString *stringLiteral()
 {
     // -2 because we ignore opening and closing quotes:'"'
-    int origLength = parser.previous.length - 2;
+    int origLength = vm->parser->previous.length - 2;
     int escapedLength = 0;
     char *escapedStr = ALLOCATE(char, origLength);
     // loop all chars and combine '\'+'n' -> '\n' char, adjust total length:
     for (int i = 1; i < origLength + 1; ++i)
     {
-        char c = parser.previous.start[i];
+        char c = vm->parser->previous.start[i];
         if (i < origLength && c == '\\')
         {
-            char nextChar = parser.previous.start[++i];
+            char nextChar = vm->parser->previous.start[++i];
             switch (nextChar)
             {
             case '\n':
@@ -633,28 +1109,35 @@ static void string(bool _canAssign)
         }
         escapedStr[escapedLength++] = c;
     }
-    emitConstant(OBJ_VAL(copyString(escapedStr, escapedLength)));
-    FREE(char, escapedStr);
+    // an empty literal allocates no buffer, but the copy still needs a valid pointer
+    ObjString *string = copyString(escapedLength > 0 ? escapedStr : "", escapedLength);
+    FREE_ARRAY(char, escapedStr, origLength);
+    return string;
+}
+
+static void string(bool _canAssign)
+{
+    emitConstant(OBJ_VAL(stringLiteral()));
 }
 
 static void namedVariable(Token name, ZBool canAssign)
 {
     ZUInt8 getOp, setOp;
-    ZInt32 arg = resolveLocal(current, &name);
+    ZInt32 arg = resolveLocal(vm->compiler, &name);
 
     if (arg != -1)
     {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
     }
-    else if ((arg = resolveUpvalue(current, &name)) != -1)
+    else if ((arg = resolveUpvalue(vm->compiler, &name)) != -1)
     {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
     }
     else
     {
-        arg = identifierConstant(&name);
+        arg = identifierGlobal(&name);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
@@ -662,7 +1145,7 @@ static void namedVariable(Token name, ZBool canAssign)
     if (canAssign && match(TOKEN_EQUAL))
     {
         expression();
-        emitBytes(setOp, (ZUInt8)arg);
+        emitVariableOp(setOp, arg);
     }
     else if (canAssign && match(TOKEN_PLUS_PLUS_POSTFIX))
     {
@@ -677,52 +1160,52 @@ static void namedVariable(Token name, ZBool canAssign)
     {
         namedVariable(name, ZFALSE);
         expression();
-        emitByte(OP_ADD);
-        emitBytes(setOp, (ZUInt8)arg);
+        emitBinaryOp(OP_ADD);
+        emitVariableOp(setOp, arg);
     }
     else if (canAssign && match(TOKEN_MINUS_EQUAL))
     {
         namedVariable(name, ZFALSE);
         expression();
-        emitByte(OP_SUBTRACT);
-        emitBytes(setOp, (ZUInt8)arg);
+        emitBinaryOp(OP_SUBTRACT);
+        emitVariableOp(setOp, arg);
     }
     else if (canAssign && match(TOKEN_STAR_EQUAL))
     {
         namedVariable(name, ZFALSE);
         expression();
         emitByte(OP_MULTIPLY);
-        emitBytes(setOp, (ZUInt8)arg);
+        emitVariableOp(setOp, arg);
     }
     else if (canAssign && match(TOKEN_SLASH_EQUAL))
     {
         namedVariable(name, ZFALSE);
         expression();
         emitByte(OP_DIVIDE);
-        emitBytes(setOp, (ZUInt8)arg);
+        emitVariableOp(setOp, arg);
     }
 
     else
     {
-        emitBytes(getOp, (ZUInt8)arg);
+        emitVariableOp(getOp, arg);
     }
 }
 
 static void variable(ZBool canAssign)
 {
-    namedVariable(parser.previous, canAssign);
+    namedVariable(vm->parser->previous, canAssign);
 }
 
 static void unary(ZBool canAssign)
 {
-    TokenType operatorType = parser.previous.type;
+    TokenType operatorType = vm->parser->previous.type;
 
     parsePrecedence(PREC_UNARY);
 
     switch (operatorType)
     {
     case TOKEN_BANG:
-        emitByte(OP_NOT);
+        emitNot();
         break;
     case TOKEN_MINUS:
         emitByte(OP_NEGATE);
@@ -736,13 +1219,13 @@ static void postIncrementDecrement(ZUInt8 getOp, ZUInt8 setOp, ZInt32 arg, ZUInt
 {
     // Post-increment: a++
     // 1. Get original value
-    emitBytes(getOp, (ZUInt8)arg);
+    emitVariableOp(getOp, arg);
     // 2. Duplicate it
     emitByte(OP_DUP);
     // 3. Increment the copy
     emitByte(operation);
     // 4. Store the incremented value back to variable
-    emitBytes(setOp, (ZUInt8)arg);
+    emitVariableOp(setOp, arg);
     // Stack now has [original, incremented]
     // We want to keep original and discard incremented
     emitByte(OP_POP);
@@ -753,9 +1236,9 @@ static void preIncrementDecrement(ZUInt8 operation)
     // The previous token should be the ++ operator, and current should be the variable
     advance(); // Move to the variable token
 
-    Token name = parser.previous;
+    Token name = vm->parser->previous;
     ZUInt8 getOp, setOp;
-    ZInt32 arg = resolveLocal(current, &name);
+    ZInt32 arg = resolveLocal(vm->compiler, &name);
 
     if (arg != -1)
     {
@@ -764,15 +1247,15 @@ static void preIncrementDecrement(ZUInt8 operation)
     }
     else
     {
-        arg = identifierConstant(&name);
+        arg = identifierGlobal(&name);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
 
-    emitBytes(getOp, (ZUInt8)arg);
+    emitVariableOp(getOp, arg);
     emitByte(operation);
     emitByte(OP_DUP);
-    emitBytes(setOp, (ZUInt8)arg);
+    emitVariableOp(setOp, arg);
 }
 
 static void preIncrement(bool canAssign)
@@ -860,7 +1343,7 @@ ParseRule rules[] =
 static void parsePrecedence(Precedence precedence)
 {
     advance();
-    ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+    ParseFn prefixRule = getRule(vm->parser->previous.type)->prefix;
 
     if (NULL == prefixRule)
     {
@@ -872,10 +1355,10 @@ static void parsePrecedence(Precedence precedence)
     ZBool canAssign = precedence <= PREC_ASSIGNMENT;
     prefixRule(canAssign);
 
-    while (precedence <= getRule(parser.current.type)->precedence)
+    while (precedence <= getRule(vm->parser->current.type)->precedence)
     {
         advance();
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
+        ParseFn infixRule = getRule(vm->parser->previous.type)->infix;
         infixRule(canAssign);
     }
 
@@ -885,9 +1368,15 @@ static void parsePrecedence(Precedence precedence)
     }
 }
 
-static ZUInt8 identifierConstant(Token *name)
+static ZInt32 identifierGlobal(Token *name)
 {
-    return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+    ZInt32 slot = globalSlot(copyString(name->start, name->length));
+    if (slot == -1)
+    {
+        error("Trop de variables globales.");
+        return 0;
+    }
+    return slot;
 }
 
 static ZBool identifiersEqual(Token *a, Token *b)
@@ -966,14 +1455,14 @@ static ZInt32 resolveUpvalue(Compiler *compiler, Token *name)
 
 static void addLocal(Token name)
 {
-    if (current->localCount == UINT8_COUNT)
+    if (vm->compiler->localCount == UINT8_COUNT)
     {
         // TBD: extend 256 local vairable number in a scope to four byte
         error("Trop de variables locales dans un seul bloc.");
         return;
     }
 
-    Local *local = &current->locals[current->localCount++];
+    Local *local = &vm->compiler->locals[vm->compiler->localCount++];
     local->name = name;
     local->depth = -1;
     local->isCaptured = ZFALSE;
@@ -981,16 +1470,16 @@ static void addLocal(Token name)
 
 static void declareVariable()
 {
-    if (current->scopeDepth == 0)
+    if (vm->compiler->scopeDepth == 0)
     {
         return;
     }
 
-    Token *name = &parser.previous;
-    for (ZInt32 i = current->localCount - 1; i >= 0; i--)
+    Token *name = &vm->parser->previous;
+    for (ZInt32 i = vm->compiler->localCount - 1; i >= 0; i--)
     {
-        Local *local = &current->locals[i];
-        if (local->depth != -1 && local->depth < current->scopeDepth)
+        Local *local = &vm->compiler->locals[i];
+        if (local->depth != -1 && local->depth < vm->compiler->scopeDepth)
         {
             break;
         }
@@ -1002,38 +1491,38 @@ static void declareVariable()
     addLocal(*name);
 }
 
-static ZUInt8 parseVariable(const ZChar *errorMessage)
+static ZInt32 parseVariable(const ZChar *errorMessage)
 {
     consume(TOKEN_IDENTIFIER, errorMessage);
 
     declareVariable();
-    if (current->scopeDepth > 0)
+    if (vm->compiler->scopeDepth > 0)
     {
         return 0;
     }
 
-    return identifierConstant(&parser.previous);
+    return identifierGlobal(&vm->parser->previous);
 }
 
 static void markInitialized()
 {
-    if (current->scopeDepth == 0)
+    if (vm->compiler->scopeDepth == 0)
     {
         return;
     }
 
-    current->locals[current->localCount - 1].depth = current->scopeDepth;
+    vm->compiler->locals[vm->compiler->localCount - 1].depth = vm->compiler->scopeDepth;
 }
 
-static void defineVariable(ZUInt8 global)
+static void defineVariable(ZInt32 global)
 {
-    if (current->scopeDepth > 0)
+    if (vm->compiler->scopeDepth > 0)
     {
         markInitialized();
         return;
     }
 
-    emitBytes(OP_DEFINE_GLOBAL, global);
+    emitVariableOp(OP_DEFINE_GLOBAL, global);
 }
 
 static ZUInt8 argumentList()
@@ -1093,12 +1582,12 @@ static void function(FunctionType type)
     {
         do
         {
-            current->function->arity++;
-            if (current->function->arity > 255)
+            vm->compiler->function->arity++;
+            if (vm->compiler->function->arity > 255)
             {
                 errorAtCurrent("Impossible d'avoir plus de %d paramètres. ", MAX_ARGS);
             }
-            ZUInt8 constant = parseVariable(" Nom de paramètre attendu.");
+            ZInt32 constant = parseVariable(" Nom de paramètre attendu.");
             defineVariable(constant);
         } while (match(TOKEN_COMMA));
     }
@@ -1119,7 +1608,7 @@ static void function(FunctionType type)
 
 static void funcDeclaration()
 {
-    ZUInt8 global = parseVariable("Expect function name.");
+    ZInt32 global = parseVariable("Expect function name.");
     markInitialized();
     function(TYPE_FUNCTION);
     defineVariable(global);
@@ -1127,7 +1616,7 @@ static void funcDeclaration()
 
 static void varDeclaration()
 {
-    ZUInt8 global = parseVariable("Nom de variable attendu.");
+    ZInt32 global = parseVariable("Nom de variable attendu.");
 
     if (match(TOKEN_EQUAL))
     {
@@ -1147,7 +1636,7 @@ static void expressionStatement()
 {
     expression();
     consume(TOKEN_SEMICOLON, "Erreur : point-virgule manquant après la valeur.");
-    emitByte(OP_POP);
+    emitPop();
 }
 
 static void forStatement()
@@ -1173,7 +1662,7 @@ static void forStatement()
     }
 
     // Set loop start position
-    current->loopContext.loops[current->loopContext.loopDepth - 1].loopStart = currentChunk()->count;
+    vm->compiler->loopContext.loops[vm->compiler->loopContext.loopDepth - 1].loopStart = jumpTarget();
     ZInt32 exitJump = -1;
 
     // Condition clause
@@ -1182,9 +1671,7 @@ static void forStatement()
         expression();
         consume(TOKEN_SEMICOLON, "Point-virgule ';' attendu après la condition.");
 
-        exitJump = emitJump(OP_JUMP_IF_FALSE);
-        // Pop condition if true
-        emitByte(OP_POP);
+        exitJump = emitJumpIfFalsePop();
     }
 
     // Increment clause
@@ -1193,21 +1680,21 @@ static void forStatement()
     {
         // Jump over increment for first iteration
         ZInt32 bodyJump = emitJump(OP_JUMP);
-        incrementStart = currentChunk()->count;
+        incrementStart = jumpTarget();
 
         // Store increment start for continue jumps
-        current->loopContext.loops[current->loopContext.loopDepth - 1].incrementStart = incrementStart;
+        vm->compiler->loopContext.loops[vm->compiler->loopContext.loopDepth - 1].incrementStart = incrementStart;
 
         expression();
-        emitByte(OP_POP);
+        emitPop();
         consume(TOKEN_RIGHT_PAREN, "Parenthèse ')' attendue après les clauses.");
 
-        emitLoop(current->loopContext.loops[current->loopContext.loopDepth - 1].loopStart);
+        emitLoop(vm->compiler->loopContext.loops[vm->compiler->loopContext.loopDepth - 1].loopStart);
         patchJump(bodyJump);
     }
 
     // Set where breaks should jump to (after the loop)
-    current->loopContext.loops[current->loopContext.loopDepth - 1].loopEnd = currentChunk()->count;
+    vm->compiler->loopContext.loops[vm->compiler->loopContext.loopDepth - 1].loopEnd = currentChunk()->count;
 
     // Loop body
     statement();
@@ -1219,39 +1706,51 @@ static void forStatement()
     }
     else
     {
-        emitLoop(current->loopContext.loops[current->loopContext.loopDepth - 1].loopStart);
+        emitLoop(vm->compiler->loopContext.loops[vm->compiler->loopContext.loopDepth - 1].loopStart);
     }
 
     // Patch exit jump if condition exists
     if (exitJump != -1)
     {
         patchJump(exitJump);
-        emitByte(OP_POP);
     }
 
     endLoop();
     endScope();
 }
 
+// pops the locals declared deeper than 'depth' on a jump out of their scope;
+// the compiler keeps tracking them since the code after the jump still sees them
+static void discardLocals(ZInt32 depth)
+{
+    for (ZInt32 i = vm->compiler->localCount - 1; i >= 0 && vm->compiler->locals[i].depth > depth; i--)
+    {
+        emitByte(ZTRUE == vm->compiler->locals[i].isCaptured ? OP_CLOSE_UPVALUE : OP_POP);
+    }
+}
+
 static void breakStatement()
 {
     consume(TOKEN_SEMICOLON, "Virgule ';' attendu après 'quitter'.");
 
-    // Clear locals from scope
-    while (current->localCount > 0 &&
-           current->locals[current->localCount - 1].depth > current->scopeDepth)
+    // Clear locals up to the scope of the construct being left
+    Switch *sw = breakSwitch();
+    if (sw != NULL)
+    {
+        discardLocals(sw->scopeDepth);
+    }
+    else if (vm->compiler->loopContext.loopDepth > 0)
     {
-        emitByte(OP_POP);
-        current->localCount--;
+        discardLocals(vm->compiler->loopContext.loops[vm->compiler->loopContext.loopDepth - 1].scopeDepth);
     }
 
     int jump = emitJump(OP_JUMP);
 
-    if (current->switchContext.switchDepth > 0)
+    if (vm->compiler->switchContext.switchDepth > 0)
     {
         addBreakJump(jump);
     }
-    else if (current->loopContext.loopDepth > 0)
+    else if (vm->compiler->loopContext.loopDepth > 0)
     {
         addBreakJump(jump);
     }
@@ -1263,7 +1762,7 @@ static void breakStatement()
 
 static void continueStatement()
 {
-    if (current->loopContext.loopDepth == 0)
+    if (vm->compiler->loopContext.loopDepth == 0)
     {
         error("Les instructions 'continuer' ne peuvent être utilisées que dans une boucle.");
         return;
@@ -1272,13 +1771,8 @@ static void continueStatement()
     consume(TOKEN_SEMICOLON, "Un Virgule ';' est attendu après 'continuer'.");
 
     // Clean up locals in the loop scope
-    Loop *currentLoop = &current->loopContext.loops[current->loopContext.loopDepth - 1];
-    while (current->localCount > 0 &&
-           current->locals[current->localCount - 1].depth > currentLoop->scopeDepth)
-    {
-        emitByte(OP_POP);
-        current->localCount--;
-    }
+    Loop *currentLoop = &vm->compiler->loopContext.loops[vm->compiler->loopContext.loopDepth - 1];
+    discardLocals(currentLoop->scopeDepth);
 
     // For while loops, emit a direct loop jump
     if (currentLoop->incrementStart != -1)
@@ -1291,106 +1785,271 @@ static void continueStatement()
     }
 }
 
+/*
+@Note: 'selon' compiles every case body first, then a single dispatch
+       instruction that jumps straight to the matching body:
+           OP_JUMP dispatch
+           body 1 ; OP_JUMP end
+           ...
+           body n ; OP_JUMP end
+           [defaut ; OP_JUMP end]
+       dispatch:
+           OP_SWITCH_TABLE | OP_SWITCH_SEARCH | OP_SWITCH_STRING <operands>
+       end:
+       Integer labels use a table indexed by 'value - low' when they are
+       dense enough (the range is at most twice the number of cases), and a
+       binary search over the sorted labels otherwise. String labels are
+       sorted by hash and matched by pointer, strings being interned.
+       The discriminant stays on the stack as a hidden local of the 'selon'
+       scope; case and default targets are absolute offsets in the chunk.
+*/
+static void emitSwitchOffset(ZInt32 offset)
+{
+    if (offset > 0xFFFFFF)
+    {
+        error("Jump offset too large.");
+    }
+    emitByte((offset >> 16) & 0xff);
+    emitByte((offset >> 8) & 0xff);
+    emitByte(offset & 0xff);
+}
+
+static int compareSwitchCases(const void *a, const void *b)
+{
+    const SwitchCase *left = (const SwitchCase *)a;
+    const SwitchCase *right = (const SwitchCase *)b;
+    if (left->key != right->key)
+    {
+        return left->key < right->key ? -1 : 1;
+    }
+    if (left->string != right->string)
+    {
+        return (uintptr_t)left->string < (uintptr_t)right->string ? -1 : 1;
+    }
+    return 0;
+}
+
+// parses the label after 'cas': an integer literal or a string literal
+static ZBool switchLabel(SwitchCase *label)
+{
+    if (match(TOKEN_STRING))
+    {
+        ObjString *string = stringLiteral();
+        label->constant = addConstant(currentChunk(), OBJ_VAL(string));
+        writeBarrier((Obj *)vm->compiler->function, OBJ_VAL(string));
+        if (label->constant > UINT16_MAX)
+        {
+            error("Trop de constantes dans un seul bloc.");
+        }
+        label->string = string;
+        label->key = string->hash;
+        return ZTRUE;
+    }
+
+    ZBool negative = match(TOKEN_MINUS);
+    consume(TOKEN_NUMBER, "Un entier ou une chaîne est attendu après 'cas'.");
+    ZReal64 value = strtod(vm->parser->previous.start, NULL);
+    if (negative)
+    {
+        value = -value;
+    }
+    if (value != (ZReal64)(ZInt32)value || value < INT32_MIN || value > INT32_MAX)
+    {
+        error("Les étiquettes de 'cas' doivent être des entiers sur 32 bits.");
+    }
+    label->string = NULL;
+    label->constant = -1;
+    label->key = (ZInt32)value;
+    return ZFALSE;
+}
+
+// compiles the statements of a case up to the next label
+static void switchBody()
+{
+    beginScope();
+    while (!check(TOKEN_CASE) && !check(TOKEN_DEFAULT) && !check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+    {
+        statement();
+    }
+    endScope();
+}
+
 static void switchStatement()
 {
-    current->switchContext.switchDepth++;
+    if (vm->compiler->switchContext.switchDepth >= MAX_NESTED_SWITCHES)
+    {
+        error("Trop de 'selon' imbriqués.");
+        return;
+    }
 
     consume(TOKEN_LEFT_PAREN, "Parenthèse '(' attendue après 'selon'.");
+    beginScope();
     expression(); // leaves discriminant on stack
     consume(TOKEN_RIGHT_PAREN, "Parenthèse ')' attendue après 'selon'.");
     consume(TOKEN_LEFT_BRACE, "Accolade '{' attendue avant le corps du 'selon'.");
 
-    // store into temp local
-    ZInt32 slot = current->localCount++;
-    emitBytes(OP_SET_LOCAL, (ZUInt8)slot);
+    // the discriminant becomes a hidden local, popped by endScope()
+    Token hidden = {.start = "", .length = 0};
+    addLocal(hidden);
+    markInitialized();
+
+    Switch *sw = &vm->compiler->switchContext.switches[vm->compiler->switchContext.switchDepth++];
+    sw->breakJumps = NULL;
+    sw->breakCount = 0;
+    sw->breakCapacity = 0;
+    sw->scopeDepth = vm->compiler->scopeDepth;
+    sw->loopDepth = vm->compiler->loopContext.loopDepth;
 
-    // collect end‐of‐switch jumps
-    ZInt32 endJumps[MAX_CASES];
+    ZInt32 dispatchJump = emitJump(OP_JUMP);
+
+    SwitchCase *cases = NULL;
+    ZInt32 caseCount = 0;
+    ZInt32 caseCapacity = 0;
+    ZInt32 *endJumps = NULL;
     ZInt32 endCount = 0;
+    ZInt32 stringCount = 0;
+    ZInt32 defaultTarget = -1;
 
-    // --- first case ---
-    if (!match(TOKEN_CASE))
+    while (match(TOKEN_CASE))
+    {
+        if (caseCount >= caseCapacity)
+        {
+            caseCapacity = caseCapacity < 8 ? 8 : caseCapacity * 2;
+            cases = realloc(cases, sizeof(SwitchCase) * caseCapacity);
+            endJumps = realloc(endJumps, sizeof(ZInt32) * (caseCapacity + 1));
+        }
+        SwitchCase *label = &cases[caseCount++];
+        if (switchLabel(label))
+        {
+            stringCount++;
+        }
+        consume(TOKEN_COLON, "':' attendu après 'cas N:'.");
+
+        label->target = jumpTarget();
+        switchBody();
+        endJumps[endCount++] = emitJump(OP_JUMP);
+    }
+
+    if (caseCount == 0)
     {
         error("'selon' doit avoir au moins un 'cas'.");
-        return;
     }
-    advance();
-    ZInt32 cv = atoi(parser.previous.start);
-    consume(TOKEN_COLON, "':' attendu après 'cas N:'.");
-
-    // if (slot != cv) skip this body
-    emitBytes(OP_GET_LOCAL, (ZUInt8)slot);
-    emitBytes(OP_CONSTANT, makeConstant(NUMBER_VAL(cv)));
-    emitByte(OP_EQUAL);
-    ZInt32 skip = emitJump(OP_JUMP_IF_FALSE);
-    // pop the boolean
-    emitByte(OP_POP);
+    else if (stringCount != 0 && stringCount != caseCount)
+    {
+        error("Les étiquettes d'un 'selon' doivent être toutes entières ou toutes des chaînes.");
+    }
 
-    // body
-    while (!check(TOKEN_CASE) && !check(TOKEN_DEFAULT) && !check(TOKEN_RIGHT_BRACE))
+    if (match(TOKEN_DEFAULT))
     {
-        statement();
+        consume(TOKEN_COLON, "':' attendu après 'défaut:'.");
+        defaultTarget = jumpTarget();
+        switchBody();
+        if (endJumps == NULL)
+        {
+            endJumps = malloc(sizeof(ZInt32));
+        }
+        endJumps[endCount++] = emitJump(OP_JUMP);
     }
 
-    // jump to end
-    endJumps[endCount++] = emitJump(OP_JUMP);
-    patchJump(skip);
-    // pop the boolean
-    emitByte(OP_POP);
+    consume(TOKEN_RIGHT_BRACE, "Accolade '}' attendue a la fin du 'selon'.");
 
-    // --- subsequent cases ---
-    while (match(TOKEN_CASE))
+    if (caseCount > UINT16_MAX)
     {
-        advance();
-        cv = atoi(parser.previous.start);
-        consume(TOKEN_COLON, "':' attendu après 'cas N:'.");
-
-        emitBytes(OP_GET_LOCAL, (ZUInt8)slot);
-        emitBytes(OP_CONSTANT, makeConstant(NUMBER_VAL(cv)));
-        emitByte(OP_EQUAL);
-        skip = emitJump(OP_JUMP_IF_FALSE);
-        emitByte(OP_POP);
+        error("Trop de 'cas' dans un seul 'selon'.");
+        caseCount = 0;
+    }
 
-        while (!check(TOKEN_CASE) && !check(TOKEN_DEFAULT) && !check(TOKEN_RIGHT_BRACE))
+    qsort(cases, caseCount, sizeof(SwitchCase), compareSwitchCases);
+    for (ZInt32 i = 1; i < caseCount; i++)
+    {
+        if (cases[i].key == cases[i - 1].key && cases[i].string == cases[i - 1].string)
         {
-            statement();
+            error("Étiquette de 'cas' en double dans 'selon'.");
+            break;
         }
+    }
 
-        endJumps[endCount++] = emitJump(OP_JUMP);
-        patchJump(skip);
-        emitByte(OP_POP);
+    // dispatch; without 'defaut' an unmatched value goes straight past it
+    patchJump(dispatchJump);
+    ZInt32 dispatch = currentChunk()->count;
+    ZInt64 range = caseCount > 0 ? cases[caseCount - 1].key - cases[0].key + 1 : 0;
+    ZBool dense = stringCount == 0 && caseCount > 0 && range <= 2 * (ZInt64)caseCount && range <= UINT16_MAX;
+    ZInt32 end;
+    if (stringCount > 0)
+    {
+        end = dispatch + 6 + caseCount * 5;
+    }
+    else if (dense)
+    {
+        end = dispatch + 10 + (ZInt32)range * 3;
     }
+    else
+    {
+        end = dispatch + 6 + caseCount * 7;
+    }
+    ZInt32 fallback = defaultTarget != -1 ? defaultTarget : end;
 
-    // --- default ---
-    if (match(TOKEN_DEFAULT))
+    if (stringCount > 0)
     {
-        consume(TOKEN_COLON, "':' attendu après 'défaut:'.");
-        while (!check(TOKEN_RIGHT_BRACE))
+        emitByte(OP_SWITCH_STRING);
+        emitBytes((caseCount >> 8) & 0xff, caseCount & 0xff);
+        emitSwitchOffset(fallback);
+        for (ZInt32 i = 0; i < caseCount; i++)
         {
-            statement();
+            emitBytes((cases[i].constant >> 8) & 0xff, cases[i].constant & 0xff);
+            emitSwitchOffset(cases[i].target);
         }
     }
+    else if (dense)
+    {
+        ZInt32 low = (ZInt32)cases[0].key;
 
-    consume(TOKEN_RIGHT_BRACE, "Accolade '}' attendue a la fin du 'selon'.");
+        emitByte(OP_SWITCH_TABLE);
+        emitBytes((low >> 24) & 0xff, (low >> 16) & 0xff);
+        emitBytes((low >> 8) & 0xff, low & 0xff);
+        emitBytes((range >> 8) & 0xff, range & 0xff);
+        emitSwitchOffset(fallback);
+
+        // holes in the range go to the default
+        ZInt32 next = 0;
+        for (ZInt64 value = low; value < low + range; value++)
+        {
+            emitSwitchOffset(cases[next].key == value ? cases[next++].target : fallback);
+        }
+    }
+    else
+    {
+        emitByte(OP_SWITCH_SEARCH);
+        emitBytes((caseCount >> 8) & 0xff, caseCount & 0xff);
+        emitSwitchOffset(fallback);
+        for (ZInt32 i = 0; i < caseCount; i++)
+        {
+            ZInt32 key = (ZInt32)cases[i].key;
+            emitBytes((key >> 24) & 0xff, (key >> 16) & 0xff);
+            emitBytes((key >> 8) & 0xff, key & 0xff);
+            emitSwitchOffset(cases[i].target);
+        }
+    }
+    jumpTarget();
 
     // patch all end‐of‐switch jumps
-    for (int i = 0; i < endCount; i++)
+    for (ZInt32 i = 0; i < endCount; i++)
     {
         patchJump(endJumps[i]);
     }
 
     // patch all ‘quitter’ inside switch
-    for (int i = 0; i < current->switchContext.switchBreakCount; i++)
+    for (ZInt32 i = 0; i < sw->breakCount; i++)
     {
-        patchJump(current->switchContext.switchBreakJumps[i]);
+        patchJump(sw->breakJumps[i]);
     }
-    free(current->switchContext.switchBreakJumps);
-    current->switchContext.switchBreakJumps = NULL;
-    current->switchContext.switchBreakCount = 0;
-    current->switchContext.switchDepth--;
+    free(sw->breakJumps);
+    free(endJumps);
+    free(cases);
+    vm->compiler->switchContext.switchDepth--;
 
-    // pop temp local
-    current->localCount--;
+    // pop the discriminant
+    endScope();
 }
 
 static void ifStatement()
@@ -1399,15 +2058,11 @@ static void ifStatement()
     expression();
     consume(TOKEN_RIGHT_PAREN, "Parenthèse ')' attendue après la condition.");
 
-    ZInt32 thenJump = emitJump(OP_JUMP_IF_FALSE);
-    // Pop condition if true
-    emitByte(OP_POP);
+    ZInt32 thenJump = emitJumpIfFalsePop();
     statement();
 
     ZInt32 elseJump = emitJump(OP_JUMP);
     patchJump(thenJump);
-    // Pop condition if false
-    emitByte(OP_POP);
 
     // Handle 'sinon si' and 'sinon'
     while (match(TOKEN_ELSE_IF))
@@ -1416,13 +2071,11 @@ static void ifStatement()
         expression();
         consume(TOKEN_RIGHT_PAREN, "Parenthèse ')' attendue après la condition.");
 
-        ZInt32 elseifJump = emitJump(OP_JUMP_IF_FALSE);
-        emitByte(OP_POP); // Pop condition if true
+        ZInt32 elseifJump = emitJumpIfFalsePop();
         statement();
 
         ZInt32 nextJump = emitJump(OP_JUMP);
         patchJump(elseifJump);
-        emitByte(OP_POP); // Pop condition if false
 
         elseJump = nextJump;
     }
@@ -1448,7 +2101,7 @@ static void printStatement()
 
 static void returnStatement()
 {
-    if (TYPE_SCRIPT == current->type)
+    if (TYPE_SCRIPT == vm->compiler->type)
     {
         error("Impossible de faire un 'returner' au niveau supérieur.");
     }
@@ -1461,6 +2114,17 @@ static void returnStatement()
     {
         expression();
         consume(TOKEN_SEMICOLON, "Point-virgule ';' attendu après la valeur de retour.");
+
+        /*
+        @Note: When the call is the very last instruction of the returned
+               expression it is in tail position and can reuse the frame.
+               The OP_RETURN is still emitted: jumps out of 'et'/'ou'/'?:'
+               branches that skip the call land on it.
+        */
+        if (vm->compiler->lastCall == currentChunk()->count - 2)
+        {
+            currentChunk()->code[vm->compiler->lastCall] = OP_TAIL_CALL;
+        }
         emitByte(OP_RETURN);
     }
 }
@@ -1470,28 +2134,26 @@ static void whileStatement()
     beginScope();
     beginLoop();
 
-    current->loopContext.loops[current->loopContext.loopDepth - 1].loopStart = currentChunk()->count;
+    vm->compiler->loopContext.loops[vm->compiler->loopContext.loopDepth - 1].loopStart = jumpTarget();
 
     consume(TOKEN_LEFT_PAREN, "Parenthèse '(' attendue après boucle 'tantque'.");
     expression();
     consume(TOKEN_RIGHT_PAREN, "Parenthèse ')' attendue après une condition.");
 
     // jump out if condition is false;
-    ZInt32 exitJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
+    ZInt32 exitJump = emitJumpIfFalsePop();
 
     // Set where breaks should jump to (after the loop)
-    current->loopContext.loops[current->loopContext.loopDepth - 1].loopEnd = currentChunk()->count;
+    vm->compiler->loopContext.loops[vm->compiler->loopContext.loopDepth - 1].loopEnd = currentChunk()->count;
 
     // Loop body
     statement();
 
     // Jump back to condition check
-    emitLoop(current->loopContext.loops[current->loopContext.loopDepth - 1].loopStart);
+    emitLoop(vm->compiler->loopContext.loops[vm->compiler->loopContext.loopDepth - 1].loopStart);
 
     // Patch exit jump (points here when condition is false)
     patchJump(exitJump);
-    emitByte(OP_POP);
 
     endLoop();
     endScope(); // End the while loop scope
@@ -1499,15 +2161,15 @@ static void whileStatement()
 
 static void synchronize()
 {
-    parser.panicMode = ZFALSE;
+    vm->parser->panicMode = ZFALSE;
 
-    while (parser.current.type != TOKEN_EOF)
+    while (vm->parser->current.type != TOKEN_EOF)
     {
-        if (parser.previous.type == TOKEN_SEMICOLON)
+        if (vm->parser->previous.type == TOKEN_SEMICOLON)
         {
             return;
         }
-        switch (parser.current.type)
+        switch (vm->parser->current.type)
         {
         case TOKEN_CLASS:
         case TOKEN_FUN:
@@ -1543,7 +2205,7 @@ static void declaration()
         statement();
     }
 
-    if (parser.panicMode)
+    if (vm->parser->panicMode)
     {
         synchronize();
     }
@@ -1595,9 +2257,13 @@ static void statement()
     }
 }
 
-ObjFunction *compile(const ZChar *source)
+ObjFunction *compile(VM *context, const ZChar *source)
 {
-    initScanner(source);
+    VM *previous = vm;
+    vm = context;
+    Parser parser;
+    initScanner(&parser.scanner, source);
+    vm->parser = &parser;
     Compiler compiler;
     initCompiler(&compiler, TYPE_SCRIPT);
 
@@ -1615,12 +2281,14 @@ ObjFunction *compile(const ZChar *source)
     /*
     @NOTE: This way, the VM doesn’t try to execute a function that may contain invalid bytecode.
     */
+    vm->parser = NULL;
+    vm = previous;
     return parser.hadError ? NULL : function;
 }
 
 void markCompilerRoots()
 {
-    Compiler *compiler = current;
+    Compiler *compiler = vm->compiler;
     while (NULL != compiler)
     {
         markObject((Obj *)compiler->function);
@@ -5,10 +5,11 @@
 #include "common/commonTypes.h"
 #include "chunk/chunk.h"
 #include "object/object.h"
+#include "vm/vm.h"
 
 #define JUMP_OFFSET_SIZE 3  // Use 24-bit offsets
 
-ObjFunction* compile(const ZChar* source);
+ObjFunction* compile(VM* context, const ZChar* source);
 void markCompilerRoots();
 
 #endif
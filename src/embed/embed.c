@@ -0,0 +1,70 @@
+#include <stdlib.h>
+
+#include "compiler/compiler.h"
+#include "embed/embed.h"
+#include "memory/memory.h"
+#include "vm/vm.h"
+
+Program* compileProgram(VM* context, const ZChar* source)
+{
+    ObjFunction* function = compile(context, source);
+    if (NULL == function)
+    {
+        return NULL;
+    }
+
+    // nothing is allocated on the heap before the function is rooted
+    Program* program = (Program*)malloc(sizeof(Program));
+    if (NULL == program)
+    {
+        exit(1);
+    }
+    program->function = function;
+    program->previous = NULL;
+    program->next = context->programs;
+    if (NULL != context->programs)
+    {
+        context->programs->previous = program;
+    }
+    context->programs = program;
+    return program;
+}
+
+InterpretResult runProgram(VM* context, Program* program)
+{
+    return interpretFunction(context, program->function);
+}
+
+void freeProgram(VM* context, Program* program)
+{
+    if (NULL != program->previous)
+    {
+        program->previous->next = program->next;
+    }
+    else
+    {
+        context->programs = program->next;
+    }
+    if (NULL != program->next)
+    {
+        program->next->previous = program->previous;
+    }
+    free(program);
+}
+
+void resetGlobals(VM* context)
+{
+    VM* previous = vm;
+    vm = context;
+    for (ZInt32 i = 0; i < vm->globalValues.count; i++)
+    {
+        vm->globalValues.values[i] = UNDEFINED_VAL;
+    }
+    for (ZInt32 i = 0; i < vm->nativeGlobals.count; i += 2)
+    {
+        ZInt32 slot = (ZInt32)AS_INT(vm->nativeGlobals.values[i]);
+        vm->globalValues.values[slot] = vm->nativeGlobals.values[i + 1];
+        globalWriteBarrier(slot, vm->globalValues.values[slot]);
+    }
+    vm = previous;
+}
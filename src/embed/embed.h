@@ -0,0 +1,37 @@
+#ifndef ZIA_EMBED_H
+#define ZIA_EMBED_H
+
+#include "common/common.h"
+#include "common/commonTypes.h"
+#include "vm/vm.h"
+
+/*
+@Note: Embedding zia in a host program. A script is compiled once into a
+       Program, which keeps its code alive across collections until it is
+       freed, and can then be run any number of times:
+           VM vm;
+           initVM(&vm);
+           defineNative(&vm, "lire", readNative);
+           Program* program = compileProgram(&vm, source);
+           for (each request)
+           {
+               resetGlobals(&vm);
+               runProgram(&vm, program);
+           }
+           freeProgram(&vm, program);
+           freeVM(&vm);
+       Without resetGlobals() a run sees the globals the previous ones left.
+       A program belongs to the VM that compiled it: global slots and
+       strings are resolved against that VM.
+       debug/embed_host.c is a complete host, built with make embed-host.
+*/
+
+// NULL when the source does not compile, the errors are written on context->err
+Program* compileProgram(VM* context, const ZChar* source);
+InterpretResult runProgram(VM* context, Program* program);
+void freeProgram(VM* context, Program* program);
+
+// every global back to undefined, except the natives, which get their first value back
+void resetGlobals(VM* context);
+
+#endif
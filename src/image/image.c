@@ -0,0 +1,905 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache/cache.h"
+#include "image/image.h"
+#include "memory/memory.h"
+#include "table/table.h"
+#include "value/value.h"
+#include "vm/vm.h"
+
+/*
+@Note: Layout of a .ziai file, in the byte order of the machine that wrote
+       it, which the magic number gives away:
+         ImageHeader
+         the objects, one record each, numbered from 0 in file order
+         the globals, one per slot in slot order: the object number of
+         the name, then the value
+       A record is the object type on one byte and its fields. Objects
+       point to each other by number, never by address, so the file does
+       not depend on where it is mapped:
+         string    interned byte, 32-bit length, the characters
+         function  arity, upvalue count, stack size, name (IMAGE_NONE
+                   for none), the count of code bytes and the bytes
+                   themselves, padding to 4, the line of each byte as a
+                   32-bit integer, then the count of constants and the
+                   constants
+         closure   function, upvalue count, the upvalues
+         upvalue   its closed value
+         native    the global slot defineNative() gave it
+       A value is a kind byte and its payload, see ImageValue.
+       Like CACHE_VERSION, IMAGE_VERSION has to follow the opcodes, and
+       the header keeps hashFingerprint() since string tables of
+       OP_SWITCH_STRING in the code are sorted by hash.
+*/
+#define IMAGE_MAGIC   0x4941495au  // "ZIAI" read as a little-endian word
+#define IMAGE_VERSION 4
+#define IMAGE_NONE    0xffffffffu
+
+#ifdef NAN_BOXING
+#define IMAGE_BUILD 1
+#else
+#define IMAGE_BUILD 0
+#endif
+
+typedef struct
+{
+    ZUInt32 magic;
+    ZUInt32 version;
+    ZUInt32 build;
+    ZUInt32 hashes;       // hashFingerprint() of the writer
+    ZUInt32 objectCount;
+    ZUInt32 globalCount;
+    ZUInt32 entry;        // object number of the entry closure
+}ImageHeader;
+
+typedef enum
+{
+    IMAGE_NUL,
+    IMAGE_TRUE,
+    IMAGE_FALSE,
+    IMAGE_REAL,
+    IMAGE_INT,
+    IMAGE_UNDEFINED,
+    IMAGE_OBJECT,
+}ImageValue;
+
+ZBool isImagePath(const ZChar* path)
+{
+    size_t length = strlen(path);
+    return length >= 5 && 0 == strcmp(path + length - 5, ".ziai");
+}
+
+// --- writing ---
+
+/*
+@Note: The objects to write, in the order they are numbered, and an open
+       addressing map from each one to its number. They are found from the
+       globals breadth first. Both live outside the collected heap: the
+       objects are reachable from the globals, which is enough to keep them.
+*/
+typedef struct
+{
+    Obj** objects;
+    ZInt32 count;
+    ZInt32 capacity;
+    Obj** keys;
+    ZUInt32* numbers;
+    ZInt32 keyCapacity;    // a power of two, at most half full
+    ZBool failed;
+}ImageObjects;
+
+static void* imageAllocate(void* pointer, size_t size)
+{
+    void* result = realloc(pointer, size);
+    if (NULL == result)
+    {
+        exit(1);
+    }
+    return result;
+}
+
+static ZUInt32 objectHash(Obj* object)
+{
+    return (ZUInt32)(((uintptr_t)object >> 4) * 0x9e3779b1u);
+}
+
+// the number of 'object', IMAGE_NONE if it has none yet
+static ZUInt32 objectNumber(ImageObjects* objects, Obj* object)
+{
+    if (0 == objects->keyCapacity)
+    {
+        return IMAGE_NONE;
+    }
+    ZUInt32 mask = (ZUInt32)objects->keyCapacity - 1;
+    for (ZUInt32 slot = objectHash(object) & mask;; slot = (slot + 1) & mask)
+    {
+        if (NULL == objects->keys[slot])
+        {
+            return IMAGE_NONE;
+        }
+        if (objects->keys[slot] == object)
+        {
+            return objects->numbers[slot];
+        }
+    }
+}
+
+static void insertNumber(ImageObjects* objects, Obj* object, ZUInt32 number)
+{
+    ZUInt32 mask = (ZUInt32)objects->keyCapacity - 1;
+    ZUInt32 slot = objectHash(object) & mask;
+    while (NULL != objects->keys[slot])
+    {
+        slot = (slot + 1) & mask;
+    }
+    objects->keys[slot] = object;
+    objects->numbers[slot] = number;
+}
+
+static void addObject(ImageObjects* objects, Obj* object)
+{
+    if (NULL == object || IMAGE_NONE != objectNumber(objects, object))
+    {
+        return;
+    }
+    if (OBJ_STRING == object->type)
+    {
+        // a rope is written as the flat string it stands for
+        flattenString((ObjString*)object);
+    }
+
+    if (objects->count == objects->capacity)
+    {
+        objects->capacity = GROW_CAPACITY(objects->capacity);
+        objects->objects = (Obj**)imageAllocate(objects->objects, sizeof(Obj*) * objects->capacity);
+    }
+    if ((objects->count + 1) * 2 > objects->keyCapacity)
+    {
+        Obj** keys = objects->keys;
+        ZUInt32* numbers = objects->numbers;
+        ZInt32 keyCapacity = objects->keyCapacity;
+        objects->keyCapacity = GROW_CAPACITY(keyCapacity);
+        objects->keys = (Obj**)calloc(objects->keyCapacity, sizeof(Obj*));
+        objects->numbers = (ZUInt32*)imageAllocate(NULL, sizeof(ZUInt32) * objects->keyCapacity);
+        if (NULL == objects->keys)
+        {
+            exit(1);
+        }
+        for (ZInt32 i = 0; i < keyCapacity; i++)
+        {
+            if (NULL != keys[i])
+            {
+                insertNumber(objects, keys[i], numbers[i]);
+            }
+        }
+        free(keys);
+        free(numbers);
+    }
+
+    insertNumber(objects, object, (ZUInt32)objects->count);
+    objects->objects[objects->count++] = object;
+}
+
+static void addValue(ImageObjects* objects, Value value)
+{
+    if (IS_OBJ(value))
+    {
+        addObject(objects, AS_OBJ(value));
+    }
+}
+
+// numbers every object reachable from the globals, the objects found are visited in turn
+static void findObjects(ImageObjects* objects)
+{
+    for (ZInt32 i = 0; i < vm->globalValues.count; i++)
+    {
+        addValue(objects, vm->globalNames.values[i]);
+        addValue(objects, vm->globalValues.values[i]);
+    }
+
+    for (ZInt32 i = 0; i < objects->count; i++)
+    {
+        Obj* object = objects->objects[i];
+        switch (object->type)
+        {
+        case OBJ_FUNCTION:
+        {
+            ObjFunction* function = (ObjFunction*)object;
+            addObject(objects, (Obj*)function->name);
+            for (ZInt32 j = 0; j < function->chunk.constants.count; j++)
+            {
+                addValue(objects, function->chunk.constants.values[j]);
+            }
+            break;
+        }
+        case OBJ_CLOSURE:
+        {
+            ObjClosure* closure = (ObjClosure*)object;
+            addObject(objects, (Obj*)closure->function);
+            for (ZInt32 j = 0; j < closure->upvalueCount; j++)
+            {
+                addObject(objects, (Obj*)closure->upvalues[j]);
+            }
+            break;
+        }
+        case OBJ_UPVALUE:
+        {
+            ObjUpvalue* upvalue = (ObjUpvalue*)object;
+            // an upvalue still open points into a stack that is not part of the image
+            if (upvalue->location != &upvalue->closed)
+            {
+                objects->failed = ZTRUE;
+            }
+            addValue(objects, upvalue->closed);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+static void freeImageObjects(ImageObjects* objects)
+{
+    free(objects->objects);
+    free(objects->keys);
+    free(objects->numbers);
+}
+
+typedef struct
+{
+    FILE* file;
+    size_t offset;
+    ZBool failed;
+}ImageWriter;
+
+static void writeBytes(ImageWriter* writer, const void* bytes, size_t count)
+{
+    if (count > 0 && fwrite(bytes, 1, count, writer->file) != count)
+    {
+        writer->failed = ZTRUE;
+    }
+    writer->offset += count;
+}
+
+static void writeU8(ImageWriter* writer, ZUInt8 value)
+{
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writeU32(ImageWriter* writer, ZUInt32 value)
+{
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writePadding(ImageWriter* writer)
+{
+    static const ZUInt8 zeros[4] = { 0 };
+    writeBytes(writer, zeros, (4 - writer->offset % 4) % 4);
+}
+
+static void writeReference(ImageWriter* writer, ImageObjects* objects, Obj* object)
+{
+    writeU32(writer, NULL != object ? objectNumber(objects, object) : IMAGE_NONE);
+}
+
+static void writeValue(ImageWriter* writer, ImageObjects* objects, Value value)
+{
+    if (IS_UNDEFINED(value))
+    {
+        writeU8(writer, IMAGE_UNDEFINED);
+    }
+    else if (IS_NIL(value))
+    {
+        writeU8(writer, IMAGE_NUL);
+    }
+    else if (IS_BOOL(value))
+    {
+        writeU8(writer, AS_BOOL(value) ? IMAGE_TRUE : IMAGE_FALSE);
+    }
+    else if (IS_INT(value))
+    {
+        ZInt64 integer = AS_INT(value);
+        writeU8(writer, IMAGE_INT);
+        writeBytes(writer, &integer, sizeof(integer));
+    }
+    else if (IS_REAL(value))
+    {
+        ZReal64 real = AS_REAL(value);
+        writeU8(writer, IMAGE_REAL);
+        writeBytes(writer, &real, sizeof(real));
+    }
+    else
+    {
+        writeU8(writer, IMAGE_OBJECT);
+        writeReference(writer, objects, AS_OBJ(value));
+    }
+}
+
+// the slot a native was defined in, -1 for a native defineNative() did not make
+static ZInt32 nativeSlot(Obj* native)
+{
+    for (ZInt32 i = 0; i + 1 < vm->nativeGlobals.count; i += 2)
+    {
+        if (AS_OBJ(vm->nativeGlobals.values[i + 1]) == native)
+        {
+            return (ZInt32)AS_INT(vm->nativeGlobals.values[i]);
+        }
+    }
+    return -1;
+}
+
+static void writeObject(ImageWriter* writer, ImageObjects* objects, Obj* object)
+{
+    writeU8(writer, (ZUInt8)object->type);
+    switch (object->type)
+    {
+    case OBJ_STRING:
+    {
+        ObjString* string = (ObjString*)object;
+        writeU8(writer, (ZUInt8)string->interned);
+        writeU32(writer, (ZUInt32)string->length);
+        writeBytes(writer, string->chars, string->length);
+        break;
+    }
+    case OBJ_FUNCTION:
+    {
+        ObjFunction* function = (ObjFunction*)object;
+        Chunk* chunk = &function->chunk;
+        writeU32(writer, (ZUInt32)function->arity);
+        writeU32(writer, (ZUInt32)function->upvalueCount);
+        writeU32(writer, (ZUInt32)function->maxStack);
+        writeReference(writer, objects, (Obj*)function->name);
+        writeU32(writer, (ZUInt32)chunk->count);
+        writeBytes(writer, chunk->code, chunk->count);
+        writePadding(writer);
+        writeBytes(writer, chunk->lines, sizeof(ZInt32) * chunk->count);
+        writeU32(writer, (ZUInt32)chunk->constants.count);
+        for (ZInt32 i = 0; i < chunk->constants.count; i++)
+        {
+            writeValue(writer, objects, chunk->constants.values[i]);
+        }
+        break;
+    }
+    case OBJ_CLOSURE:
+    {
+        ObjClosure* closure = (ObjClosure*)object;
+        writeReference(writer, objects, (Obj*)closure->function);
+        writeU32(writer, (ZUInt32)closure->upvalueCount);
+        for (ZInt32 i = 0; i < closure->upvalueCount; i++)
+        {
+            writeReference(writer, objects, (Obj*)closure->upvalues[i]);
+        }
+        break;
+    }
+    case OBJ_UPVALUE:
+        writeValue(writer, objects, ((ObjUpvalue*)object)->closed);
+        break;
+    case OBJ_NATIVE:
+    {
+        ZInt32 slot = nativeSlot(object);
+        if (slot < 0)
+        {
+            writer->failed = ZTRUE;
+        }
+        writeU32(writer, (ZUInt32)slot);
+        break;
+    }
+    }
+}
+
+// the closure the global 'name' holds, NULL if there is none
+static ObjClosure* findEntry(const ZChar* name)
+{
+    Value slot;
+    if (!tableGet(&vm->globalSlots, copyString(name, (ZInt32)strlen(name)), &slot))
+    {
+        return NULL;
+    }
+    Value value = vm->globalValues.values[AS_INT(slot)];
+    return IS_CLOSURE(value) ? AS_CLOSURE(value) : NULL;
+}
+
+static ZInt32 writeImageFile(const ZChar* path, const ZChar* entry)
+{
+    ObjClosure* closure = findEntry(entry);
+    if (NULL == closure || 0 != closure->function->arity)
+    {
+        fprintf(vm->err, "Fonction d'entrée '%s' introuvable: il faut une fonction globale sans paramètres.\n", entry);
+        return 70;
+    }
+
+    ImageObjects objects;
+    memset(&objects, 0, sizeof(objects));
+    findObjects(&objects);
+
+    // as for a .ziac, the file only takes its name once it is complete
+    ZChar temporary[4096 + 32];
+    static ZInt32 writes = 0;
+    snprintf(temporary, sizeof(temporary), "%s.%ld.%d", path, (long)getpid(),
+             __atomic_add_fetch(&writes, 1, __ATOMIC_SEQ_CST));
+    ImageWriter writer = { ZTRUE == objects.failed ? NULL : fopen(temporary, "wb"), 0, ZFALSE };
+    if (NULL == writer.file)
+    {
+        fprintf(vm->err, "Impossible d'écrire l'image \"%s\".\n", path);
+        freeImageObjects(&objects);
+        return 74;
+    }
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = IMAGE_MAGIC;
+    header.version = IMAGE_VERSION;
+    header.build = IMAGE_BUILD;
+    header.hashes = hashFingerprint();
+    header.objectCount = (ZUInt32)objects.count;
+    header.globalCount = (ZUInt32)vm->globalValues.count;
+    header.entry = objectNumber(&objects, (Obj*)closure);
+    writeBytes(&writer, &header, sizeof(header));
+    for (ZInt32 i = 0; i < objects.count; i++)
+    {
+        writeObject(&writer, &objects, objects.objects[i]);
+    }
+    for (ZInt32 i = 0; i < vm->globalValues.count; i++)
+    {
+        writeReference(&writer, &objects, AS_OBJ(vm->globalNames.values[i]));
+        writeValue(&writer, &objects, vm->globalValues.values[i]);
+    }
+    freeImageObjects(&objects);
+
+    if (0 != fclose(writer.file) || ZTRUE == writer.failed || 0 != rename(temporary, path))
+    {
+        remove(temporary);
+        fprintf(vm->err, "Impossible d'écrire l'image \"%s\".\n", path);
+        return 74;
+    }
+    return 0;
+}
+
+ZInt32 writeImage(VM* context, const ZChar* path, const ZChar* entry)
+{
+    VM* previous = vm;
+    vm = context;
+    ZInt32 status = writeImageFile(path, entry);
+    vm = previous;
+    return status;
+}
+
+// --- reading ---
+
+/*
+@Note: The records are read three times, straight from the mapping:
+         IMAGE_ALLOCATE  every object but the closures is made, strings
+                         complete, the others without their references
+         IMAGE_CLOSURES  the closures, which need their function's
+                         upvalue count
+         IMAGE_LINK      the references are filled in, numbers turned
+                         into the addresses of the objects just made
+       Until the globals hold them, the objects are kept in
+       vm->imageObjects, a root, by number. The chunks borrow the code
+       and line bytes of the mapping, which stays mapped until freeVM().
+*/
+typedef enum
+{
+    IMAGE_ALLOCATE,
+    IMAGE_CLOSURES,
+    IMAGE_LINK,
+}ImagePass;
+
+typedef struct
+{
+    const ZUInt8* start;
+    const ZUInt8* current;
+    const ZUInt8* end;
+    ZUInt32 objectCount;
+    ZBool failed;
+}ImageReader;
+
+// the next 'count' bytes of the file, NULL once it is found truncated
+static const ZUInt8* readBytes(ImageReader* reader, size_t count)
+{
+    if (ZTRUE == reader->failed || (size_t)(reader->end - reader->current) < count)
+    {
+        reader->failed = ZTRUE;
+        return NULL;
+    }
+    const ZUInt8* bytes = reader->current;
+    reader->current += count;
+    return bytes;
+}
+
+static ZUInt8 readU8(ImageReader* reader)
+{
+    const ZUInt8* byte = readBytes(reader, 1);
+    return NULL != byte ? *byte : 0;
+}
+
+static ZUInt32 readU32(ImageReader* reader)
+{
+    ZUInt32 value = 0;
+    const ZUInt8* bytes = readBytes(reader, sizeof(value));
+    if (NULL != bytes)
+    {
+        memcpy(&value, bytes, sizeof(value));
+    }
+    return value;
+}
+
+static void skipPadding(ImageReader* reader)
+{
+    readBytes(reader, (4 - (size_t)(reader->current - reader->start) % 4) % 4);
+}
+
+// object 'number' once made, NULL when it is not one of type 'type'
+static Obj* imageObject(ImageReader* reader, ZUInt32 number, ObjType type)
+{
+    if (number >= (ZUInt32)vm->imageObjects.count || !isObjType(vm->imageObjects.values[number], type))
+    {
+        reader->failed = ZTRUE;
+        return NULL;
+    }
+    return AS_OBJ(vm->imageObjects.values[number]);
+}
+
+// a reference to an object of type 'type', NULL for IMAGE_NONE, or before IMAGE_LINK
+static Obj* readReference(ImageReader* reader, ImagePass pass, ObjType type)
+{
+    ZUInt32 number = readU32(reader);
+    if (IMAGE_NONE == number)
+    {
+        return NULL;
+    }
+    if (number >= reader->objectCount)
+    {
+        reader->failed = ZTRUE;
+        return NULL;
+    }
+    return IMAGE_LINK == pass ? imageObject(reader, number, type) : NULL;
+}
+
+// the value, or nul for a reference read before IMAGE_LINK
+static Value readValue(ImageReader* reader, ImagePass pass)
+{
+    ZUInt8 kind = readU8(reader);
+    switch (kind)
+    {
+    case IMAGE_NUL:
+        return NUL_VAL;
+    case IMAGE_TRUE:
+        return BOOL_VAL(ZTRUE);
+    case IMAGE_FALSE:
+        return BOOL_VAL(ZFALSE);
+    case IMAGE_UNDEFINED:
+        return UNDEFINED_VAL;
+    case IMAGE_INT:
+    case IMAGE_REAL:
+    {
+        const ZUInt8* bytes = readBytes(reader, 8);
+        if (NULL == bytes)
+        {
+            return NUL_VAL;
+        }
+        if (IMAGE_INT == kind)
+        {
+            ZInt64 integer;
+            memcpy(&integer, bytes, sizeof(integer));
+            if (!INT_FITS(integer))
+            {
+                reader->failed = ZTRUE;
+                return NUL_VAL;
+            }
+            return INT_VAL(integer);
+        }
+        ZReal64 real;
+        memcpy(&real, bytes, sizeof(real));
+        return NUMBER_VAL(real);
+    }
+    case IMAGE_OBJECT:
+    {
+        ZUInt32 number = readU32(reader);
+        if (number >= reader->objectCount)
+        {
+            reader->failed = ZTRUE;
+            return NUL_VAL;
+        }
+        if (IMAGE_LINK != pass || ZTRUE == reader->failed)
+        {
+            return NUL_VAL;
+        }
+        Value value = vm->imageObjects.values[number];
+        if (!IS_OBJ(value))
+        {
+            reader->failed = ZTRUE;
+        }
+        return value;
+    }
+    default:
+        reader->failed = ZTRUE;
+        return NUL_VAL;
+    }
+}
+
+static void readString(ImageReader* reader, ImagePass pass)
+{
+    ZBool interned = (ZBool)readU8(reader);
+    ZUInt32 length = readU32(reader);
+    const ZUInt8* chars = readBytes(reader, length);
+    if (IMAGE_ALLOCATE != pass || NULL == chars)
+    {
+        return;
+    }
+    ObjString* string = ZTRUE == interned ? copyString((const ZChar*)chars, (ZInt32)length)
+                                          : newString((const ZChar*)chars, (ZInt32)length);
+    writeValueArray(&vm->imageObjects, OBJ_VAL(string));
+}
+
+static void readFunction(ImageReader* reader, ImagePass pass, ZUInt32 number)
+{
+    ZInt32 arity = (ZInt32)readU32(reader);
+    ZInt32 upvalueCount = (ZInt32)readU32(reader);
+    ZInt32 maxStack = (ZInt32)readU32(reader);
+    Obj* name = readReference(reader, pass, OBJ_STRING);
+    ZUInt32 count = readU32(reader);
+    const ZUInt8* code = readBytes(reader, count);
+    skipPadding(reader);
+    const ZUInt8* lines = readBytes(reader, sizeof(ZInt32) * (size_t)count);
+    if (ZTRUE == reader->failed || 0 == count || arity < 0 || upvalueCount < 0 || upvalueCount > UINT8_COUNT ||
+        maxStack <= arity || maxStack > STACK_MAX)
+    {
+        reader->failed = ZTRUE;
+        return;
+    }
+
+    ObjFunction* function = NULL;
+    if (IMAGE_ALLOCATE == pass)
+    {
+        function = newFunction();
+        function->arity = arity;
+        function->upvalueCount = upvalueCount;
+        function->maxStack = maxStack;
+        function->chunk.code = (ZUInt8*)code;
+        function->chunk.lines = (ZInt32*)lines;
+        function->chunk.count = (ZInt32)count;
+        writeValueArray(&vm->imageObjects, OBJ_VAL(function));
+    }
+    else if (IMAGE_LINK == pass)
+    {
+        function = (ObjFunction*)imageObject(reader, number, OBJ_FUNCTION);
+        if (NULL != function && NULL != name)
+        {
+            function->name = (ObjString*)name;
+            writeBarrier((Obj*)function, OBJ_VAL(name));
+        }
+    }
+
+    ZUInt32 constantCount = readU32(reader);
+    for (ZUInt32 i = 0; i < constantCount && ZFALSE == reader->failed; i++)
+    {
+        Value value = readValue(reader, pass);
+        if (IMAGE_LINK == pass && NULL != function)
+        {
+            addConstant(&function->chunk, value);
+            writeBarrier((Obj*)function, value);
+        }
+    }
+}
+
+static void readClosure(ImageReader* reader, ImagePass pass, ZUInt32 number)
+{
+    ZUInt32 functionNumber = readU32(reader);
+    ZUInt32 upvalueCount = readU32(reader);
+    if (IMAGE_ALLOCATE == pass)
+    {
+        // a placeholder, the closure is made once every function is
+        writeValueArray(&vm->imageObjects, NUL_VAL);
+    }
+    else if (IMAGE_CLOSURES == pass)
+    {
+        ObjFunction* function = (ObjFunction*)imageObject(reader, functionNumber, OBJ_FUNCTION);
+        if (NULL == function || (ZUInt32)function->upvalueCount != upvalueCount)
+        {
+            reader->failed = ZTRUE;
+            return;
+        }
+        vm->imageObjects.values[number] = OBJ_VAL(newClosure(function));
+    }
+
+    ObjClosure* closure = IMAGE_LINK == pass ? (ObjClosure*)imageObject(reader, number, OBJ_CLOSURE) : NULL;
+    for (ZUInt32 i = 0; i < upvalueCount && ZFALSE == reader->failed; i++)
+    {
+        Obj* upvalue = readReference(reader, pass, OBJ_UPVALUE);
+        if (NULL != closure)
+        {
+            if (NULL == upvalue || i >= (ZUInt32)closure->upvalueCount)
+            {
+                reader->failed = ZTRUE;
+                return;
+            }
+            closure->upvalues[i] = (ObjUpvalue*)upvalue;
+            writeBarrier((Obj*)closure, OBJ_VAL(upvalue));
+        }
+    }
+}
+
+static void readUpvalue(ImageReader* reader, ImagePass pass, ZUInt32 number)
+{
+    Value closed = readValue(reader, pass);
+    if (IMAGE_ALLOCATE == pass)
+    {
+        ObjUpvalue* upvalue = newUpvalue(NULL);
+        upvalue->location = &upvalue->closed;
+        writeValueArray(&vm->imageObjects, OBJ_VAL(upvalue));
+    }
+    else if (IMAGE_LINK == pass)
+    {
+        ObjUpvalue* upvalue = (ObjUpvalue*)imageObject(reader, number, OBJ_UPVALUE);
+        if (NULL != upvalue)
+        {
+            upvalue->closed = closed;
+            writeBarrier((Obj*)upvalue, closed);
+        }
+    }
+}
+
+// a native is the one this VM defined in the same slot
+static void readNative(ImageReader* reader, ImagePass pass)
+{
+    ZInt32 slot = (ZInt32)readU32(reader);
+    if (IMAGE_ALLOCATE != pass)
+    {
+        return;
+    }
+    for (ZInt32 i = 0; i + 1 < vm->nativeGlobals.count; i += 2)
+    {
+        if (AS_INT(vm->nativeGlobals.values[i]) == slot)
+        {
+            writeValueArray(&vm->imageObjects, vm->nativeGlobals.values[i + 1]);
+            return;
+        }
+    }
+    reader->failed = ZTRUE;
+}
+
+static void readObjects(ImageReader* reader, ImagePass pass)
+{
+    for (ZUInt32 i = 0; i < reader->objectCount && ZFALSE == reader->failed; i++)
+    {
+        switch (readU8(reader))
+        {
+        case OBJ_STRING:
+            readString(reader, pass);
+            break;
+        case OBJ_FUNCTION:
+            readFunction(reader, pass, i);
+            break;
+        case OBJ_CLOSURE:
+            readClosure(reader, pass, i);
+            break;
+        case OBJ_UPVALUE:
+            readUpvalue(reader, pass, i);
+            break;
+        case OBJ_NATIVE:
+            readNative(reader, pass);
+            break;
+        default:
+            reader->failed = ZTRUE;
+            break;
+        }
+    }
+}
+
+/*
+@Note: Every name is given its slot before any value is stored, so a file
+       whose slots do not match leaves the values of the globals as they were.
+*/
+static void readGlobals(ImageReader* reader, ZUInt32 count)
+{
+    const ZUInt8* globals = reader->current;
+    for (ZUInt32 i = 0; i < count && ZFALSE == reader->failed; i++)
+    {
+        ObjString* name = (ObjString*)readReference(reader, IMAGE_LINK, OBJ_STRING);
+        readValue(reader, IMAGE_ALLOCATE);
+        if (NULL == name || ZFALSE == name->interned || (ZInt32)i != globalSlot(name))
+        {
+            reader->failed = ZTRUE;
+        }
+    }
+    if (ZTRUE == reader->failed || reader->current != reader->end)
+    {
+        reader->failed = ZTRUE;
+        return;
+    }
+
+    reader->current = globals;
+    for (ZUInt32 i = 0; i < count; i++)
+    {
+        readU32(reader);
+        Value value = readValue(reader, IMAGE_LINK);
+        vm->globalValues.values[i] = value;
+        globalWriteBarrier((ZInt32)i, value);
+    }
+}
+
+static ObjClosure* readImage(const ZUInt8* base, size_t size)
+{
+    ImageHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (IMAGE_MAGIC != header.magic || IMAGE_VERSION != header.version || IMAGE_BUILD != header.build ||
+        hashFingerprint() != header.hashes ||
+        header.objectCount > size || header.globalCount > GLOBALS_MAX || header.entry >= header.objectCount)
+    {
+        return NULL;
+    }
+
+    ImageReader reader = { base, base + sizeof(header), base + size, header.objectCount, ZFALSE };
+    // sized once: growing it could start a collection between making an object and storing it
+    initValueArray(&vm->imageObjects);
+    vm->imageObjects.values = GROW_ARRAY(Value, NULL, 0, header.objectCount);
+    vm->imageObjects.capacity = (ZInt32)header.objectCount;
+    readObjects(&reader, IMAGE_ALLOCATE);
+    for (ImagePass pass = IMAGE_CLOSURES; pass <= IMAGE_LINK && ZFALSE == reader.failed; pass++)
+    {
+        reader.current = base + sizeof(header);
+        readObjects(&reader, pass);
+    }
+
+    ObjClosure* entry = NULL;
+    if (ZFALSE == reader.failed)
+    {
+        entry = (ObjClosure*)imageObject(&reader, header.entry, OBJ_CLOSURE);
+    }
+    if (NULL != entry && 0 == entry->function->arity)
+    {
+        readGlobals(&reader, header.globalCount);
+    }
+    // the entry is a global: it needs no other root from now on
+    freeValueArray(&vm->imageObjects);
+    return ZFALSE == reader.failed && NULL != entry && 0 == entry->function->arity ? entry : NULL;
+}
+
+ObjClosure* loadImage(VM* context, const ZChar* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    struct stat status;
+    if (0 != fstat(fd, &status) || (size_t)status.st_size < sizeof(ImageHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)status.st_size;
+    void* base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == base)
+    {
+        return NULL;
+    }
+
+    VM* previous = vm;
+    vm = context;
+    ObjClosure* entry = readImage((const ZUInt8*)base, size);
+    vm = previous;
+
+    MappedCache* mapping = NULL != entry ? (MappedCache*)malloc(sizeof(MappedCache)) : NULL;
+    if (NULL == mapping)
+    {
+        // what was made before the failure is garbage and never runs: its code can go
+        munmap(base, size);
+        return NULL;
+    }
+    mapping->base = base;
+    mapping->size = size;
+    mapping->next = context->mappedCaches;
+    context->mappedCaches = mapping;
+    return entry;
+}
@@ -0,0 +1,32 @@
+#ifndef ZIA_IMAGE_H
+#define ZIA_IMAGE_H
+
+#include "common/common.h"
+#include "common/commonTypes.h"
+#include "object/object.h"
+#include "vm/vm.h"
+
+/*
+@Note: A heap image, "x.ziai", keeps what a script leaves behind once its
+       setup is done: the globals and everything they reach, interned
+       strings, functions, closures and their upvalues. Running the image
+       restores that heap and calls its entry function, a global taking
+       no arguments, instead of compiling and running the setup again:
+           zia --image=app.ziai [--entry=principal] app.zia
+           zia app.ziai
+       The global slots of the image must be the ones the loading VM hands
+       out for the same names, as with a .ziac: the natives have to be
+       defined in the same order on both sides.
+*/
+#define IMAGE_ENTRY "principal"  // entry function when --entry is not given
+
+// whether 'path' names an image rather than a script
+ZBool isImagePath(const ZChar* path);
+
+// 0, 70 when 'entry' is not a function without arguments, 74 when the file cannot be written
+ZInt32 writeImage(VM* context, const ZChar* path, const ZChar* entry);
+
+// the entry function, NULL when the file is not an image this VM can load
+ObjClosure* loadImage(VM* context, const ZChar* path);
+
+#endif
@@ -0,0 +1,188 @@
+#include "memory/allocator.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUND_UP(size, unit) (((size) + (unit) - 1) / (unit) * (unit))
+
+void initPool(Pool* pool, size_t cellSize, ZBool hasBitmaps)
+{
+    pool->cellSize = ROUND_UP(cellSize, POOL_WORD_SIZE);
+    pool->hasBitmaps = hasBitmaps;
+    pool->headerSize = sizeof(PoolPage);
+    if (hasBitmaps)
+    {
+        pool->headerSize += POOL_BITMAPS * POOL_BITMAP_WORDS * sizeof(ZUInt64);
+    }
+    // cells start after the page header, keeping POOL_GRANULE alignment
+    pool->headerSize = ROUND_UP(pool->headerSize, POOL_GRANULE);
+    pool->freeList = NULL;
+    pool->bump = NULL;
+    pool->limit = NULL;
+    pool->pages = NULL;
+    pool->pageCount = 0;
+    pool->sweepPage = NULL;
+}
+
+static ZBool addPage(Pool* pool)
+{
+    void* memory = NULL;
+    if (0 != posix_memalign(&memory, POOL_PAGE_SIZE, POOL_PAGE_SIZE))
+    {
+        return ZFALSE;
+    }
+
+    PoolPage* page = (PoolPage*)memory;
+    page->next = pool->pages;
+    page->pool = pool;
+    pool->pages = page;
+    pool->pageCount++;
+    if (pool->hasBitmaps)
+    {
+        memset(pageBitmap(page, POOL_LIVE_BITS), 0, POOL_BITMAPS * POOL_BITMAP_WORDS * sizeof(ZUInt64));
+    }
+
+    pool->bump = (ZUInt8*)page + pool->headerSize;
+    pool->limit = (ZUInt8*)page + POOL_PAGE_SIZE;
+    return ZTRUE;
+}
+
+void* poolAllocate(Pool* pool)
+{
+    void* result = pool->freeList;
+    if (NULL != result)
+    {
+        pool->freeList = pool->freeList->next;
+    }
+    else
+    {
+        // cells of a new page are only touched as they are handed out
+        if (NULL == pool->bump || pool->bump + pool->cellSize > pool->limit)
+        {
+            if (!addPage(pool))
+            {
+                return NULL;
+            }
+        }
+        result = pool->bump;
+        pool->bump += pool->cellSize;
+    }
+
+    if (pool->hasBitmaps)
+    {
+        // a reused cell still carries the collector bits of the one freed there
+        size_t bit = ((uintptr_t)result & (POOL_PAGE_SIZE - 1)) / POOL_WORD_SIZE;
+        ZUInt64 mask = (ZUInt64)1 << (bit % 64);
+        PoolPage* page = pageOf(result);
+        pageBitmap(page, POOL_LIVE_BITS)[bit / 64] |= mask;
+        for (PoolBitmap bitmap = POOL_LIVE_BITS + 1; bitmap < POOL_BITMAPS; bitmap++)
+        {
+            pageBitmap(page, bitmap)[bit / 64] &= ~mask;
+        }
+    }
+    return result;
+}
+
+void poolFree(Pool* pool, void* cell)
+{
+    if (pool->hasBitmaps)
+    {
+        clearCellBit(cell, POOL_LIVE_BITS);
+    }
+    PoolCell* freed = (PoolCell*)cell;
+    freed->next = pool->freeList;
+    pool->freeList = freed;
+}
+
+// one memset per page, whatever the number of cells
+void clearPoolBitmap(Pool* pool, PoolBitmap bitmap)
+{
+    for (PoolPage* page = pool->pages; NULL != page; page = page->next)
+    {
+        memset(pageBitmap(page, bitmap), 0, POOL_BITMAP_WORDS * sizeof(ZUInt64));
+    }
+}
+
+void freePool(Pool* pool)
+{
+    PoolPage* page = pool->pages;
+    while (NULL != page)
+    {
+        PoolPage* next = page->next;
+        free(page);
+        page = next;
+    }
+    initPool(pool, pool->cellSize, pool->hasBitmaps);
+}
+
+static void linkBlock(LargeBlock** blocks, LargeBlock* block)
+{
+    block->prev = NULL;
+    block->next = *blocks;
+    if (NULL != *blocks)
+    {
+        (*blocks)->prev = block;
+    }
+    *blocks = block;
+}
+
+static void unlinkBlock(LargeBlock** blocks, LargeBlock* block)
+{
+    if (NULL != block->prev)
+    {
+        block->prev->next = block->next;
+    }
+    else
+    {
+        *blocks = block->next;
+    }
+    if (NULL != block->next)
+    {
+        block->next->prev = block->prev;
+    }
+}
+
+// realloc() for large blocks: a NULL pointer allocates a new one
+void* largeReallocate(LargeBlock** blocks, void* pointer, size_t newSize)
+{
+    LargeBlock* block = (NULL != pointer) ? (LargeBlock*)pointer - 1 : NULL;
+    if (NULL != block)
+    {
+        unlinkBlock(blocks, block);
+    }
+
+    LargeBlock* result = (LargeBlock*)realloc(block, sizeof(LargeBlock) + newSize);
+    if (NULL == result)
+    {
+        // out of memory: the old block is left as it was
+        if (NULL != block)
+        {
+            linkBlock(blocks, block);
+        }
+        return NULL;
+    }
+    linkBlock(blocks, result);
+    return result + 1;
+}
+
+void largeFree(LargeBlock** blocks, void* pointer)
+{
+    if (NULL == pointer)
+    {
+        return;
+    }
+    LargeBlock* block = (LargeBlock*)pointer - 1;
+    unlinkBlock(blocks, block);
+    free(block);
+}
+
+void freeLargeBlocks(LargeBlock** blocks)
+{
+    LargeBlock* block = *blocks;
+    while (NULL != block)
+    {
+        LargeBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    *blocks = NULL;
+}
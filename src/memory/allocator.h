@@ -0,0 +1,129 @@
+#ifndef ZIA_ALLOCATOR_H
+#define ZIA_ALLOCATOR_H
+
+#include <stddef.h>
+#include "common/common.h"
+#include "common/commonTypes.h"
+
+/*
+@Note: Small blocks come from pools of fixed-size cells carved out of
+       POOL_PAGE_SIZE pages, instead of one malloc per block. A freed cell
+       goes on its pool's free list and is handed out again first.
+       Buffers up to POOL_MAX_CELL bytes use one pool per POOL_GRANULE size
+       class, heap objects use one pool per object type; anything larger
+       goes to malloc, as a LargeBlock.
+*/
+#define POOL_GRANULE      16
+#define POOL_MAX_CELL     256
+#define POOL_SIZE_CLASSES (POOL_MAX_CELL / POOL_GRANULE)
+#define POOL_PAGE_SIZE    (64 * 1024)
+
+/*
+@Note: Pages of object pools carry side bitmaps with one bit per
+       POOL_WORD_SIZE bytes of the page: a cell is described by the bit of
+       its first word. The allocator keeps POOL_LIVE_BITS, the collector
+       owns the others, so its state never lives in the object headers.
+       poolAllocate() hands out cells with only their live bit set.
+*/
+#define POOL_WORD_SIZE    8
+#define POOL_BITMAP_WORDS (POOL_PAGE_SIZE / POOL_WORD_SIZE / 64)
+
+typedef enum
+{
+    POOL_LIVE_BITS,         // cells handed out and not freed
+    POOL_MARK_BITS,         // reached by the collection in progress
+    POOL_OLD_BITS,          // survived a collection
+    POOL_REMEMBERED_BITS,   // old cells in the remembered set
+    POOL_BITMAPS,
+}PoolBitmap;
+
+typedef struct PoolCell
+{
+    struct PoolCell* next;
+}PoolCell;
+
+typedef struct PoolPage
+{
+    struct PoolPage* next;
+    struct Pool* pool;
+}PoolPage;
+
+typedef struct Pool
+{
+    size_t cellSize;
+    size_t headerSize;  // page header, with the bitmaps when the pool has them
+    ZBool hasBitmaps;
+    PoolCell* freeList;
+    ZUInt8* bump;       // never used cells at the end of the newest page
+    ZUInt8* limit;
+    PoolPage* pages;
+    size_t pageCount;
+    PoolPage* sweepPage;  // next page the last full collection left to sweep
+}Pool;
+
+/*
+@Note: Blocks too large for a pool are linked in a list through a header
+       in front of them, so they can all be released together.
+*/
+typedef struct LargeBlock
+{
+    struct LargeBlock* prev;
+    struct LargeBlock* next;
+}LargeBlock;
+
+void initPool(Pool* pool, size_t cellSize, ZBool hasBitmaps);
+void* poolAllocate(Pool* pool);
+void poolFree(Pool* pool, void* cell);
+void clearPoolBitmap(Pool* pool, PoolBitmap bitmap);
+void freePool(Pool* pool);
+
+void* largeReallocate(LargeBlock** blocks, void* pointer, size_t newSize);
+void largeFree(LargeBlock** blocks, void* pointer);
+void freeLargeBlocks(LargeBlock** blocks);
+
+// pages are aligned on their size, so a cell finds its page by masking its address
+static inline PoolPage* pageOf(const void* cell)
+{
+    return (PoolPage*)((uintptr_t)cell & ~(uintptr_t)(POOL_PAGE_SIZE - 1));
+}
+
+static inline ZUInt64* pageBitmap(PoolPage* page, PoolBitmap bitmap)
+{
+    return (ZUInt64*)(page + 1) + bitmap * POOL_BITMAP_WORDS;
+}
+
+// the cell at bit 'bit' of a page bitmap
+static inline void* pageCell(PoolPage* page, size_t bit)
+{
+    return (ZUInt8*)page + bit * POOL_WORD_SIZE;
+}
+
+static inline ZBool testCellBit(const void* cell, PoolBitmap bitmap)
+{
+    size_t bit = ((uintptr_t)cell & (POOL_PAGE_SIZE - 1)) / POOL_WORD_SIZE;
+    return (pageBitmap(pageOf(cell), bitmap)[bit / 64] >> (bit % 64)) & 1;
+}
+
+static inline void setCellBit(const void* cell, PoolBitmap bitmap)
+{
+    size_t bit = ((uintptr_t)cell & (POOL_PAGE_SIZE - 1)) / POOL_WORD_SIZE;
+    pageBitmap(pageOf(cell), bitmap)[bit / 64] |= (ZUInt64)1 << (bit % 64);
+}
+
+static inline void clearCellBit(const void* cell, PoolBitmap bitmap)
+{
+    size_t bit = ((uintptr_t)cell & (POOL_PAGE_SIZE - 1)) / POOL_WORD_SIZE;
+    pageBitmap(pageOf(cell), bitmap)[bit / 64] &= ~((ZUInt64)1 << (bit % 64));
+}
+
+#ifdef PARALLEL_MARK
+// sets the bit even while other threads set bits of the same word; returns whether it was set already
+static inline ZBool setCellBitAtomic(const void* cell, PoolBitmap bitmap)
+{
+    size_t bit = ((uintptr_t)cell & (POOL_PAGE_SIZE - 1)) / POOL_WORD_SIZE;
+    ZUInt64 mask = (ZUInt64)1 << (bit % 64);
+    return 0 != (__atomic_fetch_or(&pageBitmap(pageOf(cell), bitmap)[bit / 64], mask, __ATOMIC_RELAXED) & mask);
+}
+#endif
+
+#endif
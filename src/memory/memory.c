@@ -1,47 +1,302 @@
 #include "memory/memory.h"
 #include "vm/vm.h"
 #include "compiler/compiler.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef PARALLEL_MARK
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #ifdef DEBUG_LOG_GC
-#include <stdio.h>
 #include "debug.h"
 #endif
 
-#define GC_HEAP_GROW_FACTOR 2
+#define GC_NURSERY_SIZE     (256 * 1024)        // bytes allocated between two minor collections, at first
+#define GC_NURSERY_MAX      (16 * 1024 * 1024)  // the nursery grows up to this while most of it survives
+#ifdef DEBUG_STRESS_GC
+#define GC_STRESS_FULL_EVERY 64           // under stress, one collection in so many is a full one
+#endif
 
-void *reallocate(void *pointer, size_t oldSize, size_t newSize)
+static void collectYoung();
+static void startCycle();
+static void gcStep(ZInt32 budget);
+static void sweepPage(Pool *pool);
+
+#ifdef PARALLEL_MARK
+#define GC_MAX_THREADS       16
+#define GC_PARALLEL_MIN_GRAY 16   // smaller traces are not worth waking the other threads
+#define GC_STEAL_MAX         256  // gray objects taken from another thread at once
+
+// gray objects of one marking thread; the others steal from it when they run dry
+typedef struct
 {
-    vm.bytesAllocated += (newSize - oldSize);
+    pthread_mutex_t lock;
+    Obj **objects;
+    ZInt32 count;
+    ZInt32 capacity;
+}GrayQueue;
 
-    if (newSize > oldSize)
+static __thread GrayQueue *markQueue = NULL;  // queue of the current thread during a parallel trace
+static void pushGray(GrayQueue *queue, Obj *object);
+#endif
+
+// objects blackened per allocation while a full cycle is marking
+static ZInt32 stepBudget()
+{
+#ifdef DEBUG_STRESS_GC
+    // the smallest steps interleave the program and the collector the most
+    return 1;
+#else
+    return vm->gcStepBudget;
+#endif
+}
+
+static ZInt64 gcNanos()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ZInt64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void recordPause(ZInt64 start)
+{
+    ZInt64 nanos = gcNanos() - start;
+    GcStats *stats = &vm->gcStats;
+    stats->pauseCount++;
+    stats->pauseNanos += nanos;
+    if (nanos > stats->maxPauseNanos)
     {
+        stats->maxPauseNanos = nanos;
+    }
+
+    ZInt32 bucket = 0;
+    for (ZInt64 micros = nanos / 1000; micros > 0 && bucket < GC_PAUSE_BUCKETS - 1; micros >>= 1)
+    {
+        bucket++;
+    }
+    stats->pauses[bucket]++;
+}
+
+// cells of strings with inline characters, each class half or a third larger than the last
+static const size_t stringCellSizes[STRING_SIZE_CLASSES] = {
+    48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, STRING_MAX_CELL,
+};
+
+void initHeap()
+{
+    memset(&vm->gcStats, 0, sizeof(GcStats));
+    vm->gcStats.startNanos = gcNanos();
+    vm->nurserySize = GC_NURSERY_SIZE;
+
+    for (ZInt32 i = 0; i < POOL_SIZE_CLASSES; i++)
+    {
+        initPool(&vm->bufferPools[i], (i + 1) * POOL_GRANULE, ZFALSE);
+    }
+    initPool(&vm->objectPools[OBJ_CLOSURE], sizeof(ObjClosure), ZTRUE);
+    initPool(&vm->objectPools[OBJ_FUNCTION], sizeof(ObjFunction), ZTRUE);
+    initPool(&vm->objectPools[OBJ_NATIVE], sizeof(ObjNativeFn), ZTRUE);
+    initPool(&vm->objectPools[OBJ_STRING], sizeof(ObjString), ZTRUE);
+    initPool(&vm->objectPools[OBJ_UPVALUE], sizeof(ObjUpvalue), ZTRUE);
+    for (ZInt32 i = 0; i < STRING_SIZE_CLASSES; i++)
+    {
+        initPool(&vm->objectPools[OBJ_TYPE_COUNT + i], stringCellSizes[i], ZTRUE);
+    }
+}
+
+// whether the allocation just counted owes the collector some work
+static ZBool collectionDue()
+{
 #ifdef DEBUG_STRESS_GC
-        collectGarbage();
+    return ZTRUE;
+#else
+    return GC_MARK == vm->gcPhase || vm->bytesAllocated > vm->nextGC || vm->youngBytes > vm->nurserySize;
 #endif
+}
+
+static void collect()
+{
+    // a full cycle marking advances a little on every allocation
+    if (GC_MARK == vm->gcPhase)
+    {
+        gcStep(stepBudget());
+        return;
     }
 
-    if (vm.bytesAllocated > vm.nextGC)
+#ifdef DEBUG_STRESS_GC
+    if (++vm->stressCount % GC_STRESS_FULL_EVERY == 0)
     {
-       collectGarbage();
+        startCycle();
+        gcStep(stepBudget());
     }
-    
-    if (newSize == 0)
+    else
     {
-        free(pointer);
-        return NULL;
+        collectYoung();
     }
+    return;
+#endif
+    if (vm->bytesAllocated > vm->nextGC)
+    {
+        startCycle();
+        gcStep(stepBudget());
+    }
+    else
+    {
+        collectYoung();
+    }
+}
+
+/*
+@Note: Every allocation goes through here first. Only growth may start a
+       collection: a free can happen in the middle of a sweep, which must
+       not start another one. The clock is only read when there is work.
+*/
+static void countBytes(size_t oldSize, size_t newSize)
+{
+    vm->bytesAllocated += (newSize - oldSize);
 
-    void *result = realloc(pointer, newSize);
+    if (newSize > oldSize)
+    {
+        vm->youngBytes += newSize - oldSize;
+        vm->gcStats.bytesAllocated += newSize - oldSize;
+        if (vm->bytesAllocated > vm->gcStats.peakHeap)
+        {
+            vm->gcStats.peakHeap = vm->bytesAllocated;
+        }
+
+        if (ZTRUE == collectionDue())
+        {
+            ZInt64 start = gcNanos();
+            collect();
+            recordPause(start);
+        }
+    }
+}
+
+static void *checked(void *result)
+{
     if (NULL == result)
     {
         // TBD: handle case of out of memory before aborting the process
         exit(1);
     }
+    return result;
+}
+
+// the pool holding blocks of this size, NULL for blocks left to malloc
+static Pool *bufferPool(size_t size)
+{
+    return (size > 0 && size <= POOL_MAX_CELL) ? &vm->bufferPools[(size - 1) / POOL_GRANULE] : NULL;
+}
+
+void *reallocate(void *pointer, size_t oldSize, size_t newSize)
+{
+    countBytes(oldSize, newSize);
+
+    Pool *oldPool = (NULL != pointer) ? bufferPool(oldSize) : NULL;
+    Pool *newPool = bufferPool(newSize);
+
+    if (newSize == 0)
+    {
+        if (NULL != oldPool)
+        {
+            poolFree(oldPool, pointer);
+        }
+        else
+        {
+            largeFree(&vm->largeBlocks, pointer);
+        }
+        return NULL;
+    }
+
+    // a block keeps its cell while it stays in the same size class
+    if (NULL != oldPool && oldPool == newPool)
+    {
+        return pointer;
+    }
+
+    if (NULL == oldPool && NULL == newPool)
+    {
+        return checked(largeReallocate(&vm->largeBlocks, pointer, newSize));
+    }
 
+    void *result = checked((NULL != newPool) ? poolAllocate(newPool) : largeReallocate(&vm->largeBlocks, NULL, newSize));
+    if (NULL != pointer)
+    {
+        memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+        if (NULL != oldPool)
+        {
+            poolFree(oldPool, pointer);
+        }
+        else
+        {
+            largeFree(&vm->largeBlocks, pointer);
+        }
+    }
     return result;
 }
 
+// the pool an object of this type and size takes its cell from
+static Pool *objectPool(ObjType type, size_t size)
+{
+    if (OBJ_STRING != type || size <= sizeof(ObjString))
+    {
+        return &vm->objectPools[type];
+    }
+    ZInt32 i = 0;
+    while (stringCellSizes[i] < size)
+    {
+        i++;
+    }
+    return &vm->objectPools[OBJ_TYPE_COUNT + i];
+}
+
+void *allocateObjectCell(ObjType type, size_t size)
+{
+    countBytes(0, size);
+    Pool *pool = objectPool(type, size);
+    // the garbage of the last full collection is only swept when its pool runs out of cells
+    if (NULL == pool->freeList && NULL != pool->sweepPage)
+    {
+        ZInt64 start = gcNanos();
+        while (NULL == pool->freeList && NULL != pool->sweepPage)
+        {
+            sweepPage(pool);
+        }
+        recordPause(start);
+    }
+    return checked(poolAllocate(pool));
+}
+
+void addYoungObject(Obj *object)
+{
+    if (vm->youngCapacity < vm->youngCount + 1)
+    {
+        vm->youngCapacity = GROW_CAPACITY(vm->youngCapacity);
+        vm->young = (Obj **)realloc(vm->young, sizeof(Obj *) * vm->youngCapacity);
+
+        if (NULL == vm->young)
+        {
+            exit(1);
+        }
+    }
+    vm->young[vm->youngCount++] = object;
+}
+
+static void freeObjectCell(Obj *object, size_t size)
+{
+    countBytes(size, 0);
+    Pool *pool = pageOf(object)->pool;
+#ifdef DEBUG_STRESS_GC
+    // a dangling reference to a freed object then fails fast instead of reading stale fields
+    memset(object, 0xdd, size);
+#endif
+    poolFree(pool, object);
+}
+
 void markObject(Obj *object)
 {
     if (NULL == object)
@@ -49,11 +304,31 @@ void markObject(Obj *object)
         return;
     }
 
-    if (ZTRUE == object->isMarked)
+#ifdef PARALLEL_MARK
+    if (NULL != markQueue)
+    {
+        // another thread may be marking the same object: only the one setting the bit traces it
+        if ((ZTRUE == vm->minorGC && ZTRUE == testCellBit(object, POOL_OLD_BITS)) ||
+            ZTRUE == setCellBitAtomic(object, POOL_MARK_BITS))
+        {
+            return;
+        }
+        // natives and flat strings have no references, marking them is all there is to do
+        if (OBJ_NATIVE != object->type &&
+            !(OBJ_STRING == object->type && NULL != ((ObjString *)object)->chars))
+        {
+            pushGray(markQueue, object);
+        }
+        return;
+    }
+#endif
+
+    // a minor collection takes every old object as live without tracing it
+    if (ZTRUE == testCellBit(object, POOL_MARK_BITS) ||
+        (ZTRUE == vm->minorGC && ZTRUE == testCellBit(object, POOL_OLD_BITS)))
     {
         return;
     }
-    
 
 #ifdef DEBUG_LOG_GC
     if (ZTRUE == FLAG_LOG_GC)
@@ -64,20 +339,20 @@ void markObject(Obj *object)
     }
 #endif
 
-    object->isMarked = ZTRUE;
+    setCellBit(object, POOL_MARK_BITS);
 
-    if (vm.grayCapacity < vm.grayCount + 1)
+    if (vm->grayCapacity < vm->grayCount + 1)
     {
-        vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
-        vm.grayStack = (Obj **)realloc(vm.grayStack, sizeof(Obj *) * vm.grayCapacity);
+        vm->grayCapacity = GROW_CAPACITY(vm->grayCapacity);
+        vm->grayStack = (Obj **)realloc(vm->grayStack, sizeof(Obj *) * vm->grayCapacity);
 
-        if (NULL == vm.grayStack)
+        if (NULL == vm->grayStack)
         {
             exit(1);
         }
     }
 
-    vm.grayStack[vm.grayCount++] = object;
+    vm->grayStack[vm->grayCount++] = object;
 }
 
 /*
@@ -113,12 +388,19 @@ static void blackenObject(Obj *object)
     switch (object->type)
     {
         /*
-        @Note: strings and native function objects contain no outgoing
-            references so there is nothing to traverse.
+        @Note: native function objects contain no outgoing references
+            so there is nothing to traverse.
         */
         case OBJ_NATIVE:
+            break;
         case OBJ_STRING:
+        {
+            // only a rope has references: its operands, or the string it was flattened to
+            ObjString* string = (ObjString*)object;
+            markObject((Obj*)string->left);
+            markObject((Obj*)string->right);
             break;
+        }
         case OBJ_CLOSURE:
         {
             ObjClosure* closure = (ObjClosure*)object;
@@ -144,6 +426,8 @@ static void blackenObject(Obj *object)
     }
 }
 
+#define FREE_OBJ(type, object) freeObjectCell(object, sizeof(type))
+
 static void freeObject(Obj *object)
 {
 #ifdef DEBUG_LOG_GC
@@ -159,31 +443,35 @@ static void freeObject(Obj *object)
     {
         ObjClosure *closure = (ObjClosure *)object;
         FREE_ARRAY(ObjUpvalue *, closure->upvalues, closure->upvalueCount);
-        FREE(ObjClosure, object);
+        FREE_OBJ(ObjClosure, object);
         break;
     }
     case OBJ_FUNCTION:
     {
         ObjFunction *function = (ObjFunction *)object;
         freeChunk(&function->chunk);
-        FREE(ObjFunction, object);
+        FREE_OBJ(ObjFunction, object);
         break;
     }
     case OBJ_NATIVE:
     {
-        FREE(ObjNativeFn, object);
+        FREE_OBJ(ObjNativeFn, object);
         break;
     }
     case OBJ_STRING:
     {
         ObjString *string = (ObjString *)object;
-        FREE_ARRAY(char, string->chars, string->length + 1);
-        FREE(ObjString, object);
+        if (NULL != string->chars && string->chars != string->inlineChars)
+        {
+            FREE_ARRAY(char, string->chars, string->length + 1);
+        }
+        freeObjectCell(object, stringObjectSize(string));
         break;
     }
     case OBJ_UPVALUE:
     {
-        FREE(ObjUpvalue, object);
+        FREE_OBJ(ObjUpvalue, object);
+        break;
     }
     default:
         break;
@@ -192,107 +480,767 @@ static void freeObject(Obj *object)
 
 static void markRoots()
 {
-    for (Value *slot = vm.stack; slot < vm.stackTop; slot++)
+    for (Value *slot = vm->stack; slot < vm->stackTop; slot++)
     {
         markValue(*slot);
     }
 
-    for (ZInt32 i = 0; i < vm.frameCount; i++)
+    for (ZInt32 i = 0; i < vm->frameCount; i++)
     {
-        markObject((Obj *)vm.frames[i].closure);
+        markObject((Obj *)vm->frames[i].closure);
     }
 
-    for (ObjUpvalue *upvalue = vm.openUpvalues; NULL != upvalue; upvalue = upvalue->next)
+    for (ObjUpvalue *upvalue = vm->openUpvalues; NULL != upvalue; upvalue = upvalue->next)
     {
         markObject((Obj *)upvalue);
     }
 
-    markTable(&vm.globals);
+    // a program, a native or an image being loaded may still be young: these are marked by minor collections too
+    for (Program *program = vm->programs; NULL != program; program = program->next)
+    {
+        markObject((Obj *)program->function);
+    }
+    markArray(&vm->nativeGlobals);
+    markArray(&vm->imageObjects);
+
+    // a minor collection only looks at the global slots remembered since the last one
+    if (ZFALSE == vm->minorGC)
+    {
+        markTable(&vm->globalSlots);
+        markArray(&vm->globalValues);
+        markArray(&vm->globalNames);
+    }
     markCompilerRoots();
 }
 
-static void traceReferences()
+#ifdef PARALLEL_MARK
+/*
+@Note: Parallel marking. With vm->gcThreads above 1, a trace that starts
+       with enough gray objects deals them out to one GrayQueue per
+       thread, and the program's thread and vm->gcThreads - 1 helper
+       threads drain them together. Mark bits are set atomically, so each
+       object is traced once. A thread whose queue is empty steals half of
+       another one; the trace is over when every thread is idle. Helpers
+       are started on the first parallel trace and sleep between traces.
+       Each VM has its own helpers, in its MarkWorkers.
+*/
+typedef struct MarkWorkers MarkWorkers;
+
+// what a helper thread is started with
+typedef struct
+{
+    MarkWorkers *workers;
+    ZInt32 self;
+}MarkHelper;
+
+struct MarkWorkers
 {
-    while (vm.grayCount > 0)
+    VM *vm;                              // the VM whose heap the helpers trace
+    GrayQueue queues[GC_MAX_THREADS];
+    pthread_t threads[GC_MAX_THREADS];
+    MarkHelper helpers[GC_MAX_THREADS];
+    ZInt32 count;                        // helper threads started
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    ZInt32 generation;                   // parallel traces started, under lock
+    ZInt32 running;                      // helpers still in the current trace, under lock
+    ZBool shutdown;
+    ZInt32 idle;                         // threads that found no gray object left, atomic
+};
+
+static void pushGray(GrayQueue *queue, Obj *object)
+{
+    pthread_mutex_lock(&queue->lock);
+    if (queue->capacity < queue->count + 1)
     {
-        Obj *object = vm.grayStack[--vm.grayCount];
-        blackenObject(object);
+        queue->capacity = GROW_CAPACITY(queue->capacity);
+        queue->objects = (Obj **)realloc(queue->objects, sizeof(Obj *) * queue->capacity);
+
+        if (NULL == queue->objects)
+        {
+            exit(1);
+        }
+    }
+    queue->objects[queue->count] = object;
+    __atomic_store_n(&queue->count, queue->count + 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static Obj *popGray(GrayQueue *queue)
+{
+    Obj *object = NULL;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count > 0)
+    {
+        object = queue->objects[queue->count - 1];
+        __atomic_store_n(&queue->count, queue->count - 1, __ATOMIC_SEQ_CST);
     }
+    pthread_mutex_unlock(&queue->lock);
+    return object;
 }
 
-void static sweep()
+// moves half of the first non-empty queue of another thread into ours
+static ZBool stealGray(MarkWorkers *workers, ZInt32 self, ZInt32 markers)
 {
-    Obj* previous = NULL;
-    Obj* object = vm.objects;
-    while (NULL != object)
+    for (ZInt32 i = 1; i < markers; i++)
     {
-        if (ZTRUE == object->isMarked)
+        GrayQueue *victim = &workers->queues[(self + i) % markers];
+        if (0 == __atomic_load_n(&victim->count, __ATOMIC_SEQ_CST))
         {
-            /*
-            @Note: That’s correct, but when the next collection cycle starts, 
-                   we need every object to be white
-            */
-            object->isMarked = ZFALSE;
-            previous = object;
-            object = object->next;
+            continue;
         }
-        else
+
+        Obj *stolen[GC_STEAL_MAX];
+        ZInt32 count = 0;
+        pthread_mutex_lock(&victim->lock);
+        count = (victim->count + 1) / 2;
+        if (count > GC_STEAL_MAX)
+        {
+            count = GC_STEAL_MAX;
+        }
+        memcpy(stolen, victim->objects + victim->count - count, sizeof(Obj *) * count);
+        __atomic_store_n(&victim->count, victim->count - count, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&victim->lock);
+
+        for (ZInt32 j = 0; j < count; j++)
+        {
+            pushGray(&workers->queues[self], stolen[j]);
+        }
+        if (count > 0)
+        {
+            return ZTRUE;
+        }
+    }
+    return ZFALSE;
+}
+
+static ZBool anyGray(MarkWorkers *workers, ZInt32 markers)
+{
+    for (ZInt32 i = 0; i < markers; i++)
+    {
+        if (0 != __atomic_load_n(&workers->queues[i].count, __ATOMIC_SEQ_CST))
+        {
+            return ZTRUE;
+        }
+    }
+    return ZFALSE;
+}
+
+static void drainGray(MarkWorkers *workers, ZInt32 self, ZInt32 markers)
+{
+    GrayQueue *queue = &workers->queues[self];
+    for (;;)
+    {
+        Obj *object;
+        while (NULL != (object = popGray(queue)))
+        {
+            blackenObject(object);
+        }
+        if (ZTRUE == stealGray(workers, self, markers))
+        {
+            continue;
+        }
+
+        // only busy threads push gray objects: once all are idle, none is left
+        __atomic_add_fetch(&workers->idle, 1, __ATOMIC_SEQ_CST);
+        for (;;)
         {
-            Obj* unreached = object;
-            object = object->next;
-            if (NULL != previous)
+            if (markers == __atomic_load_n(&workers->idle, __ATOMIC_SEQ_CST))
             {
-                previous->next = object;
+                return;
             }
-            else
+            if (ZTRUE == anyGray(workers, markers))
             {
-                vm.objects = object;
+                __atomic_sub_fetch(&workers->idle, 1, __ATOMIC_SEQ_CST);
+                break;
             }
-            freeObject(unreached);
+            sched_yield();
         }
-    }  
+    }
 }
 
-void collectGarbage()
+static void *markThread(void *argument)
+{
+    MarkHelper *helper = (MarkHelper *)argument;
+    MarkWorkers *workers = helper->workers;
+    ZInt32 seen = 0;
+    vm = workers->vm;
+    markQueue = &workers->queues[helper->self];
+
+    pthread_mutex_lock(&workers->lock);
+    for (;;)
+    {
+        while (seen == workers->generation && ZFALSE == workers->shutdown)
+        {
+            pthread_cond_wait(&workers->start, &workers->lock);
+        }
+        if (ZTRUE == workers->shutdown)
+        {
+            break;
+        }
+        seen = workers->generation;
+        pthread_mutex_unlock(&workers->lock);
+
+        drainGray(workers, helper->self, workers->count + 1);
+
+        pthread_mutex_lock(&workers->lock);
+        if (0 == --workers->running)
+        {
+            pthread_cond_signal(&workers->done);
+        }
+    }
+    pthread_mutex_unlock(&workers->lock);
+    return NULL;
+}
+
+static void startMarkThreads()
+{
+    MarkWorkers *workers = (MarkWorkers *)calloc(1, sizeof(MarkWorkers));
+    if (NULL == workers)
+    {
+        exit(1);
+    }
+    workers->vm = vm;
+    pthread_mutex_init(&workers->lock, NULL);
+    pthread_cond_init(&workers->start, NULL);
+    pthread_cond_init(&workers->done, NULL);
+
+    ZInt32 helpers = (vm->gcThreads > GC_MAX_THREADS ? GC_MAX_THREADS : vm->gcThreads) - 1;
+    for (ZInt32 i = 0; i <= helpers; i++)
+    {
+        pthread_mutex_init(&workers->queues[i].lock, NULL);
+    }
+    for (ZInt32 i = 1; i <= helpers; i++)
+    {
+        workers->helpers[i].workers = workers;
+        workers->helpers[i].self = i;
+        if (0 != pthread_create(&workers->threads[i], NULL, markThread, &workers->helpers[i]))
+        {
+            // the trace goes on with the threads there are
+            break;
+        }
+        workers->count = i;
+    }
+    for (ZInt32 i = workers->count + 1; i <= helpers; i++)
+    {
+        pthread_mutex_destroy(&workers->queues[i].lock);
+    }
+    vm->markWorkers = workers;
+    vm->gcThreads = workers->count + 1;
+}
+
+static void stopMarkThreads()
+{
+    MarkWorkers *workers = vm->markWorkers;
+    pthread_mutex_lock(&workers->lock);
+    workers->shutdown = ZTRUE;
+    pthread_cond_broadcast(&workers->start);
+    pthread_mutex_unlock(&workers->lock);
+
+    for (ZInt32 i = 1; i <= workers->count; i++)
+    {
+        pthread_join(workers->threads[i], NULL);
+    }
+    for (ZInt32 i = 0; i <= workers->count; i++)
+    {
+        free(workers->queues[i].objects);
+        pthread_mutex_destroy(&workers->queues[i].lock);
+    }
+    pthread_mutex_destroy(&workers->lock);
+    pthread_cond_destroy(&workers->start);
+    pthread_cond_destroy(&workers->done);
+    free(workers);
+    vm->markWorkers = NULL;
+}
+
+static void traceParallel()
+{
+    if (NULL == vm->markWorkers)
+    {
+        startMarkThreads();
+    }
+    MarkWorkers *workers = vm->markWorkers;
+    ZInt32 markers = workers->count + 1;
+
+    for (ZInt32 i = 0; i < vm->grayCount; i++)
+    {
+        pushGray(&workers->queues[i % markers], vm->grayStack[i]);
+    }
+    vm->grayCount = 0;
+    workers->idle = 0;
+
+    pthread_mutex_lock(&workers->lock);
+    workers->running = workers->count;
+    workers->generation++;
+    pthread_cond_broadcast(&workers->start);
+    pthread_mutex_unlock(&workers->lock);
+
+    markQueue = &workers->queues[0];
+    drainGray(workers, 0, markers);
+    markQueue = NULL;
+
+    pthread_mutex_lock(&workers->lock);
+    while (workers->running > 0)
+    {
+        pthread_cond_wait(&workers->done, &workers->lock);
+    }
+    pthread_mutex_unlock(&workers->lock);
+}
+#endif
+
+static void traceReferences()
+{
+    while (vm->grayCount > 0)
+    {
+#ifdef PARALLEL_MARK
+        // the other threads join in once there is enough to share
+        if (vm->gcThreads > 1 && vm->grayCount >= GC_PARALLEL_MIN_GRAY)
+        {
+            traceParallel();
+            return;
+        }
+#endif
+        Obj *object = vm->grayStack[--vm->grayCount];
+        blackenObject(object);
+    }
+}
+
+/*
+@Note: Generational collection. New objects go on vm->young, the nursery.
+       A minor collection marks from the roots but stops at old objects,
+       frees the unreached young ones and sets the old bit of the survivors.
+       Old objects are only traced by a full collection.
+       An old object that is given a reference to a young one must be
+       traced by the next minor collection as well: the write barrier
+       (writeBarrier, globalWriteBarrier) puts it in the remembered set.
+*/
+void rememberObject(Obj *object)
+{
+    if (ZTRUE == testCellBit(object, POOL_REMEMBERED_BITS))
+    {
+        return;
+    }
+    setCellBit(object, POOL_REMEMBERED_BITS);
+
+    if (vm->rememberedCapacity < vm->rememberedCount + 1)
+    {
+        vm->rememberedCapacity = GROW_CAPACITY(vm->rememberedCapacity);
+        vm->remembered = (Obj **)realloc(vm->remembered, sizeof(Obj *) * vm->rememberedCapacity);
+
+        if (NULL == vm->remembered)
+        {
+            exit(1);
+        }
+    }
+    vm->remembered[vm->rememberedCount++] = object;
+}
+
+void rememberGlobal(ZInt32 slot)
+{
+    ZUInt64 bit = (ZUInt64)1 << (slot % 64);
+    if (0 != (vm->rememberedGlobalBits[slot / 64] & bit))
+    {
+        return;
+    }
+    vm->rememberedGlobalBits[slot / 64] |= bit;
+
+    if (vm->rememberedGlobalCapacity < vm->rememberedGlobalCount + 1)
+    {
+        vm->rememberedGlobalCapacity = GROW_CAPACITY(vm->rememberedGlobalCapacity);
+        vm->rememberedGlobals = (ZInt32 *)realloc(vm->rememberedGlobals, sizeof(ZInt32) * vm->rememberedGlobalCapacity);
+
+        if (NULL == vm->rememberedGlobals)
+        {
+            exit(1);
+        }
+    }
+    vm->rememberedGlobals[vm->rememberedGlobalCount++] = slot;
+}
+
+static void markRemembered()
+{
+    for (ZInt32 i = 0; i < vm->rememberedCount; i++)
+    {
+        blackenObject(vm->remembered[i]);
+    }
+    for (ZInt32 i = 0; i < vm->rememberedGlobalCount; i++)
+    {
+        ZInt32 slot = vm->rememberedGlobals[i];
+        markValue(vm->globalValues.values[slot]);
+        markValue(vm->globalNames.values[slot]);
+    }
+}
+
+static void forgetRemembered()
+{
+    for (ZInt32 i = 0; i < vm->rememberedCount; i++)
+    {
+        clearCellBit(vm->remembered[i], POOL_REMEMBERED_BITS);
+    }
+    vm->rememberedCount = 0;
+
+    for (ZInt32 i = 0; i < vm->rememberedGlobalCount; i++)
+    {
+        ZInt32 slot = vm->rememberedGlobals[i];
+        vm->rememberedGlobalBits[slot / 64] &= ~((ZUInt64)1 << (slot % 64));
+    }
+    vm->rememberedGlobalCount = 0;
+}
+
+// an object the current collection has not reached, and will free
+ZBool isUnreached(Obj *object)
+{
+    return ZFALSE == testCellBit(object, POOL_MARK_BITS) &&
+           !(ZTRUE == vm->minorGC && ZTRUE == testCellBit(object, POOL_OLD_BITS));
+}
+
+/*
+@Note: Frees the unmarked young objects and makes the marked ones old.
+       Survivors keep their mark: a minor collection never looks at the
+       mark of an old object, and a full cycle clears every mark before
+       it starts, while the sweep that follows it must skip them.
+       Returns the bytes freed.
+*/
+static size_t sweepYoung()
+{
+    size_t before = vm->bytesAllocated;
+    for (ZInt32 i = 0; i < vm->youngCount; i++)
+    {
+        Obj *object = vm->young[i];
+        if (ZTRUE == testCellBit(object, POOL_MARK_BITS))
+        {
+            setCellBit(object, POOL_OLD_BITS);
+        }
+        else
+        {
+            freeObject(object);
+        }
+    }
+    vm->youngCount = 0;
+    vm->gcStats.bytesFreed += before - vm->bytesAllocated;
+    return before - vm->bytesAllocated;
+}
+
+/*
+@Note: A nursery whose objects mostly survive is collected for little:
+       it grows so they have longer to die, and shrinks back once most of
+       it is garbage again. It stays under a quarter of the full collection
+       threshold, or full collections would do all the work.
+*/
+static void paceNursery(size_t freed)
+{
+    size_t survived = vm->youngBytes > freed ? vm->youngBytes - freed : 0;
+    if (survived * 2 > vm->youngBytes && vm->nurserySize < GC_NURSERY_MAX && vm->nurserySize * 8 <= vm->nextGC)
+    {
+        vm->nurserySize *= 2;
+    }
+    else if (survived * 8 < vm->youngBytes && vm->nurserySize > GC_NURSERY_SIZE)
+    {
+        vm->nurserySize /= 2;
+    }
+}
+
+static void collectYoung()
 {
 #ifdef DEBUG_LOG_GC
     if(ZTRUE == FLAG_LOG_GC)
     {
-        printf("-- gc begin\n");
+        printf("-- minor gc begin\n");
     }
-    size_t before = vm.bytesAllocated;
+    size_t before = vm->bytesAllocated;
 #endif
 
+    vm->minorGC = ZTRUE;
     markRoots();
+    markRemembered();
     traceReferences();
-    tableRemoveWhite(&vm.strings);
+    tableRemoveWhite(&vm->strings);
+    forgetRemembered();
+    paceNursery(sweepYoung());
+    vm->minorGC = ZFALSE;
+    vm->youngBytes = 0;
+    vm->gcStats.minorCollections++;
+
+#ifdef DEBUG_LOG_GC
+    if(ZTRUE == FLAG_LOG_GC)
+    {
+        printf("-- minor gc end\n");
+        printf("  collected %zu bytes (from %zu to %zu) next at %zu\n",
+                (before - vm->bytesAllocated), before, vm->bytesAllocated, vm->nextGC);
+    }
+#endif
+}
+
+/*
+@Note: Full collections are incremental. startCycle() grays the roots, then
+       each allocation blackens up to vm->gcStepBudget gray objects. While
+       marking, the program may store a white object into a black one, so
+       writeBarrier() grays it, and objects allocated then are born black.
+       Roots get no barrier: finishMarking() marks them again before the
+       weak strings are dropped. Minor collections wait for the marking to end.
+
+       Sweeping is lazy: once marked, the pages of each object pool are only
+       swept when that pool has no free cell left for an allocation, see
+       allocateObjectCell(). The next cycle sweeps whatever is left first,
+       since it clears the marks the sweep relies on.
+*/
+// sweeps what the last cycle left, which tells the share of the heap it kept
+static void finishSweep()
+{
+    for (ZInt32 i = 0; i < OBJECT_POOLS; i++)
+    {
+        while (NULL != vm->objectPools[i].sweepPage)
+        {
+            sweepPage(&vm->objectPools[i]);
+        }
+    }
+    if (vm->cycleStartBytes > 0)
+    {
+        // averaged with the previous cycles, so one odd cycle does not swing the pacing
+        size_t freed = vm->cycleFreedBytes < vm->cycleStartBytes ? vm->cycleFreedBytes : vm->cycleStartBytes;
+        vm->gcSurvival = (vm->gcSurvival + (1.0 - (ZReal64)freed / vm->cycleStartBytes)) / 2;
+    }
+}
+
+static void startCycle()
+{
+#ifdef DEBUG_LOG_GC
+    if(ZTRUE == FLAG_LOG_GC)
+    {
+        printf("-- gc begin\n");
+    }
+#endif
+
+    finishSweep();
+    vm->cycleStartBytes = vm->bytesAllocated;
+    vm->cycleFreedBytes = 0;
+
+    // every mark is dropped at once, a memset per page
+    for (ZInt32 i = 0; i < OBJECT_POOLS; i++)
+    {
+        clearPoolBitmap(&vm->objectPools[i], POOL_MARK_BITS);
+    }
+    vm->gcPhase = GC_MARK;
+    markRoots();
+}
+
+static void finishCycle()
+{
+    vm->gcPhase = GC_IDLE;
+    vm->gcStats.fullCollections++;
+
     /*
-    @Note: The gray stack is empty, and every object in the heap is either black or white. 
-           The black objects are reachable, and we want to hang on to them. Anything still white 
-           never got touched by the trace and is thus garbage. All that’s left is to reclaim them.
+    @Note: bytesAllocated still counts the garbage left to sweep, so the live
+           heap is estimated with the share the last cycles kept. The program
+           may then allocate that much again, times the growth factor, before
+           the next cycle: a heap that mostly survives is collected less often.
     */
-    sweep();
-
-    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    size_t live = (size_t)(vm->bytesAllocated * vm->gcSurvival);
+    size_t next = vm->bytesAllocated + (size_t)(live * (vm->gcGrowthFactor - 1.0));
+    vm->nextGC = next > vm->gcInitialHeap ? next : vm->gcInitialHeap;
+    while (vm->nurserySize > GC_NURSERY_SIZE && vm->nurserySize * 4 > vm->nextGC)
+    {
+        vm->nurserySize /= 2;
+    }
 
 #ifdef DEBUG_LOG_GC
     if(ZTRUE == FLAG_LOG_GC)
     {
         printf("-- gc end\n");
         printf("  collected %zu bytes (from %zu to %zu) next at %zu\n", 
-                (before - vm.bytesAllocated), before, vm.bytesAllocated, vm.nextGC);
+                (vm->cycleStartBytes - vm->bytesAllocated), vm->cycleStartBytes, vm->bytesAllocated, vm->nextGC);
     }
 #endif
 }
 
+static void finishMarking()
+{
+    markRoots();
+    traceReferences();
+    tableRemoveWhite(&vm->strings);
+    forgetRemembered();
+    /*
+    @Note: The gray stack is empty, and every object in the heap is either black or white. 
+           The black objects are reachable, and we want to hang on to them. Anything still white 
+           never got touched by the trace and is thus garbage. All that’s left is to reclaim them.
+           The nursery is swept at once so the survivors are old before the program runs again;
+           the old pages are swept later, as their pools need cells. Objects allocated from
+           now on are young and stay out of that sweep.
+    */
+    vm->cycleFreedBytes += sweepYoung();
+    vm->youngBytes = 0;
+    for (ZInt32 i = 0; i < OBJECT_POOLS; i++)
+    {
+        vm->objectPools[i].sweepPage = vm->objectPools[i].pages;
+    }
+    finishCycle();
+}
+
+// frees the unmarked old objects of the next page the last full collection left to sweep
+static void sweepPage(Pool *pool)
+{
+    PoolPage *page = pool->sweepPage;
+    pool->sweepPage = page->next;
+    size_t before = vm->bytesAllocated;
+
+    ZUInt64 *live = pageBitmap(page, POOL_LIVE_BITS);
+    ZUInt64 *old = pageBitmap(page, POOL_OLD_BITS);
+    ZUInt64 *mark = pageBitmap(page, POOL_MARK_BITS);
+    for (ZInt32 word = 0; word < POOL_BITMAP_WORDS; word++)
+    {
+        ZUInt64 dead = live[word] & old[word] & ~mark[word];
+        while (0 != dead)
+        {
+            ZInt32 bit = __builtin_ctzll(dead);
+            dead &= dead - 1;
+            freeObject((Obj *)pageCell(page, word * 64 + bit));
+        }
+    }
+    vm->cycleFreedBytes += before - vm->bytesAllocated;
+    vm->gcStats.bytesFreed += before - vm->bytesAllocated;
+}
+
+// one bounded slice of the marking in progress; a budget of 0 runs it to the end
+static void gcStep(ZInt32 budget)
+{
+    ZBool unbounded = (budget <= 0);
+
+    if (GC_MARK == vm->gcPhase)
+    {
+        if (unbounded)
+        {
+            traceReferences();
+        }
+        while (vm->grayCount > 0 && (unbounded || budget-- > 0))
+        {
+            Obj *object = vm->grayStack[--vm->grayCount];
+            blackenObject(object);
+        }
+        if (vm->grayCount > 0)
+        {
+            return;
+        }
+        finishMarking();
+    }
+}
+
+// a whole collection at once, sweep included
+void collectGarbage()
+{
+    ZInt64 start = gcNanos();
+    if (GC_IDLE == vm->gcPhase)
+    {
+        startCycle();
+    }
+    gcStep(0);
+    finishSweep();
+    recordPause(start);
+}
+
+// one figure of the telemetry by its script name, nul for an unknown one
+Value gcStat(const ZChar *name)
+{
+    GcStats *stats = &vm->gcStats;
+    ZReal64 seconds = (gcNanos() - stats->startNanos) / 1e9;
+    const struct
+    {
+        const ZChar *name;
+        ZReal64 value;
+    } figures[] = {
+        {"collections_mineures", (ZReal64)stats->minorCollections},
+        {"collections_completes", (ZReal64)stats->fullCollections},
+        {"octets_alloues", (ZReal64)stats->bytesAllocated},
+        {"octets_liberes", (ZReal64)stats->bytesFreed},
+        {"tas", (ZReal64)vm->bytesAllocated},
+        {"pic_tas", (ZReal64)stats->peakHeap},
+        {"pauses", (ZReal64)stats->pauseCount},
+        {"pause_totale_ms", stats->pauseNanos / 1e6},
+        {"pause_max_ms", stats->maxPauseNanos / 1e6},
+        {"debit_allocation", seconds > 0 ? stats->bytesAllocated / seconds : 0.0},
+    };
+
+    for (size_t i = 0; i < sizeof(figures) / sizeof(figures[0]); i++)
+    {
+        if (0 == strcmp(name, figures[i].name))
+        {
+            // counts come back as integers, durations and rates as reals
+            ZReal64 value = figures[i].value;
+            return (value == (ZInt64)value) ? INT_VAL((ZInt64)value) : NUMBER_VAL(value);
+        }
+    }
+    return NUL_VAL;
+}
+
+void printGcStats(VM *context)
+{
+    GcStats *stats = &context->gcStats;
+    ZReal64 seconds = (gcNanos() - stats->startNanos) / 1e9;
+
+    fprintf(stderr, "-- ramasse-miettes --\n");
+    fprintf(stderr, "collections: %lld mineures, %lld complètes\n",
+            (long long)stats->minorCollections, (long long)stats->fullCollections);
+    fprintf(stderr, "octets alloués: %zu (%.1f Mo/s)\n", stats->bytesAllocated,
+            seconds > 0 ? stats->bytesAllocated / seconds / (1024 * 1024) : 0.0);
+    fprintf(stderr, "octets libérés: %zu\n", stats->bytesFreed);
+    fprintf(stderr, "pic du tas: %zu octets\n", stats->peakHeap);
+    fprintf(stderr, "pauses: %lld, totale %.3f ms, max %.3f ms\n", (long long)stats->pauseCount,
+            stats->pauseNanos / 1e6, stats->maxPauseNanos / 1e6);
+    for (ZInt32 i = 0; i < GC_PAUSE_BUCKETS; i++)
+    {
+        if (0 == stats->pauses[i])
+        {
+            continue;
+        }
+        if (GC_PAUSE_BUCKETS - 1 == i)
+        {
+            fprintf(stderr, "  >= %lld µs: %lld\n", 1LL << (i - 1), (long long)stats->pauses[i]);
+        }
+        else
+        {
+            fprintf(stderr, "  < %lld µs: %lld\n", 1LL << i, (long long)stats->pauses[i]);
+        }
+    }
+}
+
 void freeObjects()
 {
-    Obj *object = vm.objects;
-    while (NULL != object)
+    vm->gcPhase = GC_IDLE;
+#ifdef PARALLEL_MARK
+    if (NULL != vm->markWorkers)
+    {
+        stopMarkThreads();
+    }
+#endif
+    free(vm->young);
+    vm->young = NULL;
+    vm->youngCount = 0;
+    vm->youngCapacity = 0;
+    free(vm->grayStack);
+    vm->grayStack = NULL;
+    vm->grayCapacity = 0;
+    free(vm->remembered);
+    vm->remembered = NULL;
+    vm->rememberedCount = 0;
+    vm->rememberedCapacity = 0;
+    free(vm->rememberedGlobals);
+    vm->rememberedGlobals = NULL;
+    vm->rememberedGlobalCount = 0;
+    vm->rememberedGlobalCapacity = 0;
+
+    /*
+    @Note: Objects are not freed one by one: every block they own is either
+           a pool cell or a large block, and all of them go at once.
+    */
+    freeLargeBlocks(&vm->largeBlocks);
+    for (ZInt32 i = 0; i < POOL_SIZE_CLASSES; i++)
+    {
+        freePool(&vm->bufferPools[i]);
+    }
+    for (ZInt32 i = 0; i < OBJECT_POOLS; i++)
     {
-        Obj *next = object->next;
-        freeObject(object);
-        object = next;
+        freePool(&vm->objectPools[i]);
     }
-    free(vm.grayStack);
+    vm->bytesAllocated = 0;
+    vm->youngBytes = 0;
 }
@@ -4,6 +4,8 @@
 #include "common/common.h"
 #include "common/commonTypes.h"
 #include "object/object.h"
+#include "memory/allocator.h"
+#include "vm/vm.h"
 
 
 #define INIT_CAPACITY   0x0100
@@ -23,10 +25,51 @@
 #define FREE_ARRAY(type, pointer, oldCount) \
         reallocate(pointer, sizeof(type) * (oldCount), 0)
 
+void initHeap();
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+void* allocateObjectCell(ObjType type, size_t size);
+void addYoungObject(Obj* object);
 void markObject(Obj* object);
 void markValue(Value value);
+ZBool isUnreached(Obj* object);
+void rememberObject(Obj* object);
+void rememberGlobal(ZInt32 slot);
 void collectGarbage();
+void printGcStats(VM* context);
+Value gcStat(const ZChar* name);
 void freeObjects();
 
+/*
+@Note: Storing 'value' into 'container'. While a full collection is marking,
+       a black object must not point to a white one, so the white one is
+       grayed. An old object pointing to a young one is remembered.
+*/
+static inline void writeBarrier(Obj* container, Value value)
+{
+    if (!IS_OBJ(value))
+    {
+        return;
+    }
+
+    Obj* target = AS_OBJ(value);
+    if (GC_MARK == vm->gcPhase && ZTRUE == testCellBit(container, POOL_MARK_BITS) &&
+        ZFALSE == testCellBit(target, POOL_MARK_BITS))
+    {
+        markObject(target);
+    }
+    if (ZTRUE == testCellBit(container, POOL_OLD_BITS) && ZFALSE == testCellBit(target, POOL_OLD_BITS))
+    {
+        rememberObject(container);
+    }
+}
+
+// globals are never collected: a slot holding a young object is remembered
+static inline void globalWriteBarrier(ZInt32 slot, Value value)
+{
+    if (IS_OBJ(value) && ZFALSE == testCellBit(AS_OBJ(value), POOL_OLD_BITS))
+    {
+        rememberGlobal(slot);
+    }
+}
+
 #endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "memory/memory.h"
@@ -7,17 +8,22 @@
 #include "vm/vm.h"
 #include "table/table.h"
 
+#define ROPE_MIN_LENGTH 32  // shorter concatenations are copied at once
+
 #define ALLOCATE_OBJ(type, objectType) \
     (type *)allocateObject(sizeof(type), objectType)
 
 static Obj *allocateObject(size_t size, ObjType type)
 {
-    Obj *object = (Obj *)reallocate(NULL, 0, size);
+    Obj *object = (Obj *)allocateObjectCell(type, size);
     object->type = type;
-    object->isMarked = ZFALSE;
-
-    object->next = vm.objects;
-    vm.objects = object;
+    // the pool hands out cells young and unmarked; born black while a full
+    // collection is marking, so that cycle keeps it
+    if (GC_MARK == vm->gcPhase)
+    {
+        setCellBit(object, POOL_MARK_BITS);
+    }
+    addYoungObject(object);
 
 #ifdef DEBUG_LOG_GC
     if(ZTRUE == FLAG_LOG_GC)
@@ -39,6 +45,7 @@ ObjClosure *newClosure(ObjFunction *function)
 
     ObjClosure *closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
     closure->function = function;
+    writeBarrier((Obj *)closure, OBJ_VAL(function));
     closure->upvalues = upvalues;
     closure->upvalueCount = function->upvalueCount;
     return closure;
@@ -49,6 +56,7 @@ ObjFunction *newFunction()
     ObjFunction *function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
     function->upvalueCount = 0;
+    function->maxStack = 0;
     function->name = NULL;
     initChunk(&function->chunk);
     return function;
@@ -61,26 +69,111 @@ ObjNativeFn *newNative(NativeFn function)
     return nativefn;
 }
 
+#define HASH_WORD_MIN 16     // shorter strings are hashed a byte at a time
+
+/*
+@Note: Short strings, i.e. most identifiers, keep FNV-1a. Longer ones are
+       read eight bytes at a time and mixed with a multiply and rotate, then
+       the tail is folded in byte by byte. Hashes are stored after all:
+       the tables of a string 'selon' are sorted by them and written into
+       .ziac and .ziai files, which check hashFingerprint() before loading.
+*/
 static ZUInt32 hashString(const ZChar *key, ZInt32 length)
 {
-    ZUInt32 hash = 2166136261u;
-    for (ZInt32 i = 0; i < length; i++)
+    if (length < HASH_WORD_MIN)
+    {
+        ZUInt32 hash = 2166136261u;
+        for (ZInt32 i = 0; i < length; i++)
+        {
+            hash ^= (ZUInt8)key[i];
+            hash *= 16777619;
+        }
+        return hash;
+    }
+
+    ZUInt64 hash = 0xcbf29ce484222325ull ^ (ZUInt64)length;
+    ZInt32 i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        ZUInt64 word;
+        memcpy(&word, key + i, sizeof(word));
+        hash = ((hash << 23) | (hash >> 41)) ^ word;
+        hash *= 0x9e3779b97f4a7c15ull;
+    }
+    for (; i < length; i++)
+    {
+        hash ^= (ZUInt8)key[i];
+        hash *= 0x100000001b3ull;
+    }
+    hash ^= hash >> 32;
+    return (ZUInt32)hash;
+}
+
+// changes whenever either half of hashString() does
+ZUInt32 hashFingerprint()
+{
+    static const ZChar probe[] = "zia: une empreinte de hashString()";
+    return hashString(probe, HASH_WORD_MIN - 1) ^ hashString(probe, (ZInt32)sizeof(probe) - 1);
+}
+
+// the hash of a flat string, computed the first time it is asked for
+ZUInt32 stringHash(ObjString *string)
+{
+    if (ZFALSE == string->hashed)
     {
-        hash ^= (ZUInt32)key[i];
-        hash *= 16777619;
+        string->hash = hashString(string->chars, string->length);
+        string->hashed = ZTRUE;
     }
-    return hash;
+    return string->hash;
 }
 
-static ObjString *allocateString(ZChar *chars, ZInt32 length, ZUInt32 hash)
+// a string header of 'size' bytes, with neither characters nor operands yet
+static ObjString *allocateStringObject(size_t size, ZInt32 length)
 {
-    ObjString *string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+    ObjString *string = (ObjString *)allocateObject(size, OBJ_STRING);
     string->length = length;
-    string->chars = chars;
+    string->hash = 0;
+    string->interned = ZFALSE;
+    string->hashed = ZFALSE;
+    string->chars = NULL;
+    string->left = NULL;
+    string->right = NULL;
+    return string;
+}
+
+static ZBool fitsInline(ZInt32 length)
+{
+    return sizeof(ObjString) + (size_t)length + 1 <= STRING_MAX_CELL;
+}
+
+// a string with room for 'length' characters, in its own cell when they fit
+static ObjString *allocateString(ZInt32 length)
+{
+    ObjString *string;
+    if (ZTRUE == fitsInline(length))
+    {
+        string = allocateStringObject(sizeof(ObjString) + length + 1, length);
+        string->chars = string->inlineChars;
+    }
+    else
+    {
+        string = allocateStringObject(sizeof(ObjString), length);
+        push(OBJ_VAL(string));
+        string->chars = ALLOCATE(ZChar, length + 1);
+        pop();
+    }
+    string->chars[length] = NULL_CHAR;
+    return string;
+}
+
+static ObjString *internString(ObjString *string, ZUInt32 hash)
+{
     string->hash = hash;
+    string->hashed = ZTRUE;
+    string->interned = ZTRUE;
 
     push(OBJ_VAL(string));
-    tableSet(&vm.strings, string, NUL_VAL);
+    tableSet(&vm->strings, string, NUL_VAL);
     pop();
 
     return string;
@@ -89,28 +182,192 @@ static ObjString *allocateString(ZChar *chars, ZInt32 length, ZUInt32 hash)
 ObjString *takeString(ZChar *chars, ZInt32 length)
 {
     ZUInt32 hash = hashString(chars, length);
-    ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString *interned = tableFindString(&vm->strings, chars, length, hash);
     if (NULL != interned)
     {
         FREE_ARRAY(ZChar, chars, length + 1);
         return interned;
     }
-    return allocateString(chars, length, hash);
+
+    // a buffer too long for a cell is kept as it is, others are copied inline
+    if (ZFALSE == fitsInline(length))
+    {
+        ObjString *string = allocateStringObject(sizeof(ObjString), length);
+        string->chars = chars;
+        return internString(string, hash);
+    }
+    ObjString *string = allocateString(length);
+    memcpy(string->chars, chars, length);
+    FREE_ARRAY(ZChar, chars, length + 1);
+    return internString(string, hash);
 }
 
 ObjString *copyString(const ZChar *chars, ZInt32 length)
 {
     ZUInt32 hash = hashString(chars, length);
-    ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
+    ObjString *interned = tableFindString(&vm->strings, chars, length, hash);
     if (NULL != interned)
     {
         return interned;
     }
 
-    ZChar *heapChars = ALLOCATE(ZChar, length + 1);
-    memcpy(heapChars, chars, length);
-    heapChars[length] = NULL_CHAR;
-    return allocateString(heapChars, length, hash);
+    ObjString *string = allocateString(length);
+    memcpy(string->chars, chars, length);
+    return internString(string, hash);
+}
+
+// a flat string that is not interned, as the program makes them
+ObjString *newString(const ZChar *chars, ZInt32 length)
+{
+    ObjString *string = allocateString(length);
+    memcpy(string->chars, chars, length);
+    return string;
+}
+
+ObjString *concatStrings(ObjString *a, ObjString *b)
+{
+    ZInt32 length = a->length + b->length;
+    if (length < ROPE_MIN_LENGTH)
+    {
+        // short results are copied at once, as a rope node would cost about as much
+        ObjString *string = allocateString(length);
+        memcpy(string->chars, a->chars, a->length);
+        memcpy(string->chars + a->length, b->chars, b->length);
+        return string;
+    }
+
+    ObjString *rope = allocateStringObject(sizeof(ObjString), length);
+    rope->left = a;
+    rope->right = b;
+    writeBarrier(&rope->obj, OBJ_VAL(a));
+    writeBarrier(&rope->obj, OBJ_VAL(b));
+    return rope;
+}
+
+/*
+@Note: Visits the flat strings a rope is made of, left to right. Ropes
+       built in a loop are as deep as the loop is long, so the pending right
+       halves go on an explicit stack rather than the C one. Nothing is
+       allocated on the heap: this is safe in the middle of a collection.
+*/
+static void visitRope(ObjString *rope, void (*visit)(ObjString *leaf, void *context), void *context)
+{
+    if (NULL != rope->chars)
+    {
+        visit(rope, context);
+        return;
+    }
+
+    ZInt32 capacity = 64;
+    ZInt32 count = 0;
+    ObjString **pending = (ObjString **)malloc(sizeof(ObjString *) * capacity);
+    if (NULL == pending)
+    {
+        exit(1);
+    }
+
+    pending[count++] = rope;
+    while (count > 0)
+    {
+        ObjString *string = pending[--count];
+        while (NULL == string->chars && NULL == string->right)
+        {
+            string = string->left;
+        }
+        if (NULL != string->chars)
+        {
+            visit(string, context);
+            continue;
+        }
+
+        if (capacity < count + 2)
+        {
+            capacity *= 2;
+            pending = (ObjString **)realloc(pending, sizeof(ObjString *) * capacity);
+            if (NULL == pending)
+            {
+                exit(1);
+            }
+        }
+        pending[count++] = string->right;
+        pending[count++] = string->left;
+    }
+    free(pending);
+}
+
+static void copyLeaf(ObjString *leaf, void *context)
+{
+    ZChar **cursor = (ZChar **)context;
+    memcpy(*cursor, leaf->chars, leaf->length);
+    *cursor += leaf->length;
+}
+
+static void printLeaf(ObjString *leaf, void *context)
+{
+    fwrite(leaf->chars, 1, leaf->length, (FILE *)context);
+}
+
+// the string itself, with its characters copied out first if it is a rope
+ObjString *flattenString(ObjString *string)
+{
+    if (NULL != string->chars)
+    {
+        return string;
+    }
+
+    // the rope may be unreachable otherwise, e.g. a value printed after being popped
+    push(OBJ_VAL(string));
+    // the header has no room for them, the characters get a buffer of their own
+    ZChar *chars = ALLOCATE(ZChar, string->length + 1);
+    ZChar *cursor = chars;
+    visitRope(string, copyLeaf, &cursor);
+    chars[string->length] = NULL_CHAR;
+    string->chars = chars;
+    string->left = NULL;
+    string->right = NULL;
+    pop();
+    return string;
+}
+
+// the interned string with the characters of 'string', NULL if there is none
+ObjString *findInterned(ObjString *string)
+{
+    if (ZTRUE == string->interned)
+    {
+        return string;
+    }
+    flattenString(string);
+    return tableFindString(&vm->strings, string->chars, string->length, stringHash(string));
+}
+
+/*
+@Note: Two interned strings are equal only when they are the same object.
+       Any other pair is compared by length, then by hash when both are
+       already known, and only then byte by byte.
+*/
+ZBool stringsEqual(ObjString *a, ObjString *b)
+{
+    if (a == b)
+    {
+        return ZTRUE;
+    }
+    if (a->length != b->length || (ZTRUE == a->interned && ZTRUE == b->interned))
+    {
+        return ZFALSE;
+    }
+    if (ZTRUE == a->hashed && ZTRUE == b->hashed && a->hash != b->hash)
+    {
+        return ZFALSE;
+    }
+
+    // flattening 'b' may collect, 'a' could be popped already
+    push(OBJ_VAL(a));
+    push(OBJ_VAL(b));
+    flattenString(a);
+    flattenString(b);
+    pop();
+    pop();
+    return 0 == memcmp(a->chars, b->chars, a->length);
 }
 
 ObjUpvalue *newUpvalue(Value *slot)
@@ -122,37 +379,43 @@ ObjUpvalue *newUpvalue(Value *slot)
     return upvalue;
 }
 
-static void printFunction(ObjFunction *function)
+static void printFunction(FILE *file, ObjFunction *function)
 {
     if (NULL == function->name)
     {
-        printf("<script>");
+        fputs("<script>", file);
         return;
     }
 
-    printf("<fn %s>", function->name->chars);
+    fprintf(file, "<fn %s>", function->name->chars);
 }
 
 void printObject(Value value)
+{
+    fprintObject(stdout, value);
+}
+
+void fprintObject(FILE *file, Value value)
 {
     switch (OBJ_TYPE(value))
     {
     case OBJ_CLOSURE:
     {
-        printFunction(AS_CLOSURE(value)->function);
+        printFunction(file, AS_CLOSURE(value)->function);
         break;
     }
     case OBJ_FUNCTION:
-        printFunction(AS_FUNCTION(value));
+        printFunction(file, AS_FUNCTION(value));
         break;
     case OBJ_STRING:
-        printf("%s", AS_CSTRING(value));
+        // a rope is printed piece by piece, there is no need to flatten it
+        visitRope(AS_STRING(value), printLeaf, file);
         break;
     case OBJ_NATIVE:
-        printf("<native fn>");
+        fputs("<native fn>", file);
         break;
     case OBJ_UPVALUE:
-        printf("upvalue");
+        fputs("upvalue", file);
         break;
     }
 }
@@ -16,9 +16,12 @@
 #define AS_FUNCTION(value)  ((ObjFunction*)AS_OBJ(value))
 #define AS_NATIVE(value)    (((ObjNativeFn*)AS_OBJ(value))->function)
 #define AS_STRING(value)    ((ObjString*)AS_OBJ(value))
-#define AS_CSTRING(value)   (((ObjString*)AS_OBJ(value))->chars)
+#define AS_CSTRING(value)   (flattenString((ObjString*)AS_OBJ(value))->chars)
 
-typedef Value (*NativeFn)(ZInt32 argCount, Value* args);
+struct VM;
+
+// natives get the VM that calls them
+typedef Value (*NativeFn)(struct VM* vm, ZInt32 argCount, Value* args);
 
 typedef enum
 {
@@ -29,11 +32,25 @@ typedef enum
     OBJ_UPVALUE,
 }ObjType;
 
+#define OBJ_TYPE_COUNT      (OBJ_UPVALUE + 1)
+
+/*
+@Note: Strings keep their characters inline, so their cells come from
+       pools of their own, one per size class up to STRING_MAX_CELL bytes.
+       objectPools[OBJ_STRING] only holds bare headers: ropes and strings
+       too long for a cell, whose characters live in a buffer of their own.
+*/
+#define STRING_SIZE_CLASSES 14
+#define STRING_MAX_CELL     4096
+#define OBJECT_POOLS        (OBJ_TYPE_COUNT + STRING_SIZE_CLASSES)
+
+/*
+@Note: The collector keeps its per-object state (mark, age, remembered) in
+       the side bitmaps of the object's pool page, see allocator.h.
+*/
 struct Obj
 {
     ObjType type;
-    ZBool isMarked;
-    struct Obj* next;
 };
 
 typedef struct
@@ -41,6 +58,7 @@ typedef struct
     Obj obj;
     ZInt32 arity; //stores the number of parameters the function expects
     ZInt32 upvalueCount;
+    ZInt32 maxStack;    // stack slots a call uses at most, callee and arguments included
     Chunk chunk;
     ObjString* name;
 }ObjFunction;
@@ -51,12 +69,29 @@ typedef struct
     NativeFn function;
 }ObjNativeFn;
 
+/*
+@Note: Only the strings the compiler sees, identifiers and literals, are
+       interned; 'interned' is set on them and their hash is computed up
+       front. Strings made while the program runs are neither interned nor
+       hashed until someone asks, see stringHash() and findInterned().
+       A string built by '+' starts as a rope: chars is NULL and left and
+       right are the two operands, so repeated concatenation does not copy
+       the whole string every time. flattenString() copies the characters
+       out once they are needed and drops the operands.
+       chars points to inlineChars, right after the header, unless the
+       string is too long for a cell or was a rope.
+*/
 struct ObjString
 {
     Obj obj;
     ZInt32 length;
-    ZChar* chars;
     ZUInt32 hash;
+    ZBool interned;
+    ZBool hashed;
+    ZChar* chars;
+    struct ObjString* left;
+    struct ObjString* right;
+    ZChar inlineChars[];
 };
 
 typedef struct ObjUpvalue
@@ -80,8 +115,22 @@ ObjFunction* newFunction();
 ObjNativeFn* newNative(NativeFn function);
 ObjString* takeString(ZChar* chars, ZInt32 length);
 ObjString* copyString(const ZChar* chars, ZInt32 length);
+ObjString* newString(const ZChar* chars, ZInt32 length);
+ObjString* concatStrings(ObjString* a, ObjString* b);
+ObjString* flattenString(ObjString* string);
+ObjString* findInterned(ObjString* string);
+ZUInt32 stringHash(ObjString* string);
+ZUInt32 hashFingerprint();
+ZBool stringsEqual(ObjString* a, ObjString* b);
 ObjUpvalue* newUpvalue(Value* slot);
 void printObject(Value value);
+void fprintObject(FILE* file, Value value);
+
+// the bytes of a string object, its inline characters included
+static inline size_t stringObjectSize(ObjString* string)
+{
+    return sizeof(ObjString) + (string->chars == string->inlineChars ? (size_t)string->length + 1 : 0);
+}
 
 static inline ZBool isObjType(Value value, ObjType type)
 {
@@ -7,15 +7,6 @@
 
 #define END_CHAR '\0'
 
-typedef struct
-{
-    const char *start;
-    const char *current;
-    ZInt32 line;
-} Scanner;
-
-Scanner scanner;
-
 static bool isAlpha(char c)
 {
     return (c >= 'a' && c <= 'z') ||
@@ -28,118 +19,118 @@ static bool isDigit(char c)
     return c >= '0' && c <= '9';
 }
 
-static ZBool isAtEnd()
+static ZBool isAtEnd(Scanner *scanner)
 {
-    return *scanner.current == END_CHAR;
+    return *scanner->current == END_CHAR;
 }
 
-static char advance()
+static char advance(Scanner *scanner)
 {
-    scanner.current++;
-    return scanner.current[-1];
+    scanner->current++;
+    return scanner->current[-1];
 }
 
-static char peek()
+static char peek(Scanner *scanner)
 {
-    return *scanner.current;
+    return *scanner->current;
 }
 
-static char peekNext()
+static char peekNext(Scanner *scanner)
 {
-    if (isAtEnd())
+    if (isAtEnd(scanner))
     {
         return NULL_CHAR;
     }
-    return scanner.current[1];
+    return scanner->current[1];
 }
 
-static ZBool match(char expected)
+static ZBool match(Scanner *scanner, char expected)
 {
-    if (isAtEnd())
+    if (isAtEnd(scanner))
     {
         return ZFALSE;
     }
-    if (*scanner.current != expected)
+    if (*scanner->current != expected)
     {
         return ZFALSE;
     }
-    scanner.current++;
+    scanner->current++;
     return true;
 }
 
-static Token makeToken(TokenType type)
+static Token makeToken(Scanner *scanner, TokenType type)
 {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (ZInt32)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (ZInt32)(scanner->current - scanner->start);
+    token.line = scanner->line;
 
     return token;
 }
 
-static Token errorToken(const char *message)
+static Token errorToken(Scanner *scanner, const char *message)
 {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = message;
     token.length = (ZInt32)strlen(message);
-    token.line = scanner.line;
+    token.line = scanner->line;
 
     return token;
 }
 
-static void skipWhiteSpace()
+static void skipWhiteSpace(Scanner *scanner)
 {
     for (;;)
     {
-        char c = peek();
+        char c = peek(scanner);
         switch (c)
         {
         case BLANK_SPACE:
         case CARRIAGE_RETURN:
         case TAB_SPACE:
-            advance();
+            advance(scanner);
             break;
         case NEW_LINE:
-            scanner.line++;
-            advance();
+            scanner->line++;
+            advance(scanner);
             break;
 
         // Handle single-line and multi-line comments
         case COMMENT_SLASH:
-            if (peekNext() == COMMENT_SLASH)
+            if (peekNext(scanner) == COMMENT_SLASH)
             {
                 // Skip  this chars : //
-                while (peek() != NEW_LINE && !isAtEnd())
+                while (peek(scanner) != NEW_LINE && !isAtEnd(scanner))
                 {
-                    advance();
+                    advance(scanner);
                 }
             }
-            else if (peekNext() == COMMENT_STAR)
+            else if (peekNext(scanner) == COMMENT_STAR)
             {
                 // Skip this: /*
-                advance();
-                advance();
-                while (!isAtEnd())
+                advance(scanner);
+                advance(scanner);
+                while (!isAtEnd(scanner))
                 {
                     // in case having new line in the multi-line comment scanner should increase its line count
-                    if (peek() == NEW_LINE)
+                    if (peek(scanner) == NEW_LINE)
                     {
-                        scanner.line++;
+                        scanner->line++;
                     }
-                    if (peek() == COMMENT_STAR && peekNext() == COMMENT_SLASH)
+                    if (peek(scanner) == COMMENT_STAR && peekNext(scanner) == COMMENT_SLASH)
                     {
-                        advance(); // consume '*'
-                        advance(); // consume '/'
+                        advance(scanner); // consume '*'
+                        advance(scanner); // consume '/'
                         break;
                     }
-                    advance();
+                    advance(scanner);
                 }
 
-                if (isAtEnd())
+                if (isAtEnd(scanner))
                 {
-                    errorToken("Commentaire multi-ligne non terminé.");
+                    errorToken(scanner, "Commentaire multi-ligne non terminé.");
                     return;
                 }
             }
@@ -154,52 +145,52 @@ static void skipWhiteSpace()
     }
 }
 
-static TokenType checkKeyword(ZInt32 start, ZInt32 length, const ZChar *rest, TokenType type)
+static TokenType checkKeyword(Scanner *scanner, ZInt32 start, ZInt32 length, const ZChar *rest, TokenType type)
 {
-    if ((scanner.current - scanner.start == start + length) && (memcmp(scanner.start + start, rest, length) == 0))
+    if ((scanner->current - scanner->start == start + length) && (memcmp(scanner->start + start, rest, length) == 0))
     {
         return type;
     }
     return TOKEN_IDENTIFIER;
 }
 
-static TokenType identifierType()
+static TokenType identifierType(Scanner *scanner)
 {
-    ZInt32 length = scanner.current - scanner.start;
-    switch (scanner.start[0])
+    ZInt32 length = scanner->current - scanner->start;
+    switch (scanner->start[0])
     {
     case 'e':
-        return checkKeyword(1, 1, "t", TOKEN_AND);
+        return checkKeyword(scanner, 1, 1, "t", TOKEN_AND);
     case 'p':
-        return checkKeyword(1, 3, "our", TOKEN_FOR);
+        return checkKeyword(scanner, 1, 3, "our", TOKEN_FOR);
     case 'n':
-        return checkKeyword(1, 2, "ul", TOKEN_NULL);
+        return checkKeyword(scanner, 1, 2, "ul", TOKEN_NULL);
     case 'o':
-        return checkKeyword(1, 1, "u", TOKEN_OR);
+        return checkKeyword(scanner, 1, 1, "u", TOKEN_OR);
     case 'a':
-        return checkKeyword(1, 7, "fficher", TOKEN_PRINT);
+        return checkKeyword(scanner, 1, 7, "fficher", TOKEN_PRINT);
     case 'r':
-        return checkKeyword(1, 8, "etourner", TOKEN_RETURN);
+        return checkKeyword(scanner, 1, 8, "etourner", TOKEN_RETURN);
     case 't':
-        return checkKeyword(1, 6, "antque", TOKEN_WHILE);
+        return checkKeyword(scanner, 1, 6, "antque", TOKEN_WHILE);
     case 'q':
-        return checkKeyword(1, 6, "uitter", TOKEN_BREAK);
+        return checkKeyword(scanner, 1, 6, "uitter", TOKEN_BREAK);
     case 'd':
-        return checkKeyword(1, 5, "efaut", TOKEN_DEFAULT);
+        return checkKeyword(scanner, 1, 5, "efaut", TOKEN_DEFAULT);
     case 'c':
     {
         if (length > 1)
         {
-            switch (scanner.start[1])
+            switch (scanner->start[1])
             {
             case 'l':
-                return checkKeyword(2, 4, "asse", TOKEN_CLASS);
+                return checkKeyword(scanner, 2, 4, "asse", TOKEN_CLASS);
             case 'e':
-                return checkKeyword(2, 2, "ci", TOKEN_THIS);
+                return checkKeyword(scanner, 2, 2, "ci", TOKEN_THIS);
             case 'o':
-                return checkKeyword(2, 7, "ntinuer", TOKEN_CONTINUE);
+                return checkKeyword(scanner, 2, 7, "ntinuer", TOKEN_CONTINUE);
             case 'a':
-                return checkKeyword(2, 1, "s", TOKEN_CASE);
+                return checkKeyword(scanner, 2, 1, "s", TOKEN_CASE);
             }
         }
         break;
@@ -209,12 +200,12 @@ static TokenType identifierType()
     {
         if (length > 1)
         {
-            switch (scanner.start[1])
+            switch (scanner->start[1])
             {
             case 'r':
-                return checkKeyword(2, 2, "ai", TOKEN_TRUE);
+                return checkKeyword(scanner, 2, 2, "ai", TOKEN_TRUE);
             case 'a':
-                return checkKeyword(2, 1, "r", TOKEN_VAR);
+                return checkKeyword(scanner, 2, 1, "r", TOKEN_VAR);
             }
         }
         break;
@@ -223,12 +214,12 @@ static TokenType identifierType()
     {
         if (length > 1)
         {
-            switch (scanner.start[1])
+            switch (scanner->start[1])
             {
             case 'o':
-                return checkKeyword(2, 6, "nction", TOKEN_FUN);
+                return checkKeyword(scanner, 2, 6, "nction", TOKEN_FUN);
             case 'a':
-                return checkKeyword(2, 2, "ux", TOKEN_FALSE);
+                return checkKeyword(scanner, 2, 2, "ux", TOKEN_FALSE);
             }
         }
         break;
@@ -237,10 +228,10 @@ static TokenType identifierType()
     {
         if (length > 1)
         {
-            switch (scanner.start[1])
+            switch (scanner->start[1])
             {
                 case 'u':
-                    return checkKeyword(2, 3, "per", TOKEN_SUPER);
+                    return checkKeyword(scanner, 2, 3, "per", TOKEN_SUPER);
                 case 'i':
                 {
                     if (length == 2)
@@ -257,7 +248,7 @@ static TokenType identifierType()
                     }
                 }
                 case 'e':
-                    return checkKeyword(2, 3, "lon", TOKEN_SWITCH);
+                    return checkKeyword(scanner, 2, 3, "lon", TOKEN_SWITCH);
             }
         }
         break;
@@ -269,205 +260,205 @@ static TokenType identifierType()
     return TOKEN_IDENTIFIER;
 }
 
-static Token identifier()
+static Token identifier(Scanner *scanner)
 {
-    while (isAlpha(peek()) || isDigit(peek()))
+    while (isAlpha(peek(scanner)) || isDigit(peek(scanner)))
     {
-        advance();
+        advance(scanner);
     }
-    return makeToken(identifierType());
+    return makeToken(scanner, identifierType(scanner));
 }
 
-static Token number()
+static Token number(Scanner *scanner)
 {
-    while (isDigit(peek()))
+    while (isDigit(peek(scanner)))
     {
-        advance();
+        advance(scanner);
     }
 
-    if (peek() == '.' && isDigit(peekNext()))
+    if (peek(scanner) == '.' && isDigit(peekNext(scanner)))
     {
-        advance();
-        while (isDigit(peek()))
+        advance(scanner);
+        while (isDigit(peek(scanner)))
         {
-            advance();
+            advance(scanner);
         }
     }
-    return makeToken(TOKEN_NUMBER);
+    return makeToken(scanner, TOKEN_NUMBER);
 }
 
-static Token string()
+static Token string(Scanner *scanner)
 {
     // keep going till we find '"' to terminate the string:
-    while (peek() != '"' && !isAtEnd())
+    while (peek(scanner) != '"' && !isAtEnd(scanner))
     {
-        if (peek() == '\\' && peekNext() == '"')
+        if (peek(scanner) == '\\' && peekNext(scanner) == '"')
         {
-            advance();
+            advance(scanner);
         }
-        if (peek() == '\n')
-            scanner.line++;
-        advance();
+        if (peek(scanner) == '\n')
+            scanner->line++;
+        advance(scanner);
     }
-    if (isAtEnd())
-        return errorToken("Unterminated string.");
+    if (isAtEnd(scanner))
+        return errorToken(scanner, "Unterminated string.");
 
-    advance();
-    return makeToken(TOKEN_STRING);
+    advance(scanner);
+    return makeToken(scanner, TOKEN_STRING);
 }
 
-void initScanner(const ZChar *source)
+void initScanner(Scanner *scanner, const ZChar *source)
 {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+    scanner->start = source;
+    scanner->current = source;
+    scanner->line = 1;
 }
 
-Token scanToken()
+Token scanToken(Scanner *scanner)
 {
-    skipWhiteSpace();
-    scanner.start = scanner.current;
-    if (isAtEnd())
+    skipWhiteSpace(scanner);
+    scanner->start = scanner->current;
+    if (isAtEnd(scanner))
     {
-        return makeToken(TOKEN_EOF);
+        return makeToken(scanner, TOKEN_EOF);
     }
 
-    ZChar currChar = advance();
+    ZChar currChar = advance(scanner);
     if (isAlpha(currChar))
     {
-        return identifier();
+        return identifier(scanner);
     }
 
     if (isDigit(currChar))
     {
-        return number();
+        return number(scanner);
     }
 
     switch (currChar)
     {
     case '(':
     {
-        return makeToken(TOKEN_LEFT_PAREN);
+        return makeToken(scanner, TOKEN_LEFT_PAREN);
     }
     case ')':
     {
-        return makeToken(TOKEN_RIGHT_PAREN);
+        return makeToken(scanner, TOKEN_RIGHT_PAREN);
     }
     case '{':
     {
-        return makeToken(TOKEN_LEFT_BRACE);
+        return makeToken(scanner, TOKEN_LEFT_BRACE);
     }
     case '}':
     {
-        return makeToken(TOKEN_RIGHT_BRACE);
+        return makeToken(scanner, TOKEN_RIGHT_BRACE);
     }
     case ';':
     {
-        return makeToken(TOKEN_SEMICOLON);
+        return makeToken(scanner, TOKEN_SEMICOLON);
     }
     case ',':
     {
-        return makeToken(TOKEN_COMMA);
+        return makeToken(scanner, TOKEN_COMMA);
     }
     case '.':
     {
-        return makeToken(TOKEN_DOT);
+        return makeToken(scanner, TOKEN_DOT);
     }
     case '-':
     {
-        if (match('-'))
+        if (match(scanner, '-'))
         {
             // Check if this is prefix ++ (before an identifier)
-            if (isAlpha(peek()))
+            if (isAlpha(peek(scanner)))
             {
-                return makeToken(TOKEN_MINUS_MINUS_PREFIX);
+                return makeToken(scanner, TOKEN_MINUS_MINUS_PREFIX);
             }
             // Otherwise it's postfix ++ (after an identifier)
-            return makeToken(TOKEN_MINUS_MINUS_POSTFIX);
+            return makeToken(scanner, TOKEN_MINUS_MINUS_POSTFIX);
         }
-        else if (match('='))
+        else if (match(scanner, '='))
         {
-            return makeToken(TOKEN_MINUS_EQUAL);
+            return makeToken(scanner, TOKEN_MINUS_EQUAL);
         }
-        return makeToken(TOKEN_MINUS);
+        return makeToken(scanner, TOKEN_MINUS);
     }
     case '+':
     {
-        if (match('+'))
+        if (match(scanner, '+'))
         {
             // Check if this is prefix ++ (before an identifier)
-            if (isAlpha(peek()))
+            if (isAlpha(peek(scanner)))
             {
-                return makeToken(TOKEN_PLUS_PLUS_PREFIX);
+                return makeToken(scanner, TOKEN_PLUS_PLUS_PREFIX);
             }
             // Otherwise it's postfix ++ (after an identifier)
-            return makeToken(TOKEN_PLUS_PLUS_POSTFIX);
+            return makeToken(scanner, TOKEN_PLUS_PLUS_POSTFIX);
         }
-        else if (match('='))
+        else if (match(scanner, '='))
         {
-            return makeToken(TOKEN_PLUS_EQUAL);
+            return makeToken(scanner, TOKEN_PLUS_EQUAL);
         }
-        return makeToken(TOKEN_PLUS);
+        return makeToken(scanner, TOKEN_PLUS);
     }
     case '/':
     {
-        if (match('='))
+        if (match(scanner, '='))
         {
-            return makeToken(TOKEN_SLASH_EQUAL);
+            return makeToken(scanner, TOKEN_SLASH_EQUAL);
         }
-        return makeToken(TOKEN_SLASH);
+        return makeToken(scanner, TOKEN_SLASH);
     }
     case '*':
     {
-        if (match('*'))
+        if (match(scanner, '*'))
         {
-            return makeToken(TOKEN_STAR_STAR);
+            return makeToken(scanner, TOKEN_STAR_STAR);
         }
-        else if (match('='))
+        else if (match(scanner, '='))
         {
-            return makeToken(TOKEN_STAR_EQUAL);
+            return makeToken(scanner, TOKEN_STAR_EQUAL);
         }
-        return makeToken(TOKEN_STAR);
+        return makeToken(scanner, TOKEN_STAR);
     }
     case '!':
     {
-        return makeToken(
-            match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+        return makeToken(scanner, 
+            match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
     }
     case '=':
     {
-        return makeToken(
-            match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+        return makeToken(scanner, 
+            match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
     }
     case '<':
     {
-        return makeToken(
-            match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+        return makeToken(scanner, 
+            match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
     }
     case '>':
     {
-        return makeToken(
-            match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+        return makeToken(scanner, 
+            match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
     }
     case '"':
     {
-        return string();
+        return string(scanner);
     }
     case ':':
     {
-        return makeToken(TOKEN_COLON);
+        return makeToken(scanner, TOKEN_COLON);
     }
     case '?':
     {
-        return makeToken(TOKEN_QUESTION);
+        return makeToken(scanner, TOKEN_QUESTION);
     }
     case '%':
     {
-        return makeToken(TOKEN_PERCENT);
+        return makeToken(scanner, TOKEN_PERCENT);
     }
     default:
         break;
     }
 
-    return errorToken("Caractère inattendu.");
+    return errorToken(scanner, "Caractère inattendu.");
 }
\ No newline at end of file
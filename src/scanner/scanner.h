@@ -46,7 +46,15 @@ typedef struct
    ZInt32 line;
 }Token;
 
-void initScanner(const ZChar* source);
-Token scanToken();
+// position of the scanner in the source; each compile() has its own
+typedef struct
+{
+    const ZChar* start;
+    const ZChar* current;
+    ZInt32 line;
+}Scanner;
+
+void initScanner(Scanner* scanner, const ZChar* source);
+Token scanToken(Scanner* scanner);
 
 #endif
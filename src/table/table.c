@@ -1,125 +1,266 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "memory/memory.h"
 #include "object/object.h"
 #include "table/table.h"
 #include "value/value.h"
 
-#define TBALE_MAX_LOAD 0.75
+#define TABLE_EMPTY        ((ZInt8)-128)
+#define TABLE_DELETED      ((ZInt8)-2)
+#define TABLE_MIN_CAPACITY TABLE_GROUP
+
+// used slots hold 0..127: free ones, empty or deleted, are the negative bytes
+#define IS_FULL(control) ((control) >= 0)
+
+/*
+@Note: The low bits of a hash pick the first group, as the modulo did. The
+       control byte takes 7 bits of the hash multiplied by a large odd
+       constant, whose top bits depend on every bit of the hash: FNV-1a
+       leaves the low bits of short strings poorly mixed.
+*/
+#define HASH_POSITION(hash) (hash)
+#define HASH_TAG(hash)      ((ZInt8)(((ZUInt32)(hash) * 0x9e3779b1u) >> 25))
+
+/*
+@Note: A group mask has one set bit per slot of the group that matched,
+       walked from the lowest. SSE2 gets it from one movemask; NEON has none,
+       so the compare result is narrowed to a nibble per slot, of which only
+       the top bit is kept. Other targets compare byte by byte.
+*/
+#if defined(__ARM_NEON) && !defined(__SSE2__)
+#define GROUP_SLOT_BITS 4
+#else
+#define GROUP_SLOT_BITS 1
+#endif
+
+typedef ZUInt64 GroupMask;
+
+#if defined(__SSE2__)
+static inline GroupMask groupMatch(const ZInt8* group, ZInt8 control)
+{
+    __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(control)));
+}
+
+static inline GroupMask groupMatchFree(const ZInt8* group)
+{
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+}
+#elif defined(__ARM_NEON)
+static inline GroupMask neonMask(uint8x16_t matches)
+{
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(matches), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888ull;
+}
+
+static inline GroupMask groupMatch(const ZInt8* group, ZInt8 control)
+{
+    return neonMask(vceqq_s8(vld1q_s8(group), vdupq_n_s8(control)));
+}
+
+static inline GroupMask groupMatchFree(const ZInt8* group)
+{
+    return neonMask(vcltq_s8(vld1q_s8(group), vdupq_n_s8(0)));
+}
+#else
+static inline GroupMask groupMatch(const ZInt8* group, ZInt8 control)
+{
+    GroupMask mask = 0;
+    for (ZInt32 i = 0; i < TABLE_GROUP; i++)
+    {
+        mask |= (GroupMask)(group[i] == control) << i;
+    }
+    return mask;
+}
+
+static inline GroupMask groupMatchFree(const ZInt8* group)
+{
+    GroupMask mask = 0;
+    for (ZInt32 i = 0; i < TABLE_GROUP; i++)
+    {
+        mask |= (GroupMask)(!IS_FULL(group[i])) << i;
+    }
+    return mask;
+}
+#endif
+
+// the group offset of the lowest slot in the mask
+static inline ZUInt32 firstSlot(GroupMask mask)
+{
+    return (ZUInt32)__builtin_ctzll(mask) / GROUP_SLOT_BITS;
+}
 
 void initTable(Table* table)
 {
     table->count = 0;
+    table->tombstones = 0;
     table->capacity = 0;
+    table->control = NULL;
     table->entries = NULL;
 }
 
 void freeTable(Table* table)
 {
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    if (table->capacity > 0)
+    {
+        FREE_ARRAY(ZInt8, table->control, table->capacity + TABLE_GROUP);
+        FREE_ARRAY(Entry, table->entries, table->capacity);
+    }
     initTable(table);
 }
 
-static Entry* findEntry(Entry* entries, ZInt32 capacity, ObjString* key)
+static void setControl(Table* table, ZUInt32 slot, ZInt8 control)
+{
+    table->control[slot] = control;
+    // the mirror of the first group, read by groups that start near the end
+    if (slot < TABLE_GROUP)
+    {
+        table->control[table->capacity + slot] = control;
+    }
+}
+
+/*
+@Note: Groups are probed at triangular offsets: 1, 2, 3... groups past the
+       previous one. With a power of two capacity this visits every group
+       before coming back to the first, and the load limit leaves empty
+       slots in the table, so a probe always ends.
+*/
+#define FOR_EACH_PROBE(table, hash, position)                                  \
+    for (ZUInt32 position = HASH_POSITION(hash) & ((table)->capacity - 1),     \
+                 stride = TABLE_GROUP;;                                        \
+         position = (position + stride) & ((table)->capacity - 1),             \
+                 stride += TABLE_GROUP)
+
+// the slot holding 'key', -1 if it is not in the table
+static ZInt32 findSlot(Table* table, ObjString* key)
 {
-    ZUInt32 index = key->hash % capacity;
-    Entry* tombStone = NULL;
-    for (;;)
+    ZUInt32 mask = table->capacity - 1;
+    ZInt8 tag = HASH_TAG(key->hash);
+    FOR_EACH_PROBE(table, key->hash, position)
     {
-        Entry* entry = &entries[index];
-        if (NULL == entry->key)
+        const ZInt8* group = table->control + position;
+        for (GroupMask match = groupMatch(group, tag); 0 != match; match &= match - 1)
         {
-            if (IS_NIL(entry->value))
-            {
-                return NULL != tombStone ? tombStone : entry;
-            }
-            else
+            ZUInt32 slot = (position + firstSlot(match)) & mask;
+            if (table->entries[slot].key == key)
             {
-                if (NULL == tombStone)
-                {
-                    tombStone = entry;
-                }
-                
+                return (ZInt32)slot;
             }
         }
-        else if (entry->key == key)
+        if (0 != groupMatch(group, TABLE_EMPTY))
         {
-           return entry;
+            return -1;
         }
+    }
+}
 
-        index = (index + 1) % capacity;
+// the first empty or deleted slot on the probe sequence of 'hash'
+static ZUInt32 findFreeSlot(Table* table, ZUInt32 hash)
+{
+    FOR_EACH_PROBE(table, hash, position)
+    {
+        GroupMask free = groupMatchFree(table->control + position);
+        if (0 != free)
+        {
+            return (position + firstSlot(free)) & (table->capacity - 1);
+        }
     }
-    
 }
 
 ZBool tableGet(Table* table, ObjString* key, Value* value)
-{   
+{
     if (table->count == 0)
     {
         return ZFALSE;
     }
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (NULL == entry->key)
+    ZInt32 slot = findSlot(table, key);
+    if (slot < 0)
     {
         return ZFALSE;
     }
-    
-    *value = entry->value;
+
+    *value = table->entries[slot].value;
     return ZTRUE;
 }
 
 static void adjustCapacity(Table* table, ZInt32 capacity)
 {
+    // both arrays are allocated before the old ones are read: a collection may run meanwhile
+    ZInt8* control = ALLOCATE(ZInt8, capacity + TABLE_GROUP);
     Entry* entries = ALLOCATE(Entry, capacity);
-    for (ZInt32 i = 0; i < capacity; i++)
-    {
-        entries[i].key = NULL;
-        entries[i].value = NUL_VAL;
-    }
+    memset(control, TABLE_EMPTY, capacity + TABLE_GROUP);
 
-    table->count = 0;
+    Table resized = { 0, 0, capacity, control, entries };
     for (ZInt32 i = 0; i < table->capacity; i++)
     {
-        Entry* entry = &table->entries[i];
-        if (NULL == entry->key)
+        if (!IS_FULL(table->control[i]))
         {
             continue;
         }
-        Entry* dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-        table->count++;
+        Entry* entry = &table->entries[i];
+        ZUInt32 slot = findFreeSlot(&resized, entry->key->hash);
+        setControl(&resized, slot, table->control[i]);
+        resized.entries[slot] = *entry;
+        resized.count++;
     }
-    
-    FREE_ARRAY(Entry, table->entries, table->capacity);
-    table->entries = entries;
-    table->capacity = capacity;
+
+    freeTable(table);
+    *table = resized;
 }
 
 ZBool tableSet(Table* table, ObjString* key, Value value)
 {
+    if (table->count > 0)
+    {
+        ZInt32 slot = findSlot(table, key);
+        if (slot >= 0)
+        {
+            table->entries[slot].value = value;
+            return ZFALSE;
+        }
+    }
+
     /*
-    This is how we manage the table’s load factor. 
-    We don’t grow when the capacity is completely full. 
-    Instead, we grow the array before then, when the array 
-    becomes at least TBALE_MAX_LOAD(75% for example) full.
+    The table grows once keys and tombstones would fill 7/8 of it, which
+    keeps empty slots for probes to stop at. When most of that is
+    tombstones, rebuilding at the same capacity is enough to clear them.
     */
-    if (table->count + 1 > table->capacity + TBALE_MAX_LOAD) 
+    if ((table->count + table->tombstones + 1) * 8 > table->capacity * 7)
     {
-        ZInt32 capacity = GROW_CAPACITY(table->capacity);
+        ZInt32 capacity = table->capacity;
+        if ((table->count + 1) * 16 > capacity * 7)
+        {
+            capacity = capacity < TABLE_MIN_CAPACITY ? TABLE_MIN_CAPACITY : capacity * 2;
+        }
         adjustCapacity(table, capacity);
     }
-    
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    ZBool isNewKey = NULL == entry->key;
-    if (isNewKey && IS_NIL(entry->value))
+
+    ZUInt32 slot = findFreeSlot(table, key->hash);
+    if (TABLE_DELETED == table->control[slot])
     {
-        table->count++;
+        table->tombstones--;
     }
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+    setControl(table, slot, HASH_TAG(key->hash));
+    table->entries[slot].key = key;
+    table->entries[slot].value = value;
+    table->count++;
+    return ZTRUE;
+}
+
+static void removeSlot(Table* table, ZUInt32 slot)
+{
+    setControl(table, slot, TABLE_DELETED);
+    table->entries[slot].key = NULL;
+    table->entries[slot].value = NUL_VAL;
+    table->count--;
+    table->tombstones++;
 }
 
 ZBool tableDelete(Table* table, ObjString* key)
@@ -128,13 +269,12 @@ ZBool tableDelete(Table* table, ObjString* key)
     {
         return ZFALSE;
     }
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (NULL == entry)
+    ZInt32 slot = findSlot(table, key);
+    if (slot < 0)
     {
         return ZFALSE;
     }
-    entry->key = NULL;
-    entry->value = BOOL_VAL(true);
+    removeSlot(table, (ZUInt32)slot);
     return ZTRUE;
 }
 
@@ -142,13 +282,12 @@ void tableAddAll(Table* from, Table* to)
 {
     for (ZInt32 i = 0; i < from->capacity; i++)
     {
-        Entry* entry = &from->entries[i];
-        if (NULL != entry->key)
+        if (IS_FULL(from->control[i]))
         {
-           tableSet(to, entry->key, entry->value);
+           tableSet(to, from->entries[i].key, from->entries[i].value);
         }
     }
-    
+
 }
 
 ObjString* tableFindString(Table* table, const ZChar* chars, ZInt32 length, ZUInt32 hash)
@@ -157,25 +296,24 @@ ObjString* tableFindString(Table* table, const ZChar* chars, ZInt32 length, ZUIn
     {
         return NULL;
     }
-    
-    ZUInt32 index = hash % table->capacity;
-    for(;;)
+
+    ZUInt32 mask = table->capacity - 1;
+    ZInt8 tag = HASH_TAG(hash);
+    FOR_EACH_PROBE(table, hash, position)
     {
-        Entry* entry = &table->entries[index];
-        if (NULL == entry->key)
+        const ZInt8* group = table->control + position;
+        for (GroupMask match = groupMatch(group, tag); 0 != match; match &= match - 1)
         {
-            if(IS_NIL(entry->value)) 
+            ObjString* key = table->entries[(position + firstSlot(match)) & mask].key;
+            if (key->length == length && key->hash == hash && memcmp(key->chars, chars, length) == 0)
             {
-                return NULL;
+                return key;
             }
         }
-        else if (entry->key->length == length && entry->key->hash == hash
-                && memcmp(entry->key->chars, chars, length) == 0)
+        if (0 != groupMatch(group, TABLE_EMPTY))
         {
-            return entry->key;
+            return NULL;
         }
-        
-        index = (index + 1) % table->capacity;
     }
 }
 
@@ -183,21 +321,22 @@ void tableRemoveWhite(Table* table)
 {
     for (ZInt32 i = 0; i < table->capacity; i++)
     {
-        Entry* entry = &table->entries[i];
-        if (NULL != entry->key && ZFALSE == entry->key->obj.isMarked)
+        if (IS_FULL(table->control[i]) && isUnreached(&table->entries[i].key->obj))
         {
-            tableDelete(table, entry->key);
+            removeSlot(table, (ZUInt32)i);
         }
     }
-    
+
 }
 
 void markTable(Table* table)
 {
     for (ZInt32 i = 0; i < table->capacity; i++)
     {
-        Entry* entry = &table->entries[i];
-        markObject((Obj*)entry->key);
-        markValue(entry->value);
-    }  
-}
\ No newline at end of file
+        if (IS_FULL(table->control[i]))
+        {
+            markObject((Obj*)table->entries[i].key);
+            markValue(table->entries[i].value);
+        }
+    }
+}
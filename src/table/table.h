@@ -5,6 +5,17 @@
 #include "common/commonTypes.h"
 #include "value/value.h"
 
+/*
+@Note: Open addressing in the SwissTable style. Every slot has a control
+       byte next to the entries: empty, deleted, or the low 7 bits of the
+       hash of the key it holds. A probe compares TABLE_GROUP control bytes
+       at once and only reads the entries whose byte matches; it stops at
+       the first group holding an empty slot. The capacity is a power of
+       two, and the first group is mirrored past the last control byte so
+       a group read never wraps around.
+*/
+#define TABLE_GROUP 16
+
 typedef struct
 {
     ObjString* key;
@@ -13,8 +24,10 @@ typedef struct
 
 typedef struct
 {
-   ZInt32 count;
+   ZInt32 count;        // keys in the table
+   ZInt32 tombstones;   // deleted slots not reused yet
    ZInt32 capacity;
+   ZInt8* control;      // capacity + TABLE_GROUP bytes
    Entry* entries;
 }Table;
 
@@ -35,25 +35,53 @@ void freeValueArray(ValueArray* array)
 
 void printValue(Value value)
 {
-    switch (value.type)
+    fprintValue(stdout, value);
+}
+
+void fprintValue(FILE* file, Value value)
+{
+    if (IS_BOOL(value))
     {
-    case VAL_BOOL:
-        printf(AS_BOOL(value) ? "vrai" : "faux");
-        break;
-    case VAL_NUL:
-        printf("nul");
-        break;
-    case VAL_NUMBER:
-        printf("%g", AS_NUMBER(value));
-        break;
-    case VAL_OBJ:
-        printObject(value);
-        break;
+        fputs(AS_BOOL(value) ? "vrai" : "faux", file);
+    }
+    else if (IS_NIL(value))
+    {
+        fputs("nul", file);
+    }
+    else if (IS_NUMBER(value))
+    {
+        // integers print through the same "%g" as doubles so output does not depend on the kind
+        fprintf(file, "%g", AS_NUMBER(value));
+    }
+    else if (IS_OBJ(value))
+    {
+        fprintObject(file, value);
     }
 }
 
 ZBool valuesEqual(Value a, Value b)
 {
+    // 1 == 1.0: integers and doubles compare by numeric value
+    if (IS_INT(a) && IS_INT(b))
+    {
+        return AS_INT(a) == AS_INT(b);
+    }
+    if (IS_NUMBER(a) && IS_NUMBER(b))
+    {
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+
+#ifdef NAN_BOXING
+    /*
+    @Note: numbers still compare as doubles so that NaN != NaN and 0 == -0,
+           everything else is equal only when the bits are identical.
+    */
+    if (a == b)
+    {
+        return ZTRUE;
+    }
+    return IS_STRING(a) && IS_STRING(b) && stringsEqual(AS_STRING(a), AS_STRING(b));
+#else
     if (a.type != b.type)
     {
         return ZFALSE;
@@ -64,13 +92,16 @@ ZBool valuesEqual(Value a, Value b)
         return AS_BOOL(a) == AS_BOOL(b);
     case VAL_NUL:
         return ZTRUE;
-    case VAL_NUMBER:
-        return AS_NUMBER(a) == AS_NUMBER(b);
     case VAL_OBJ:
     {
+        if (IS_STRING(a) && IS_STRING(b))
+        {
+            return stringsEqual(AS_STRING(a), AS_STRING(b));
+        }
         return AS_OBJ(a) == AS_OBJ(b);
     }
     default:
         return ZFALSE;
     }
+#endif
 }
@@ -1,20 +1,101 @@
 #ifndef ZAI_VALUE_H
 #define ZAI_VALUE_H
 
+#include <stdio.h>
+#include <string.h>
+#include "common/common.h"
 #include "common/commonTypes.h"
 
+typedef struct Obj Obj;
+typedef struct ObjString ObjString;
+
+/*
+@Note: Integers are 48 bits wide in both representations, the width of the
+       NaN-boxed payload, so a script computes the same values whichever
+       way zia is built. Every one of them is also exact as a double.
+*/
+#define ZINT_MIN    (-((ZInt64)1 << 47))
+#define ZINT_MAX    (((ZInt64)1 << 47) - 1)
+
+#ifdef NAN_BOXING
+
+/*
+@Note: A Value is a single 64-bit word. Any double that is not a quiet NaN
+       is stored as is; the remaining quiet-NaN space carries the singleton
+       values (nul, vrai, faux) in its low bits, integers as a 48-bit payload
+       marked by INT_TAG, and object pointers with the sign bit set (pointers
+       fit in the 48 low bits on current platforms).
+*/
+#define SIGN_BIT    ((ZUInt64)0x8000000000000000)
+#define QNAN        ((ZUInt64)0x7ffc000000000000)
+#define INT_TAG     ((ZUInt64)0x0001000000000000)
+#define INT_PAYLOAD ((ZUInt64)0x0000ffffffffffff)
+
+#define TAG_NUL     1 // 01.
+#define TAG_FALSE   2 // 10.
+#define TAG_TRUE    3 // 11.
+#define TAG_UNDEFINED 4 // 100.
+
+typedef ZUInt64 Value;
+
+#define IS_BOOL(value)      (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value)       ((value) == NUL_VAL)
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+#define IS_REAL(value)      (((value) & QNAN) != QNAN)
+#define IS_INT(value)       (((value) & (SIGN_BIT | QNAN | INT_TAG)) == (QNAN | INT_TAG))
+#define IS_NUMBER(value)    (IS_REAL(value) || IS_INT(value))
+#define IS_OBJ(value)       (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+#define AS_BOOL(value)      ((value) == TRUE_VAL)
+#define AS_REAL(value)      valueToNum(value)
+#define AS_INT(value)       (((ZInt64)((value) << 16)) >> 16)
+#define AS_NUMBER(value)    numberToReal(value)
+#define AS_OBJ(value)       ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define BOOL_VAL(b)         ((b) ? TRUE_VAL : FALSE_VAL)
+#define FALSE_VAL           ((Value)(ZUInt64)(QNAN | TAG_FALSE))
+#define TRUE_VAL            ((Value)(ZUInt64)(QNAN | TAG_TRUE))
+#define NUL_VAL             ((Value)(ZUInt64)(QNAN | TAG_NUL))
+#define UNDEFINED_VAL       ((Value)(ZUInt64)(QNAN | TAG_UNDEFINED))
+#define NUMBER_VAL(num)     numToValue(num)
+#define INT_VAL(i)          ((Value)(QNAN | INT_TAG | ((ZUInt64)(i) & INT_PAYLOAD)))
+#define OBJ_VAL(obj)        (Value)(SIGN_BIT | QNAN | (ZUInt64)(uintptr_t)(obj))
+
+static inline ZReal64 valueToNum(Value value)
+{
+    ZReal64 num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+
+static inline Value numToValue(ZReal64 num)
+{
+    Value value;
+    memcpy(&value, &num, sizeof(ZReal64));
+    return value;
+}
+
+#else
+
 #define IS_BOOL(value)      ((value).type == VAL_BOOL)
 #define IS_NIL(value)       ((value).type == VAL_NUL)
-#define IS_NUMBER(value)    ((value).type == VAL_NUMBER)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
+#define IS_REAL(value)      ((value).type == VAL_NUMBER)
+#define IS_INT(value)       ((value).type == VAL_INT)
+#define IS_NUMBER(value)    (IS_REAL(value) || IS_INT(value))
 #define IS_OBJ(value)       ((value).type == VAL_OBJ)
 
 #define AS_BOOL(value)      ((value).as.boolean)
-#define AS_NUMBER(value)    ((value).as.number)
+#define AS_REAL(value)      ((value).as.number)
+#define AS_INT(value)       ((value).as.integer)
+#define AS_NUMBER(value)    numberToReal(value)
 #define AS_OBJ(value)       ((value).as.obj)
 
 #define BOOL_VAL(value)     ((Value){VAL_BOOL, {.boolean = value}})
 #define NUL_VAL             ((Value){VAL_NUL, {.number = 0}})
+#define UNDEFINED_VAL       ((Value){VAL_UNDEFINED, {.number = 0}})
 #define NUMBER_VAL(value)   ((Value){VAL_NUMBER, {.number = value}})
+#define INT_VAL(value)      ((Value){VAL_INT, {.integer = value}})
 #define OBJ_VAL(object)     ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 
 typedef enum
@@ -22,12 +103,11 @@ typedef enum
     VAL_BOOL,
     VAL_NUL,
     VAL_NUMBER,
-    VAL_OBJ
+    VAL_INT,
+    VAL_OBJ,
+    VAL_UNDEFINED, // marks a declared but not yet defined global slot, never visible to scripts
 }ValueType;
 
-typedef struct Obj Obj;
-typedef struct ObjString ObjString;
-
 typedef struct
 {
     ValueType type;
@@ -35,11 +115,29 @@ typedef struct
     {
      ZBool boolean;
      ZReal64 number;
+     ZInt64 integer;
      Obj *obj;
     }as;
     
 }Value;
 
+#endif
+
+/*
+@Note: Numbers are either doubles (REAL) or integers (INT). IS_NUMBER and
+       AS_NUMBER accept both, so code that does not care keeps seeing a
+       ZReal64; the VM keeps integer operands on the integer path and falls
+       back to doubles when a result leaves the ZINT_MIN..ZINT_MAX range.
+*/
+#define INT_FITS(i)         ((i) >= ZINT_MIN && (i) <= ZINT_MAX)
+#define REAL_FITS_INT(r)    ((r) >= (ZReal64)ZINT_MIN && (r) < -(ZReal64)ZINT_MIN)
+
+// a function rather than a macro: AS_NUMBER(pop()) must pop only once
+static inline ZReal64 numberToReal(Value value)
+{
+    return IS_INT(value) ? (ZReal64)AS_INT(value) : AS_REAL(value);
+}
+
 typedef struct
 {
     ZInt32 capacity;
@@ -52,5 +150,6 @@ void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
 void freeValueArray(ValueArray* array);
 void printValue(Value value);
+void fprintValue(FILE* file, Value value);
 
 #endif
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "vm.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <time.h>
@@ -8,23 +9,74 @@
 #include "object/object.h"
 #include "memory/memory.h"
 #include "compiler/compiler.h"
+#include "cache/cache.h"
 
-VM vm;
+__thread VM* vm = NULL;
 
 static Value peek(ZInt32 distance);
 static ZBool isFalsey(Value value);
 static void concatenate();
-static ZBool call(ObjClosure *closure, ZInt32 argCount);
-static ZBool callValue(Value callee, ZInt32 argCount);
+static ZBool call(VM *vm, ObjClosure *closure, ZInt32 argCount);
+static ZBool callValue(VM *vm, Value callee, ZInt32 argCount);
 static ObjUpvalue *captureUpvalue(Value *local);
-static void closeUpvalues(Value *last);
+static void closeUpvalues(VM *vm, Value *last);
 
-static Value clockNative(ZInt32 argCount, Value *args)
+static Value clockNative(VM *vm, ZInt32 argCount, Value *args)
 {
     return NUMBER_VAL((ZReal64)clock() / CLOCKS_PER_SEC);
 }
 
-static Value floorNative(ZInt32 argCount, Value *args)
+// integral doubles come back as integers, keeping -0 as a double so it still prints "-0"
+static Value realToNumber(ZReal64 num)
+{
+    if (REAL_FITS_INT(num) && num == (ZInt64)num && !(num == 0 && signbit(num)))
+    {
+        return INT_VAL((ZInt64)num);
+    }
+    return NUMBER_VAL(num);
+}
+
+/*
+@Note: Operand readers of the 'selon' dispatch instructions, whose tables are
+       big-endian like the jump offsets. Targets are absolute chunk offsets.
+*/
+static inline ZUInt32 readU24(const ZUInt8 *at)
+{
+    return ((ZUInt32)at[0] << 16) | ((ZUInt32)at[1] << 8) | at[2];
+}
+
+static inline ZInt32 readI32(const ZUInt8 *at)
+{
+    return (ZInt32)(((ZUInt32)at[0] << 24) | ((ZUInt32)at[1] << 16) | ((ZUInt32)at[2] << 8) | at[3]);
+}
+
+// integer key of a 'selon' discriminant: integers and integral reals match integer labels
+static ZBool switchKey(Value value, ZInt64 *key)
+{
+    if (IS_INT(value))
+    {
+        *key = AS_INT(value);
+        return ZTRUE;
+    }
+    if (IS_REAL(value) && REAL_FITS_INT(AS_REAL(value)) && AS_REAL(value) == (ZInt64)AS_REAL(value))
+    {
+        *key = (ZInt64)AS_REAL(value);
+        return ZTRUE;
+    }
+    return ZFALSE;
+}
+
+// collector telemetry, e.g. memoire("pic_tas"); see gcStat() for the names
+static Value memoryNative(VM *vm, ZInt32 argCount, Value *args)
+{
+    if (argCount != 1 || !IS_STRING(args[0]))
+    {
+        return NUL_VAL;
+    }
+    return gcStat(AS_CSTRING(args[0]));
+}
+
+static Value floorNative(VM *vm, ZInt32 argCount, Value *args)
 {
     if (argCount != 1)
     {
@@ -37,11 +89,16 @@ static Value floorNative(ZInt32 argCount, Value *args)
         return NUMBER_VAL(NAN);
     }
 
-    ZReal64 num = AS_NUMBER(args[0]);
-    return NUMBER_VAL(floor(num));
+    if (IS_INT(args[0]))
+    {
+        return args[0];
+    }
+
+    ZReal64 num = floor(AS_NUMBER(args[0]));
+    return realToNumber(num);
 }
 
-static Value ceilNative(ZInt32 argCount, Value *args)
+static Value ceilNative(VM *vm, ZInt32 argCount, Value *args)
 {
     if (argCount != 1)
     {
@@ -54,51 +111,253 @@ static Value ceilNative(ZInt32 argCount, Value *args)
         return NUMBER_VAL(NAN);
     }
 
-    ZReal64 num = AS_NUMBER(args[0]);
-    return NUMBER_VAL(ceil(num));
+    if (IS_INT(args[0]))
+    {
+        return args[0];
+    }
+
+    ZReal64 num = ceil(AS_NUMBER(args[0]));
+    return realToNumber(num);
+}
+
+/*
+@Note: The stack is moved rather than realloc'ed in place so that every
+       pointer into it (frame slots, open upvalues, stackTop) can be rebased
+       while the old block is still valid. Like the gray stack it lives
+       outside the GC heap and does not count towards bytesAllocated.
+*/
+static ZBool growStack(ZInt32 needed)
+{
+    ZInt32 used = (ZInt32)(vm->stackTop - vm->stack);
+    if (used + needed > STACK_MAX)
+    {
+        return ZFALSE;
+    }
+
+    ZInt32 capacity = vm->stackCapacity;
+    while (capacity < used + needed)
+    {
+        capacity = GROW_CAPACITY(capacity);
+    }
+    if (capacity > STACK_MAX)
+    {
+        capacity = STACK_MAX;
+    }
+
+    Value *stack = (Value *)malloc(sizeof(Value) * capacity);
+    if (NULL == stack)
+    {
+        exit(1);
+    }
+    memcpy(stack, vm->stack, sizeof(Value) * used);
+
+    for (ZInt32 i = 0; i < vm->frameCount; i++)
+    {
+        vm->frames[i].slots = stack + (vm->frames[i].slots - vm->stack);
+    }
+    for (ObjUpvalue *upvalue = vm->openUpvalues; upvalue != NULL; upvalue = upvalue->next)
+    {
+        upvalue->location = stack + (upvalue->location - vm->stack);
+    }
+    vm->stackTop = stack + used;
+
+    free(vm->stack);
+    vm->stack = stack;
+    vm->stackCapacity = capacity;
+    return ZTRUE;
+}
+
+// room for the locals and temporaries of 'function' in a frame starting at 'slots'
+static inline ZBool reserveStack(VM *vm, Value *slots, ObjFunction *function)
+{
+    ZInt32 needed = (ZInt32)(slots - vm->stackTop) + function->maxStack + STACK_RESERVE;
+    return slots + function->maxStack + STACK_RESERVE <= vm->stack + vm->stackCapacity || growStack(needed);
+}
+
+static ZBool growFrames()
+{
+    if (vm->frameCapacity == FRAMES_MAX)
+    {
+        return ZFALSE;
+    }
+
+    ZInt32 capacity = GROW_CAPACITY(vm->frameCapacity);
+    if (capacity > FRAMES_MAX)
+    {
+        capacity = FRAMES_MAX;
+    }
+
+    vm->frames = (CallFrame *)realloc(vm->frames, sizeof(CallFrame) * capacity);
+    if (NULL == vm->frames)
+    {
+        exit(1);
+    }
+    vm->frameCapacity = capacity;
+    return ZTRUE;
 }
 
 static void resetStack()
 {
-    vm.stackTop = vm.stack;
-    vm.frameCount = 0;
-    vm.openUpvalues = NULL;
+    vm->stackTop = vm->stack;
+    vm->frameCount = 0;
+    vm->openUpvalues = NULL;
 }
 
 static void runtimeError(const ZChar *format, ...)
 {
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm->err, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm->err);
 
-    for (ZInt32 i = vm.frameCount - 1; i >= 0; i--)
+    // with deep recursion only the innermost and outermost frames are worth printing
+    const ZInt32 shown = 16;
+    for (ZInt32 i = vm->frameCount - 1; i >= 0; i--)
     {
-        CallFrame *frame = &vm.frames[i];
+        if (i == vm->frameCount - 1 - shown && i >= shown)
+        {
+            fprintf(vm->err, "[... %d appels omis ...]\n", i - shown + 1);
+            i = shown - 1;
+        }
+
+        CallFrame *frame = &vm->frames[i];
         ObjFunction *function = frame->closure->function;
         size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[ligne %d] dans ", function->chunk.lines[instruction]);
+        fprintf(vm->err, "[ligne %d] dans ", function->chunk.lines[instruction]);
         if (NULL == function->name)
         {
-            fprintf(stderr, "script\n");
+            fprintf(vm->err, "script\n");
         }
         else
         {
-            fprintf(stderr, "%s()\n", function->name->chars);
+            fprintf(vm->err, "%s()\n", function->name->chars);
         }
     }
 
     resetStack();
 }
 
-static void defineNative(const ZChar *name, NativeFn function)
+// natives are kept in vm->nativeGlobals as well, resetGlobals() puts them back
+void defineNative(VM *context, const ZChar *name, NativeFn function)
 {
+    VM *previous = vm;
+    vm = context;
     push(OBJ_VAL(copyString(name, (ZInt32)strlen(name))));
     push(OBJ_VAL(newNative(function)));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    ZInt32 slot = globalSlot(AS_STRING(peek(1)));
+    vm->globalValues.values[slot] = peek(0);
+    globalWriteBarrier(slot, peek(0));
+    writeValueArray(&vm->nativeGlobals, INT_VAL(slot));
+    writeValueArray(&vm->nativeGlobals, peek(0));
     pop();
     pop();
+    vm = previous;
+}
+
+/*
+@Note: Globals are resolved by the compiler to a slot in vm->globalValues, so
+       the VM indexes an array instead of hashing the name on every access.
+       Slots outlive a single compile() so REPL lines keep sharing them.
+*/
+ZInt32 globalSlot(ObjString *name)
+{
+    Value index;
+    if (tableGet(&vm->globalSlots, name, &index))
+    {
+        return (ZInt32)AS_INT(index);
+    }
+
+    if (vm->globalValues.count == GLOBALS_MAX)
+    {
+        return -1;
+    }
+
+    push(OBJ_VAL(name));
+    ZInt32 slot = vm->globalValues.count;
+    writeValueArray(&vm->globalValues, UNDEFINED_VAL);
+    writeValueArray(&vm->globalNames, OBJ_VAL(name));
+    tableSet(&vm->globalSlots, name, INT_VAL(slot));
+    // the name is only reached through the new slot: a young one must be remembered
+    globalWriteBarrier(slot, OBJ_VAL(name));
+    pop();
+
+    return slot;
+}
+
+/*
+@Note: Checked integer arithmetic. Each helper returns ZFALSE when the exact
+       result does not fit in a Value integer, and the caller then redoes the
+       operation on doubles, so scripts never see a wrapped result.
+*/
+static inline ZBool intAdd(ZInt64 a, ZInt64 b, ZInt64 *result)
+{
+#ifdef __GNUC__
+    return !__builtin_add_overflow(a, b, result) && INT_FITS(*result);
+#else
+    if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b))
+    {
+        return ZFALSE;
+    }
+    *result = a + b;
+    return INT_FITS(*result);
+#endif
+}
+
+static inline ZBool intSubtract(ZInt64 a, ZInt64 b, ZInt64 *result)
+{
+#ifdef __GNUC__
+    return !__builtin_sub_overflow(a, b, result) && INT_FITS(*result);
+#else
+    if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b))
+    {
+        return ZFALSE;
+    }
+    *result = a - b;
+    return INT_FITS(*result);
+#endif
+}
+
+static inline ZBool intMultiply(ZInt64 a, ZInt64 b, ZInt64 *result)
+{
+    // zero times a negative number is -0, which only a double holds
+    if ((0 == a && b < 0) || (0 == b && a < 0))
+    {
+        return ZFALSE;
+    }
+#ifdef __GNUC__
+    return !__builtin_mul_overflow(a, b, result) && INT_FITS(*result);
+#else
+    if (a != 0 && b != 0)
+    {
+        if ((a == -1 && b == INT64_MIN) || (b == -1 && a == INT64_MIN))
+        {
+            return ZFALSE;
+        }
+        ZInt64 product = (ZInt64)((ZUInt64)a * (ZUInt64)b);
+        if (product / b != a)
+        {
+            return ZFALSE;
+        }
+        *result = product;
+        return INT_FITS(*result);
+    }
+    *result = 0;
+    return ZTRUE;
+#endif
+}
+
+static ZBool intPow(ZInt64 base, ZInt64 exponent, ZInt64 *result)
+{
+    *result = 1;
+    for (ZInt64 i = 0; i < exponent; i++)
+    {
+        if (!intMultiply(*result, base, result))
+        {
+            return ZFALSE;
+        }
+    }
+    return ZTRUE;
 }
 
 static ZBool isInteger(ZReal64 exponent)
@@ -144,56 +403,169 @@ static InterpretResult ziaPow(ZReal64 base, ZReal64 exponent, ZReal64 *result)
     return INTERPRET_OK;
 }
 
-void initVM()
+void initVM(VM *context)
 {
+    vm = context;
+    vm->frames = (CallFrame *)malloc(sizeof(CallFrame) * FRAMES_INITIAL);
+    vm->frameCapacity = FRAMES_INITIAL;
+    vm->stack = (Value *)malloc(sizeof(Value) * STACK_INITIAL);
+    vm->stackCapacity = STACK_INITIAL;
+    if (NULL == vm->frames || NULL == vm->stack)
+    {
+        exit(1);
+    }
     resetStack();
 
-    vm.objects = NULL;
+    vm->young = NULL;
+    vm->youngCount = 0;
+    vm->youngCapacity = 0;
+    vm->youngBytes = 0;
+    vm->minorGC = ZFALSE;
+    vm->gcPhase = GC_IDLE;
+    vm->gcStepBudget = GC_STEP_BUDGET;
+    vm->gcThreads = GC_THREADS;
+    vm->gcInitialHeap = GC_INITIAL_HEAP;
+    vm->gcGrowthFactor = GC_HEAP_GROW_FACTOR;
+    vm->gcSurvival = 1.0;
+    vm->cycleFreedBytes = 0;
+    vm->cycleStartBytes = 0;
+    vm->largeBlocks = NULL;
+    vm->out = stdout;
+    vm->err = stderr;
+    vm->mappedCaches = NULL;
+    vm->markWorkers = NULL;
+    vm->parser = NULL;
+    vm->compiler = NULL;
+#ifdef DEBUG_STRESS_GC
+    vm->stressCount = 0;
+#endif
+    initHeap();
+
+    vm->bytesAllocated = 0;
+    vm->nextGC = vm->gcInitialHeap;
 
-    // TBD: they will be tuned
-    vm.bytesAllocated = 0;
-    vm.nextGC = 1024 * 1024;
+    vm->grayCount = 0;
+    vm->grayCapacity = 0;
+    vm->grayStack = NULL;
 
-    vm.grayCount = 0;
-    vm.grayCapacity = 0;
-    vm.grayStack = NULL;
+    vm->rememberedCount = 0;
+    vm->rememberedCapacity = 0;
+    vm->remembered = NULL;
+    vm->rememberedGlobalCount = 0;
+    vm->rememberedGlobalCapacity = 0;
+    vm->rememberedGlobals = NULL;
+    memset(vm->rememberedGlobalBits, 0, sizeof(vm->rememberedGlobalBits));
 
-    initTable(&vm.globals);
-    initTable(&vm.strings);
+    initTable(&vm->globalSlots);
+    initValueArray(&vm->globalValues);
+    initValueArray(&vm->globalNames);
+    initTable(&vm->strings);
+    initValueArray(&vm->nativeGlobals);
+    vm->programs = NULL;
+    initValueArray(&vm->imageObjects);
 
-    defineNative("temps", clockNative);
+    defineNative(vm, "temps", clockNative);
     // arrondi_inférieur
-    defineNative("plancher", floorNative);
-    defineNative("plafond", ceilNative);
+    defineNative(vm, "plancher", floorNative);
+    defineNative(vm, "plafond", ceilNative);
+    defineNative(vm, "memoire", memoryNative);
 }
 
-void freeVM()
+void freeVM(VM *context)
 {
-    freeTable(&vm.globals);
-    freeTable(&vm.strings);
+    VM *previous = vm;
+    vm = context;
+    freeTable(&vm->globalSlots);
+    freeValueArray(&vm->globalValues);
+    freeValueArray(&vm->globalNames);
+    freeValueArray(&vm->nativeGlobals);
+    freeTable(&vm->strings);
+    // handles the host did not free; their functions go with the heap
+    while (NULL != vm->programs)
+    {
+        Program *program = vm->programs;
+        vm->programs = program->next;
+        free(program);
+    }
     freeObjects();
+    unmapCaches();
+    free(vm->frames);
+    free(vm->stack);
+    vm->frames = NULL;
+    vm->stack = NULL;
+    vm = previous == context ? NULL : previous;
 }
 
-static InterpretResult run()
+#ifdef DEBUG_TRACE_EXECUTION
+static void traceExecution(CallFrame *frame, ZUInt8 *ip)
 {
-    CallFrame *frame = &vm.frames[vm.frameCount - 1];
+    // loop over stack and show its contents:
+    printf("      ");
+    for (Value *slot = vm->stack; slot < vm->stackTop; slot++)
+    {
+        printf("[ ");
+        printValue(*slot);
+        printf(" ]");
+    }
+    printf("\n");
+    disassembleInstruction(&frame->closure->function->chunk, (ZInt32)(ip - frame->closure->function->chunk.code));
+}
+#endif
+
+/*
+@Note: run() and the calls it makes work on the VM they are given rather
+       than on the thread's binding: the thread-local costs a load on every
+       access, a parameter stays in a register. These are push(), pop()
+       and peek() for them.
+*/
+static inline void pushValue(VM *vm, Value value)
+{
+    *vm->stackTop = value;
+    vm->stackTop++;
+}
+
+static inline Value popValue(VM *vm)
+{
+    vm->stackTop--;
+    return *vm->stackTop;
+}
 
-#define READ_BYTE() (*frame->ip++)
+static inline Value peekValue(VM *vm, ZInt32 distance)
+{
+    return vm->stackTop[-1 - distance];
+}
+
+static InterpretResult run(VM *vm)
+{
+#define push(value) pushValue(vm, value)
+#define pop() popValue(vm)
+#define peek(distance) peekValue(vm, distance)
+    CallFrame *frame = &vm->frames[vm->frameCount - 1];
+    /*
+    @Note: ip lives in a local so it can stay in a register; it is written
+           back to frame->ip before anything that reads it (calls, errors).
+    */
+    ZUInt8 *ip = frame->ip;
+
+#define READ_BYTE() (*ip++)
 #define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
 #define READ_SHORT() \
-    (frame->ip += 2, (ZUInt16)((frame->ip[-2] << 8) | frame->ip[-1]))
-#define READ_24BIT()                   \
-    (frame->ip += 3,                   \
-     (ZUInt32)((frame->ip[-3] << 16) | \
-               (frame->ip[-2] << 8) |  \
-               frame->ip[-1]))
+    (ip += 2, (ZUInt16)((ip[-2] << 8) | ip[-1]))
+#define READ_24BIT()            \
+    (ip += 3,                   \
+     (ZUInt32)((ip[-3] << 16) | \
+               (ip[-2] << 8) |  \
+               ip[-1]))
 #define READ_24BIT_OFFSET() READ_24BIT()
+#define READ_32BIT() (ip += 4, readI32(ip - 4))
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+#define GLOBAL_NAME(slot) (AS_STRING(vm->globalNames.values[slot])->chars)
 #define BINARY_OP(valueType, op)                                     \
     do                                                               \
     {                                                                \
         if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1)))              \
         {                                                            \
+            frame->ip = ip;                                          \
             runtimeError("Les opérandes doivent être des nombres."); \
             return INTERPRET_RUNTIME_ERROR;                          \
         }                                                            \
@@ -201,115 +573,316 @@ static InterpretResult run()
         ZReal64 a = AS_NUMBER(pop());                                \
         push(valueType(a op b));                                     \
     } while (ZFALSE)
+#define COMPARE_OP(op)                                               \
+    do                                                               \
+    {                                                                \
+        if (IS_INT(peek(0)) && IS_INT(peek(1)))                      \
+        {                                                            \
+            ZInt64 b = AS_INT(pop());                                \
+            ZInt64 a = AS_INT(pop());                                \
+            push(BOOL_VAL(a op b));                                  \
+            break;                                                   \
+        }                                                            \
+        BINARY_OP(BOOL_VAL, op);                                     \
+    } while (ZFALSE)
+#define ARITH_OP(intOp, op)                                          \
+    do                                                               \
+    {                                                                \
+        ZInt64 result;                                               \
+        if (IS_INT(peek(0)) && IS_INT(peek(1)) &&                    \
+            intOp(AS_INT(peek(1)), AS_INT(peek(0)), &result))        \
+        {                                                            \
+            pop();                                                   \
+            pop();                                                   \
+            push(INT_VAL(result));                                   \
+            break;                                                   \
+        }                                                            \
+        BINARY_OP(NUMBER_VAL, op);                                   \
+    } while (ZFALSE)
+
+/*
+@Note: Bodies of the superinstructions: a and b are the operands already
+       fetched from the stack, a local or the constant pool. Integers and
+       doubles are handled in place; anything else (mixed kinds, strings,
+       errors) is pushed back and handed to the generic handler's label.
+       No do/while here, DISPATCH() is 'continue' in the switch build.
+*/
+#define FUSED_ARITH(intOp, op, a, b, generic)                          \
+    {                                                                \
+        ZInt64 result;                                               \
+        if (IS_INT(a) && IS_INT(b) &&                                \
+            intOp(AS_INT(a), AS_INT(b), &result))                    \
+        {                                                            \
+            push(INT_VAL(result));                                   \
+            DISPATCH();                                              \
+        }                                                            \
+        if (IS_REAL(a) && IS_REAL(b))                                \
+        {                                                            \
+            push(NUMBER_VAL(AS_REAL(a) op AS_REAL(b)));              \
+            DISPATCH();                                              \
+        }                                                            \
+        push(a);                                                     \
+        push(b);                                                     \
+        goto generic;                                                \
+    }
+// compare-and-branch: jump over offset unless 'a op b' holds
+#define BRANCH_UNLESS(op, a, b, offset)                              \
+    {                                                                \
+        ZBool holds;                                                 \
+        if (IS_INT(a) && IS_INT(b))                                  \
+        {                                                            \
+            holds = AS_INT(a) op AS_INT(b);                          \
+        }                                                            \
+        else if (IS_NUMBER(a) && IS_NUMBER(b))                       \
+        {                                                            \
+            holds = AS_NUMBER(a) op AS_NUMBER(b);                    \
+        }                                                            \
+        else                                                         \
+        {                                                            \
+            frame->ip = ip;                                          \
+            runtimeError("Les opérandes doivent être des nombres."); \
+            return INTERPRET_RUNTIME_ERROR;                          \
+        }                                                            \
+        if (!holds)                                                  \
+        {                                                            \
+            ip += offset;                                            \
+        }                                                            \
+        DISPATCH();                                                  \
+    }
+#define FUSED_COMPARE(op, a, b, generic)                             \
+    {                                                                \
+        if (IS_INT(a) && IS_INT(b))                                  \
+        {                                                            \
+            push(BOOL_VAL(AS_INT(a) op AS_INT(b)));                  \
+            DISPATCH();                                              \
+        }                                                            \
+        if (IS_NUMBER(a) && IS_NUMBER(b))                            \
+        {                                                            \
+            push(BOOL_VAL(AS_NUMBER(a) op AS_NUMBER(b)));            \
+            DISPATCH();                                              \
+        }                                                            \
+        push(a);                                                     \
+        push(b);                                                     \
+        goto generic;                                                \
+    }
+
+#ifdef DEBUG_TRACE_EXECUTION
+#define TRACE_INSTRUCTION()                  \
+    do                                       \
+    {                                        \
+        if (ZTRUE == FLAG_TRACE_EXECUTION)   \
+        {                                    \
+            traceExecution(frame, ip);       \
+        }                                    \
+    } while (ZFALSE)
+#else
+#define TRACE_INSTRUCTION() do { } while (ZFALSE)
+#endif
 
+#ifdef PROFILE_OPCODES
+#define PROFILE_INSTRUCTION() profileInstruction(instruction)
+#else
+#define PROFILE_INSTRUCTION() do { } while (ZFALSE)
+#endif
+
+    /*
+    @Note: With COMPUTED_GOTO every handler ends with its own copy of the
+           dispatch (an indirect jump through dispatchTable), so the branch
+           predictor can learn per-opcode successors instead of sharing the
+           single indirect branch of the switch. The switch build stays as
+           the portable fallback.
+    */
+#ifdef COMPUTED_GOTO
+    // Every opcode of the OpCode enum must have an entry here.
+    static void *dispatchTable[] = {
+        [OP_CONSTANT] = &&DO_OP_CONSTANT,
+        [OP_NULL] = &&DO_OP_NULL,
+        [OP_TRUE] = &&DO_OP_TRUE,
+        [OP_FALSE] = &&DO_OP_FALSE,
+        [OP_POP] = &&DO_OP_POP,
+        [OP_GET_GLOBAL] = &&DO_OP_GET_GLOBAL,
+        [OP_SET_GLOBAL] = &&DO_OP_SET_GLOBAL,
+        [OP_GET_LOCAL] = &&DO_OP_GET_LOCAL,
+        [OP_SET_LOCAL] = &&DO_OP_SET_LOCAL,
+        [OP_DEFINE_GLOBAL] = &&DO_OP_DEFINE_GLOBAL,
+        [OP_EQUAL] = &&DO_OP_EQUAL,
+        [OP_GREATER] = &&DO_OP_GREATER,
+        [OP_LESS] = &&DO_OP_LESS,
+        [OP_ADD] = &&DO_OP_ADD,
+        [OP_SUBTRACT] = &&DO_OP_SUBTRACT,
+        [OP_MULTIPLY] = &&DO_OP_MULTIPLY,
+        [OP_DIVIDE] = &&DO_OP_DIVIDE,
+        [OP_MODULO] = &&DO_OP_MODULO,
+        [OP_POWER] = &&DO_OP_POWER,
+        [OP_NOT] = &&DO_OP_NOT,
+        [OP_NEGATE] = &&DO_OP_NEGATE,
+        [OP_INCREMENT] = &&DO_OP_INCREMENT,
+        [OP_DECREMENT] = &&DO_OP_DECREMENT,
+        [OP_DUP] = &&DO_OP_DUP,
+        [OP_PRINT] = &&DO_OP_PRINT,
+        [OP_JUMP] = &&DO_OP_JUMP,
+        [OP_JUMP_IF_FALSE] = &&DO_OP_JUMP_IF_FALSE,
+        [OP_JUMP_IF_TRUE] = &&DO_OP_JUMP_IF_TRUE,
+        [OP_LOOP] = &&DO_OP_LOOP,
+        [OP_SWITCH_TABLE] = &&DO_OP_SWITCH_TABLE,
+        [OP_SWITCH_SEARCH] = &&DO_OP_SWITCH_SEARCH,
+        [OP_SWITCH_STRING] = &&DO_OP_SWITCH_STRING,
+        [OP_SWAP] = &&DO_OP_SWAP,
+        [OP_CALL] = &&DO_OP_CALL,
+        [OP_TAIL_CALL] = &&DO_OP_TAIL_CALL,
+        [OP_CLOSURE] = &&DO_OP_CLOSURE,
+        [OP_GET_UPVALUE] = &&DO_OP_GET_UPVALUE,
+        [OP_SET_UPVALUE] = &&DO_OP_SET_UPVALUE,
+        [OP_CLOSE_UPVALUE] = &&DO_OP_CLOSE_UPVALUE,
+        [OP_RETURN] = &&DO_OP_RETURN,
+        [OP_ADD_CONSTANT] = &&DO_OP_ADD_CONSTANT,
+        [OP_SUBTRACT_CONSTANT] = &&DO_OP_SUBTRACT_CONSTANT,
+        [OP_LESS_CONSTANT] = &&DO_OP_LESS_CONSTANT,
+        [OP_GREATER_CONSTANT] = &&DO_OP_GREATER_CONSTANT,
+        [OP_EQUAL_CONSTANT] = &&DO_OP_EQUAL_CONSTANT,
+        [OP_LOCAL_ADD_CONSTANT] = &&DO_OP_LOCAL_ADD_CONSTANT,
+        [OP_LOCAL_SUBTRACT_CONSTANT] = &&DO_OP_LOCAL_SUBTRACT_CONSTANT,
+        [OP_LOCAL_LESS_CONSTANT] = &&DO_OP_LOCAL_LESS_CONSTANT,
+        [OP_SET_LOCAL_POP] = &&DO_OP_SET_LOCAL_POP,
+        [OP_POP_JUMP_IF_FALSE] = &&DO_OP_POP_JUMP_IF_FALSE,
+        [OP_POP_JUMP_IF_TRUE] = &&DO_OP_POP_JUMP_IF_TRUE,
+        [OP_JUMP_IF_FALSE_OR_POP] = &&DO_OP_JUMP_IF_FALSE_OR_POP,
+        [OP_JUMP_IF_TRUE_OR_POP] = &&DO_OP_JUMP_IF_TRUE_OR_POP,
+        [OP_JUMP_IF_NOT_LESS] = &&DO_OP_JUMP_IF_NOT_LESS,
+        [OP_JUMP_IF_NOT_GREATER] = &&DO_OP_JUMP_IF_NOT_GREATER,
+        [OP_JUMP_IF_NOT_EQUAL] = &&DO_OP_JUMP_IF_NOT_EQUAL,
+        [OP_JUMP_IF_LOCAL_NOT_LESS_CONSTANT] = &&DO_OP_JUMP_IF_LOCAL_NOT_LESS_CONSTANT,
+    };
+
+#define CASE(opcode) DO_##opcode
+#define DISPATCH()                                         \
+    do                                                     \
+    {                                                      \
+        TRACE_INSTRUCTION();                               \
+        instruction = READ_BYTE();                         \
+        PROFILE_INSTRUCTION();                             \
+        goto *dispatchTable[instruction];                  \
+    } while (ZFALSE)
+#else
+#define CASE(opcode) case opcode
+#define DISPATCH() continue
+#endif
+
+    ZUInt8 instruction;
     for (;;)
     {
-#ifdef DEBUG_TRACE_EXECUTION
-        if (ZTRUE == FLAG_TRACE_EXECUTION)
-        {
-            // loop over stack and show its contents:
-            printf("      ");
-            for (Value *slot = vm.stack; slot < vm.stackTop; slot++)
-            {
-                printf("[ ");
-                printValue(*slot);
-                printf(" ]");
-            }
-            printf("\n");
-            disassembleInstruction(&frame->closure->function->chunk, (ZInt32)(frame->ip - frame->closure->function->chunk.code));
-        }
+#ifdef COMPUTED_GOTO
+        DISPATCH();
+#else
+        TRACE_INSTRUCTION();
+        instruction = READ_BYTE();
+        PROFILE_INSTRUCTION();
+        switch (instruction)
 #endif
-        ZUInt8 instruction;
-        switch (instruction = READ_BYTE())
         {
-        case OP_CONSTANT:
+        CASE(OP_CONSTANT):
         {
             Value constant = READ_CONSTANT();
             push(constant);
-            break;
+            DISPATCH();
         }
-        case OP_NULL:
+        CASE(OP_NULL):
         {
             push(NUL_VAL);
-            break;
+            DISPATCH();
         }
-        case OP_TRUE:
+        CASE(OP_TRUE):
         {
             push(BOOL_VAL(true));
-            break;
+            DISPATCH();
         }
-        case OP_FALSE:
+        CASE(OP_FALSE):
         {
             push(BOOL_VAL(false));
-            break;
+            DISPATCH();
         }
-        case OP_POP:
+        CASE(OP_POP):
         {
             pop();
-            break;
+            DISPATCH();
         }
-        case OP_GET_LOCAL:
+        CASE(OP_GET_LOCAL):
         {
             ZUInt8 slot = READ_BYTE();
             push(frame->slots[slot]);
-            break;
+            DISPATCH();
         }
-        case OP_SET_LOCAL:
+        CASE(OP_SET_LOCAL):
         {
             ZUInt8 slot = READ_BYTE();
             frame->slots[slot] = peek(0);
-            break;
+            DISPATCH();
         }
-        case OP_SET_GLOBAL:
+        CASE(OP_SET_GLOBAL):
         {
-            ObjString *name = READ_STRING();
-            if (tableSet(&vm.globals, name, peek(0)))
+            ZUInt16 slot = READ_SHORT();
+            if (IS_UNDEFINED(vm->globalValues.values[slot]))
             {
-                tableDelete(&vm.globals, name);
-                runtimeError("Variable '%s' non définie.", name->chars);
+                frame->ip = ip;
+                runtimeError("Variable '%s' non définie.", GLOBAL_NAME(slot));
                 return INTERPRET_RUNTIME_ERROR;
             }
-            break;
+            vm->globalValues.values[slot] = peek(0);
+            globalWriteBarrier(slot, peek(0));
+            DISPATCH();
         }
-        case OP_GET_GLOBAL:
+        CASE(OP_GET_GLOBAL):
         {
-            ObjString *name = READ_STRING();
-            Value value;
-            if (!tableGet(&vm.globals, name, &value))
+            ZUInt16 slot = READ_SHORT();
+            Value value = vm->globalValues.values[slot];
+            if (IS_UNDEFINED(value))
             {
-                runtimeError("Variable '%s' non définie.", name->chars);
+                frame->ip = ip;
+                runtimeError("Variable '%s' non définie.", GLOBAL_NAME(slot));
                 return INTERPRET_RUNTIME_ERROR;
             }
             push(value);
-            break;
+            DISPATCH();
         }
-        case OP_DEFINE_GLOBAL:
+        CASE(OP_DEFINE_GLOBAL):
         {
-            ObjString *name = READ_STRING();
-            tableSet(&vm.globals, name, peek(0));
+            ZUInt16 slot = READ_SHORT();
+            vm->globalValues.values[slot] = peek(0);
+            globalWriteBarrier(slot, peek(0));
             pop();
-            break;
+            DISPATCH();
         }
-        case OP_EQUAL:
+        CASE(OP_EQUAL):
         {
             Value b = pop();
             Value a = pop();
             push(BOOL_VAL(valuesEqual(a, b)));
-            break;
+            DISPATCH();
         }
-        case OP_GREATER:
+        CASE(OP_GREATER):
+        greaterValues:
         {
-            BINARY_OP(BOOL_VAL, >);
-            break;
+            COMPARE_OP(>);
+            DISPATCH();
         }
-        case OP_LESS:
+        CASE(OP_LESS):
+        lessValues:
         {
-            BINARY_OP(BOOL_VAL, <);
-            break;
+            COMPARE_OP(<);
+            DISPATCH();
         }
-        case OP_ADD:
+        CASE(OP_ADD):
+        addValues:
         {
-            if (IS_STRING(peek(0)) && IS_STRING(peek(1)))
+            ZInt64 sum;
+            if (IS_INT(peek(0)) && IS_INT(peek(1)) &&
+                intAdd(AS_INT(peek(1)), AS_INT(peek(0)), &sum))
+            {
+                pop();
+                pop();
+                push(INT_VAL(sum));
+            }
+            else if (IS_STRING(peek(0)) && IS_STRING(peek(1)))
             {
                 concatenate();
             }
@@ -321,112 +894,154 @@ static InterpretResult run()
             }
             else
             {
+                frame->ip = ip;
                 runtimeError(
                     "Les opérandes doivent être deux nombres ou deux chaînes.");
                 return INTERPRET_RUNTIME_ERROR;
             }
-            break;
+            DISPATCH();
         }
-        case OP_SUBTRACT:
+        CASE(OP_SUBTRACT):
+        subtractValues:
         {
-            BINARY_OP(NUMBER_VAL, -);
-            break;
+            ARITH_OP(intSubtract, -);
+            DISPATCH();
         }
-        case OP_MULTIPLY:
+        CASE(OP_MULTIPLY):
         {
-            BINARY_OP(NUMBER_VAL, *);
-            break;
+            ARITH_OP(intMultiply, *);
+            DISPATCH();
         }
-        case OP_DIVIDE:
+        CASE(OP_DIVIDE):
         {
+            // division always yields a double, 7 / 2 is 3.5
             BINARY_OP(NUMBER_VAL, /);
-            break;
+            DISPATCH();
         }
-        case OP_NOT:
+        CASE(OP_NOT):
         {
             push(BOOL_VAL(isFalsey(pop())));
-            break;
+            DISPATCH();
         }
-        case OP_NEGATE:
+        CASE(OP_NEGATE):
         {
             if (!IS_NUMBER(peek(0)))
             {
+                frame->ip = ip;
                 runtimeError("L'opérande doit être un nombre.");
                 return INTERPRET_RUNTIME_ERROR;
             }
 
+            // -0 has no integer form, so zero is negated as a double, and so is the
+            // smallest integer, whose opposite does not fit
+            if (IS_INT(peek(0)) && AS_INT(peek(0)) != 0 && AS_INT(peek(0)) != ZINT_MIN &&
+                INT_FITS(-AS_INT(peek(0))))
+            {
+                push(INT_VAL(-AS_INT(pop())));
+                DISPATCH();
+            }
+
             push(NUMBER_VAL(-AS_NUMBER(pop())));
-            break;
+            DISPATCH();
         }
-        case OP_PRINT:
+        CASE(OP_PRINT):
         {
-            printValue(pop());
-            break;
+            fprintValue(vm->out, pop());
+            DISPATCH();
         }
-        case OP_JUMP:
+        CASE(OP_JUMP):
         {
-            ZUInt16 offset = READ_24BIT_OFFSET();
-            frame->ip += offset;
-            break;
+            ZUInt32 offset = READ_24BIT_OFFSET();
+            ip += offset;
+            DISPATCH();
         }
-        case OP_JUMP_IF_FALSE:
+        CASE(OP_JUMP_IF_FALSE):
         {
-            ZUInt16 offset = READ_24BIT_OFFSET();
+            ZUInt32 offset = READ_24BIT_OFFSET();
             if (isFalsey(peek(0)))
             {
-                frame->ip += offset;
+                ip += offset;
             }
-            break;
+            DISPATCH();
         }
-        case OP_JUMP_IF_TRUE:
+        CASE(OP_JUMP_IF_TRUE):
         {
-            ZUInt16 offset = READ_24BIT_OFFSET();
+            ZUInt32 offset = READ_24BIT_OFFSET();
             if (!isFalsey(peek(0)))
             {
-                frame->ip += offset;
+                ip += offset;
             }
-            break;
+            DISPATCH();
         }
-        case OP_LOOP:
+        CASE(OP_LOOP):
         {
-            ZUInt16 offset = READ_24BIT_OFFSET();
-            frame->ip -= offset;
-            break;
+            ZUInt32 offset = READ_24BIT_OFFSET();
+            ip -= offset;
+            DISPATCH();
         }
-        case OP_MODULO:
+        CASE(OP_MODULO):
         {
             if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1)))
             {
+                frame->ip = ip;
                 runtimeError("Les opérandes doivent être des nombres.");
                 return INTERPRET_RUNTIME_ERROR;
             }
+            if (IS_INT(peek(0)) && IS_INT(peek(1)))
+            {
+                ZInt64 b = AS_INT(pop());
+                ZInt64 a = AS_INT(pop());
+                if (b == 0)
+                {
+                    frame->ip = ip;
+                    runtimeError("Division par zéro.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                // INT64_MIN % -1 traps on x86, and the result is 0 anyway
+                push(INT_VAL(b == -1 ? 0 : a % b));
+                DISPATCH();
+            }
             ZReal64 b = AS_NUMBER(pop());
             ZReal64 a = AS_NUMBER(pop());
             if (b == 0)
             {
+                frame->ip = ip;
                 runtimeError("Division par zéro.");
                 return INTERPRET_RUNTIME_ERROR;
             }
             push(NUMBER_VAL(ziaFmod(a, b)));
-            break;
+            DISPATCH();
         }
-        case OP_POWER:
+        CASE(OP_POWER):
         {
             if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1)))
             {
+                frame->ip = ip;
                 runtimeError("Les opérandes doivent être des nombres.");
                 return INTERPRET_RUNTIME_ERROR;
             }
+            ZInt64 power;
+            if (IS_INT(peek(0)) && IS_INT(peek(1)) &&
+                AS_INT(peek(0)) >= 0 && AS_INT(peek(0)) <= INT32_MAX &&
+                intPow(AS_INT(peek(1)), AS_INT(peek(0)), &power))
+            {
+                pop();
+                pop();
+                push(INT_VAL(power));
+                DISPATCH();
+            }
             ZReal64 exponent = AS_NUMBER(pop());
             ZReal64 base = AS_NUMBER(pop());
 
             if (!isInteger(exponent))
             {
+                frame->ip = ip;
                 runtimeError("L'exposant doit être un entier.");
                 return INTERPRET_RUNTIME_ERROR;
             }
 
             ZReal64 result = 1;
+            frame->ip = ip;
             InterpretResult retCode = ziaPow(base, exponent, &result);
             if (INTERPRET_RUNTIME_ERROR == retCode)
             {
@@ -434,61 +1049,194 @@ static InterpretResult run()
             }
 
             push(NUMBER_VAL(result));
-            break;
+            DISPATCH();
         }
-        case OP_DUP:
+        CASE(OP_DUP):
         {
             push(peek(0));
-            break;
+            DISPATCH();
         }
-        case OP_INCREMENT:
+        CASE(OP_INCREMENT):
         {
             if (!IS_NUMBER(peek(0)))
             {
+                frame->ip = ip;
                 runtimeError("L'opérande doit être un nombre.");
                 return INTERPRET_RUNTIME_ERROR;
             }
 
+            ZInt64 next;
+            if (IS_INT(peek(0)) && intAdd(AS_INT(peek(0)), 1, &next))
+            {
+                pop();
+                push(INT_VAL(next));
+                DISPATCH();
+            }
+
             push(NUMBER_VAL(AS_NUMBER(pop()) + 1));
-            break;
+            DISPATCH();
         }
-        case OP_DECREMENT:
+        CASE(OP_DECREMENT):
         {
             if (!IS_NUMBER(peek(0)))
             {
+                frame->ip = ip;
                 runtimeError("L'opérande doit être un nombre.");
                 return INTERPRET_RUNTIME_ERROR;
             }
 
+            ZInt64 previous;
+            if (IS_INT(peek(0)) && intSubtract(AS_INT(peek(0)), 1, &previous))
+            {
+                pop();
+                push(INT_VAL(previous));
+                DISPATCH();
+            }
+
             push(NUMBER_VAL(AS_NUMBER(pop()) - 1));
-            break;
+            DISPATCH();
+        }
+        CASE(OP_SWITCH_TABLE):
+        {
+            ZInt32 low = READ_32BIT();
+            ZUInt16 count = READ_SHORT();
+            ZUInt32 target = READ_24BIT();
+            ZInt64 key;
+            if (switchKey(peek(0), &key) && key >= low && key - low < count)
+            {
+                target = readU24(ip + 3 * (key - low));
+            }
+            ip = frame->closure->function->chunk.code + target;
+            DISPATCH();
         }
-        case OP_SWITCH:
-        case OP_CASE:
-        case OP_DEFAULT:
+        CASE(OP_SWITCH_SEARCH):
         {
-            runtimeError("Unsupported legacy switch opcode");
-            return INTERPRET_RUNTIME_ERROR;
+            ZUInt16 count = READ_SHORT();
+            ZUInt32 target = READ_24BIT();
+            ZInt64 key;
+            if (switchKey(peek(0), &key))
+            {
+                // entries are (i32 label, u24 target), sorted by label
+                ZInt32 lo = 0, hi = count - 1;
+                while (lo <= hi)
+                {
+                    ZInt32 mid = lo + (hi - lo) / 2;
+                    ZInt32 label = readI32(ip + 7 * mid);
+                    if (label == key)
+                    {
+                        target = readU24(ip + 7 * mid + 4);
+                        break;
+                    }
+                    if (label < key)
+                    {
+                        lo = mid + 1;
+                    }
+                    else
+                    {
+                        hi = mid - 1;
+                    }
+                }
+            }
+            ip = frame->closure->function->chunk.code + target;
+            DISPATCH();
+        }
+        CASE(OP_SWITCH_STRING):
+        {
+            ZUInt16 count = READ_SHORT();
+            ZUInt32 target = READ_24BIT();
+            // labels are interned, a string with no interned twin matches none of them
+            ObjString *string = IS_STRING(peek(0)) ? findInterned(AS_STRING(peek(0))) : NULL;
+            if (NULL != string)
+            {
+                // entries are (u16 constant, u24 target), sorted by string hash;
+                // interned strings are equal only when they are the same object
+                Value *constants = frame->closure->function->chunk.constants.values;
+                ZInt32 lo = 0, hi = count;
+                while (lo < hi)
+                {
+                    ZInt32 mid = lo + (hi - lo) / 2;
+                    if (AS_STRING(constants[(ip[5 * mid] << 8) | ip[5 * mid + 1]])->hash < string->hash)
+                    {
+                        lo = mid + 1;
+                    }
+                    else
+                    {
+                        hi = mid;
+                    }
+                }
+                for (; lo < count; lo++)
+                {
+                    ObjString *label = AS_STRING(constants[(ip[5 * lo] << 8) | ip[5 * lo + 1]]);
+                    if (label->hash != string->hash)
+                    {
+                        break;
+                    }
+                    if (label == string)
+                    {
+                        target = readU24(ip + 5 * lo + 2);
+                        break;
+                    }
+                }
+            }
+            ip = frame->closure->function->chunk.code + target;
+            DISPATCH();
         }
-        case OP_SWAP:
+        CASE(OP_SWAP):
         {
             Value a = pop();
             Value b = pop();
             push(a);
             push(b);
-            break;
+            DISPATCH();
         }
-        case OP_CALL:
+        CASE(OP_CALL):
         {
             ZInt32 argCount = READ_BYTE();
-            if (!callValue(peek(argCount), argCount))
+            frame->ip = ip;
+            if (!callValue(vm, peek(argCount), argCount))
             {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            frame = &vm.frames[vm.frameCount - 1];
-            break;
+            frame = &vm->frames[vm->frameCount - 1];
+            ip = frame->ip;
+            DISPATCH();
         }
-        case OP_CLOSURE:
+        CASE(OP_TAIL_CALL):
+        {
+            /*
+            @Note: 'retourner f(...)' replaces the current frame instead of
+                   pushing a new one: upvalues over the old window are closed,
+                   then the callee and its arguments slide down to slot 0.
+                   Natives and arity errors go through the regular call path.
+            */
+            ZInt32 argCount = READ_BYTE();
+            Value callee = peek(argCount);
+            if (IS_CLOSURE(callee) && AS_CLOSURE(callee)->function->arity == argCount)
+            {
+                if (!reserveStack(vm, frame->slots, AS_CLOSURE(callee)->function))
+                {
+                    frame->ip = ip;
+                    runtimeError("Stack Overflow");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                closeUpvalues(vm, frame->slots);
+                memmove(frame->slots, vm->stackTop - argCount - 1, sizeof(Value) * (argCount + 1));
+                vm->stackTop = frame->slots + argCount + 1;
+                frame->closure = AS_CLOSURE(callee);
+                ip = frame->closure->function->chunk.code;
+                DISPATCH();
+            }
+
+            frame->ip = ip;
+            if (!callValue(vm, callee, argCount))
+            {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            frame = &vm->frames[vm->frameCount - 1];
+            ip = frame->ip;
+            DISPATCH();
+        }
+        CASE(OP_CLOSURE):
         {
             ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
             ObjClosure *closure = newClosure(function);
@@ -505,92 +1253,269 @@ static InterpretResult run()
                 {
                     closure->upvalues[i] = frame->closure->upvalues[index];
                 }
+                // capturing may have collected, and promoted, the closure
+                writeBarrier((Obj *)closure, OBJ_VAL(closure->upvalues[i]));
             }
 
-            break;
+            DISPATCH();
         }
-        case OP_GET_UPVALUE:
+        CASE(OP_GET_UPVALUE):
         {
             ZUInt8 slot = READ_BYTE();
             push(*frame->closure->upvalues[slot]->location);
-            break;
+            DISPATCH();
         }
-        case OP_SET_UPVALUE:
+        CASE(OP_SET_UPVALUE):
         {
             ZUInt8 slot = READ_BYTE();
-            *frame->closure->upvalues[slot]->location = peek(0);
-            break;
+            ObjUpvalue *upvalue = frame->closure->upvalues[slot];
+            *upvalue->location = peek(0);
+            if (upvalue->location == &upvalue->closed)
+            {
+                writeBarrier((Obj *)upvalue, upvalue->closed);
+            }
+            DISPATCH();
         }
-        case OP_CLOSE_UPVALUE:
+        CASE(OP_CLOSE_UPVALUE):
         {
-            closeUpvalues(vm.stackTop - 1);
+            closeUpvalues(vm, vm->stackTop - 1);
             pop();
-            break;
+            DISPATCH();
         }
-        case OP_RETURN:
+        CASE(OP_RETURN):
         {
             Value result = pop();
-            closeUpvalues(frame->slots);
-            vm.frameCount--;
-            if (vm.frameCount == 0)
+            closeUpvalues(vm, frame->slots);
+            vm->frameCount--;
+            if (vm->frameCount == 0)
             {
                 pop();
                 return INTERPRET_OK;
             }
 
-            vm.stackTop = frame->slots;
+            vm->stackTop = frame->slots;
             push(result);
-            frame = &vm.frames[vm.frameCount - 1];
-            break;
+            frame = &vm->frames[vm->frameCount - 1];
+            ip = frame->ip;
+            DISPATCH();
+        }
+        CASE(OP_ADD_CONSTANT):
+        {
+            Value b = READ_CONSTANT();
+            Value a = pop();
+            FUSED_ARITH(intAdd, +, a, b, addValues);
+        }
+        CASE(OP_SUBTRACT_CONSTANT):
+        {
+            Value b = READ_CONSTANT();
+            Value a = pop();
+            FUSED_ARITH(intSubtract, -, a, b, subtractValues);
+        }
+        CASE(OP_LESS_CONSTANT):
+        {
+            Value b = READ_CONSTANT();
+            Value a = pop();
+            FUSED_COMPARE(<, a, b, lessValues);
+        }
+        CASE(OP_GREATER_CONSTANT):
+        {
+            Value b = READ_CONSTANT();
+            Value a = pop();
+            FUSED_COMPARE(>, a, b, greaterValues);
+        }
+        CASE(OP_EQUAL_CONSTANT):
+        {
+            Value b = READ_CONSTANT();
+            Value a = pop();
+            push(BOOL_VAL(valuesEqual(a, b)));
+            DISPATCH();
+        }
+        CASE(OP_LOCAL_ADD_CONSTANT):
+        {
+            Value a = frame->slots[READ_BYTE()];
+            Value b = READ_CONSTANT();
+            FUSED_ARITH(intAdd, +, a, b, addValues);
+        }
+        CASE(OP_LOCAL_SUBTRACT_CONSTANT):
+        {
+            Value a = frame->slots[READ_BYTE()];
+            Value b = READ_CONSTANT();
+            FUSED_ARITH(intSubtract, -, a, b, subtractValues);
+        }
+        CASE(OP_LOCAL_LESS_CONSTANT):
+        {
+            Value a = frame->slots[READ_BYTE()];
+            Value b = READ_CONSTANT();
+            FUSED_COMPARE(<, a, b, lessValues);
+        }
+        CASE(OP_SET_LOCAL_POP):
+        {
+            ZUInt8 slot = READ_BYTE();
+            frame->slots[slot] = pop();
+            DISPATCH();
+        }
+        CASE(OP_POP_JUMP_IF_FALSE):
+        {
+            ZUInt32 offset = READ_24BIT_OFFSET();
+            if (isFalsey(pop()))
+            {
+                ip += offset;
+            }
+            DISPATCH();
+        }
+        CASE(OP_POP_JUMP_IF_TRUE):
+        {
+            ZUInt32 offset = READ_24BIT_OFFSET();
+            if (!isFalsey(pop()))
+            {
+                ip += offset;
+            }
+            DISPATCH();
+        }
+        CASE(OP_JUMP_IF_FALSE_OR_POP):
+        {
+            ZUInt32 offset = READ_24BIT_OFFSET();
+            if (isFalsey(peek(0)))
+            {
+                ip += offset;
+            }
+            else
+            {
+                pop();
+            }
+            DISPATCH();
+        }
+        CASE(OP_JUMP_IF_TRUE_OR_POP):
+        {
+            ZUInt32 offset = READ_24BIT_OFFSET();
+            if (!isFalsey(peek(0)))
+            {
+                ip += offset;
+            }
+            else
+            {
+                pop();
+            }
+            DISPATCH();
+        }
+        CASE(OP_JUMP_IF_NOT_LESS):
+        {
+            Value b = pop();
+            Value a = pop();
+            ZUInt32 offset = READ_24BIT_OFFSET();
+            BRANCH_UNLESS(<, a, b, offset);
+        }
+        CASE(OP_JUMP_IF_NOT_GREATER):
+        {
+            Value b = pop();
+            Value a = pop();
+            ZUInt32 offset = READ_24BIT_OFFSET();
+            BRANCH_UNLESS(>, a, b, offset);
+        }
+        CASE(OP_JUMP_IF_NOT_EQUAL):
+        {
+            Value b = pop();
+            Value a = pop();
+            ZUInt32 offset = READ_24BIT_OFFSET();
+            if (!valuesEqual(a, b))
+            {
+                ip += offset;
+            }
+            DISPATCH();
+        }
+        CASE(OP_JUMP_IF_LOCAL_NOT_LESS_CONSTANT):
+        {
+            Value a = frame->slots[READ_BYTE()];
+            Value b = READ_CONSTANT();
+            ZUInt32 offset = READ_24BIT_OFFSET();
+            BRANCH_UNLESS(<, a, b, offset);
         }
+#ifndef COMPUTED_GOTO
         default:
-            break;
+            DISPATCH();
+#endif
         }
     }
 #undef READ_BYTE
 #undef READ_CONSTANT
 #undef READ_SHORT
 #undef READ_STRING
+#undef GLOBAL_NAME
 #undef BINARY_OP
+#undef COMPARE_OP
+#undef ARITH_OP
+#undef FUSED_ARITH
+#undef FUSED_COMPARE
+#undef BRANCH_UNLESS
 #undef READ_24BIT
 #undef READ_24BIT_OFFSET
+#undef READ_32BIT
+#undef TRACE_INSTRUCTION
+#undef PROFILE_INSTRUCTION
+#undef CASE
+#undef DISPATCH
+#undef push
+#undef pop
+#undef peek
 }
 
-InterpretResult interpret(const ZChar *source)
+InterpretResult interpret(VM *context, const ZChar *source)
 {
-    ObjFunction *function = compile(source);
+    ObjFunction *function = compile(context, source);
     if (NULL == function)
     {
         return INTERPRET_COMPILE_ERROR;
     }
+    return interpretFunction(context, function);
+}
 
+// runs a script compiled beforehand, e.g. loaded from its .ziac cache
+InterpretResult interpretFunction(VM *context, ObjFunction *function)
+{
+    VM *previous = vm;
+    vm = context;
     push(OBJ_VAL(function));
     ObjClosure *closure = newClosure(function);
     pop();
+    vm = previous;
+    return interpretClosure(context, closure);
+}
+
+// runs a closure that takes no arguments, e.g. the entry function of an image
+InterpretResult interpretClosure(VM *context, ObjClosure *closure)
+{
+    VM *previous = vm;
+    vm = context;
     push(OBJ_VAL(closure));
-    call(closure, 0);
+    if (!call(vm, closure, 0))
+    {
+        vm = previous;
+        return INTERPRET_RUNTIME_ERROR;
+    }
 
-    return run();
+    InterpretResult result = run(vm);
+    vm = previous;
+    return result;
 }
 
 void push(Value value)
 {
-    *vm.stackTop = value;
-    vm.stackTop++;
+    *vm->stackTop = value;
+    vm->stackTop++;
 }
 
 Value pop()
 {
-    vm.stackTop--;
-    return *vm.stackTop;
+    vm->stackTop--;
+    return *vm->stackTop;
 }
 
 static Value peek(ZInt32 distance)
 {
-    return vm.stackTop[-1 - distance];
+    return vm->stackTop[-1 - distance];
 }
 
-static ZBool call(ObjClosure *closure, ZInt32 argCount)
+static ZBool call(VM *vm, ObjClosure *closure, ZInt32 argCount)
 {
     if (argCount != closure->function->arity)
     {
@@ -598,32 +1523,33 @@ static ZBool call(ObjClosure *closure, ZInt32 argCount)
         return ZFALSE;
     }
 
-    if (vm.frameCount == FRAMES_MAX)
+    if ((vm->frameCount == vm->frameCapacity && !growFrames()) ||
+        !reserveStack(vm, vm->stackTop - argCount - 1, closure->function))
     {
         runtimeError("Stack Overflow");
         return ZFALSE;
     }
 
-    CallFrame *frame = &vm.frames[vm.frameCount++];
+    CallFrame *frame = &vm->frames[vm->frameCount++];
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
-    frame->slots = vm.stackTop - argCount - 1;
+    frame->slots = vm->stackTop - argCount - 1;
     return ZTRUE;
 }
 
-static ZBool callValue(Value callee, ZInt32 argCount)
+static ZBool callValue(VM *vm, Value callee, ZInt32 argCount)
 {
     if (IS_OBJ(callee))
     {
         switch (OBJ_TYPE(callee))
         {
         case OBJ_CLOSURE:
-            return call(AS_CLOSURE(callee), argCount);
+            return call(vm, AS_CLOSURE(callee), argCount);
         case OBJ_NATIVE:
         {
             NativeFn native = AS_NATIVE(callee);
-            Value result = native(argCount, vm.stackTop - argCount);
-            vm.stackTop -= argCount + 1;
+            Value result = native(vm, argCount, vm->stackTop - argCount);
+            vm->stackTop -= argCount + 1;
             push(result);
             return ZTRUE;
         }
@@ -640,7 +1566,7 @@ static ZBool callValue(Value callee, ZInt32 argCount)
 static ObjUpvalue *captureUpvalue(Value *local)
 {
     ObjUpvalue *prevUpvalue = NULL;
-    ObjUpvalue *upvalue = vm.openUpvalues;
+    ObjUpvalue *upvalue = vm->openUpvalues;
 
     while (NULL != upvalue && upvalue->location > local)
     {
@@ -658,7 +1584,7 @@ static ObjUpvalue *captureUpvalue(Value *local)
 
     if (NULL == prevUpvalue)
     {
-        vm.openUpvalues = createdUpvalue;
+        vm->openUpvalues = createdUpvalue;
     }
     else
     {
@@ -668,14 +1594,15 @@ static ObjUpvalue *captureUpvalue(Value *local)
     return createdUpvalue;
 }
 
-static void closeUpvalues(Value *last)
+static void closeUpvalues(VM *vm, Value *last)
 {
-    while (NULL != vm.openUpvalues && vm.openUpvalues->location >= last)
+    while (NULL != vm->openUpvalues && vm->openUpvalues->location >= last)
     {
-        ObjUpvalue *upvalue = vm.openUpvalues;
+        ObjUpvalue *upvalue = vm->openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
-        vm.openUpvalues = upvalue->next;
+        writeBarrier((Obj *)upvalue, upvalue->closed);
+        vm->openUpvalues = upvalue->next;
     }
 }
 
@@ -689,13 +1616,8 @@ static void concatenate()
     ObjString *b = AS_STRING(peek(0));
     ObjString *a = AS_STRING(peek(1));
 
-    ZInt32 length = a->length + b->length;
-    ZChar *chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy((chars + a->length), b->chars, b->length);
-    chars[length] = NULL_CHAR;
-
-    ObjString *result = takeString(chars, length);
+    // both operands stay on the stack while the result is allocated
+    ObjString *result = concatStrings(a, b);
     pop();
     pop();
 
@@ -6,9 +6,70 @@
 #include "chunk/chunk.h"
 #include "table/table.h"
 #include "object/object.h"
+#include "memory/allocator.h"
 
-#define FRAMES_MAX  64
-#define STACK_MAX   (FRAMES_MAX * UINT8_COUNT)
+/*
+@Note: The value stack and the frame array start small and grow on demand
+       up to these limits; going past either one is a "Stack Overflow".
+       Both can be set at build time, e.g. make build FLAGS="-DFRAMES_MAX=1000".
+*/
+#ifndef FRAMES_MAX
+#define FRAMES_MAX  (1 << 16)
+#endif
+#ifndef STACK_MAX
+#define STACK_MAX   (1 << 22)
+#endif
+#define FRAMES_INITIAL 8
+#define STACK_INITIAL  (2 * UINT8_COUNT)
+#define STACK_RESERVE  16  // room above each frame for the values the runtime pushes, e.g. a new string
+#define GLOBALS_MAX (UINT16_MAX + 1)  // global slots are addressed with a 16-bit operand
+
+// objects a full collection blackens per allocation, 0 to mark all at once
+#ifndef GC_STEP_BUDGET
+#define GC_STEP_BUDGET 100
+#endif
+
+/*
+@Note: Pacing of full collections. The first one starts once the heap
+       reaches GC_INITIAL_HEAP bytes; after each one, the next threshold is
+       the share of the heap that survived the last cycle times
+       GC_HEAP_GROW_FACTOR, never below GC_INITIAL_HEAP. Both can be set at
+       run time: ZIA_GC_HEAP / --gc-heap and ZIA_GC_GROWTH / --gc-growth.
+*/
+#ifndef GC_INITIAL_HEAP
+#define GC_INITIAL_HEAP (1024 * 1024)
+#endif
+#ifndef GC_HEAP_GROW_FACTOR
+#define GC_HEAP_GROW_FACTOR 2.0
+#endif
+
+// threads tracing the heap in a collection, 1 to keep it on the program's thread
+#ifndef GC_THREADS
+#define GC_THREADS 1
+#endif
+
+typedef enum
+{
+    GC_IDLE,    // no full collection in progress
+    GC_MARK,    // tracing the gray objects a few at a time
+}GcPhase;
+
+#define GC_PAUSE_BUCKETS 16  // pause histogram: bucket n counts pauses below 2^n microseconds
+
+// collector telemetry, see printGcStats() and the 'memoire' native
+typedef struct
+{
+    ZInt64 minorCollections;
+    ZInt64 fullCollections;
+    size_t bytesAllocated;    // all bytes ever allocated
+    size_t bytesFreed;        // bytes the collector reclaimed
+    size_t peakHeap;
+    ZInt64 pauseCount;        // slices of collector work the program waited for
+    ZInt64 pauseNanos;
+    ZInt64 maxPauseNanos;
+    ZInt64 pauses[GC_PAUSE_BUCKETS];
+    ZInt64 startNanos;
+}GcStats;
 
 typedef struct
 {
@@ -17,21 +78,69 @@ typedef struct
     Value* slots;
 }CallFrame;
 
-typedef struct
+// a script compiled once and run any number of times, see embed/embed.h
+typedef struct Program
+{
+    ObjFunction* function;
+    struct Program* previous;
+    struct Program* next;
+}Program;
+
+typedef struct VM
 {
-   CallFrame frames[FRAMES_MAX];
+   CallFrame* frames;
    ZInt32 frameCount;
-   Value stack[STACK_MAX];
+   ZInt32 frameCapacity;
+   Value* stack;
    Value* stackTop;
+   ZInt32 stackCapacity;
    Table strings;
-   Table globals;
+   Table globalSlots;        // global name -> index into globalValues
+   ValueArray globalValues;  // dense global storage, UNDEFINED_VAL until defined
+   ValueArray globalNames;   // name of each slot, for error messages and the disassembler
+   ValueArray nativeGlobals; // slot and value of each native, in pairs
+   Program* programs;        // compiled programs, roots until they are freed
+   ValueArray imageObjects;  // objects of the image being loaded, by number, see image/image.h
    ObjUpvalue* openUpvalues;
    size_t bytesAllocated;
    size_t nextGC;
-   Obj* objects;
+   size_t gcInitialHeap;     // see GC_INITIAL_HEAP
+   ZReal64 gcGrowthFactor;   // see GC_HEAP_GROW_FACTOR
+   ZReal64 gcSurvival;       // share of the heap the last finished cycle kept
+   size_t nurserySize;       // bytes allocated between two minor collections
+   size_t cycleFreedBytes;   // bytes the current cycle has swept so far
+   GcStats gcStats;
+   Obj** young;              // nursery: objects allocated since the last collection
+   ZInt32 youngCount;
+   ZInt32 youngCapacity;
+   size_t youngBytes;        // bytes allocated since the last collection
+   ZBool minorGC;            // the collection in progress only collects the nursery
+   GcPhase gcPhase;          // progress of the incremental full collection
+   ZInt32 gcStepBudget;      // see GC_STEP_BUDGET
+   ZInt32 gcThreads;         // see GC_THREADS
+   size_t cycleStartBytes;
    ZInt32 grayCount;
    ZInt32 grayCapacity;
    Obj** grayStack;
+   ZInt32 rememberedCount;   // old objects that may point to young ones
+   ZInt32 rememberedCapacity;
+   Obj** remembered;
+   ZInt32 rememberedGlobalCount; // global slots that may hold young objects
+   ZInt32 rememberedGlobalCapacity;
+   ZInt32* rememberedGlobals;
+   ZUInt64 rememberedGlobalBits[GLOBALS_MAX / 64];
+   Pool bufferPools[POOL_SIZE_CLASSES];  // small buffers, by size class
+   Pool objectPools[OBJECT_POOLS];       // heap objects, by type and strings by size
+   LargeBlock* largeBlocks;              // blocks too large for the pools
+   FILE* out;                // where 'afficher' writes, stdout by default
+   FILE* err;                // compile and runtime errors, stderr by default
+   struct MappedCache* mappedCaches;     // .ziac and .ziai files the loaded chunks point into
+   struct MarkWorkers* markWorkers;      // helper threads of the parallel mark, started lazily
+   struct Parser* parser;                // state of the compile() in progress, NULL otherwise
+   struct Compiler* compiler;            // innermost function being compiled
+#ifdef DEBUG_STRESS_GC
+   ZInt32 stressCount;
+#endif
 }VM;
 
 typedef enum
@@ -41,11 +150,24 @@ typedef enum
     INTERPRET_RUNTIME_ERROR,
 }InterpretResult;
 
-extern VM vm;
+/*
+@Note: Each VM owns all of its state: heap, globals, interned strings and
+       the compiler in progress. The entry points below take the VM to
+       work on and bind it to the calling thread while they run; the code
+       underneath reaches it through 'vm', which is thread-local, so
+       independent VMs can run on separate threads at the same time.
+       initVM() leaves the new VM bound, the others restore the VM that
+       was bound before them.
+*/
+extern __thread VM* vm;
 
-void initVM();
-void freeVM();
-InterpretResult interpret(const ZChar* source);
+void initVM(VM* context);
+void freeVM(VM* context);
+InterpretResult interpret(VM* context, const ZChar* source);
+InterpretResult interpretFunction(VM* context, ObjFunction* function);
+InterpretResult interpretClosure(VM* context, ObjClosure* closure);
+void defineNative(VM* context, const ZChar* name, NativeFn function);
+ZInt32 globalSlot(ObjString* name);
 void push(Value value);
 Value pop();
 
@@ -1,10 +1,20 @@
 #include "common/common.h"
 #include "chunk/chunk.h"
 #include "vm/vm.h"
+#include "memory/memory.h"
+#include "compiler/compiler.h"
+#include "cache/cache.h"
+#include "batch/batch.h"
+#include "image/image.h"
 #include "debug.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
 
 // we define needed Flags: ( we could create flags from main(argv[]) from those) 
 #ifdef DEBUG_PRINT_CODE
@@ -20,6 +30,8 @@ ZBool FLAG_LOG_GC = false;
 #endif
 
 
+static VM mainVM;
+
 static void repl()
 {
     char line[1024];
@@ -32,81 +44,280 @@ static void repl()
             break;
         }
 
-        interpret(line);     
+        interpret(&mainVM, line);
     }
 }
 
-static char* readFile(const char* path)
+static ZBool useCache = ZTRUE;  // --no-cache: neither read nor write x.ziac
+static const char* imagePath = NULL;     // --image: the heap image to write once the script has run
+static const char* imageEntry = IMAGE_ENTRY;
+
+static void runFile(const char* path)
 {
-    FILE* file = fopen(path, "rb");
-    if (NULL == file)
+    ZInt32 status = runScript(&mainVM, path, useCache);
+    if (0 == status && NULL != imagePath)
+    {
+        status = writeImage(&mainVM, imagePath, imageEntry);
+    }
+    if (0 != status)
     {
-        fprintf(stderr, "Impossible d'ouvrir le fichier \"%s\".\n", path);
-        exit(74);
+        exit(status);
     }
+}
 
-    //Moves the file cursor to the end of the file so we can measure its size.
-    fseek(file, 0L, SEEK_END);
-    //Returns the current position of the cursor — which, since we are at the end, gives the total file size in bytes.
-    size_t fileSize = ftell(file);
-    //Moves the file cursor back to the beginning, so we can read from the start.
-    rewind(file);
+// a size in bytes above 0, with an optional k or m suffix; ZFALSE for anything else
+static ZBool parseBytes(const char* text, size_t* bytes)
+{
+    // strtoull() would take leading blanks and a minus sign
+    if (!isdigit((unsigned char)text[0]))
+    {
+        return ZFALSE;
+    }
+    char* end = NULL;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    unsigned long long unit = 1;
+    if ('k' == *end || 'K' == *end)
+    {
+        unit = 1024;
+        end++;
+    }
+    else if ('m' == *end || 'M' == *end)
+    {
+        unit = 1024 * 1024;
+        end++;
+    }
+    if (0 != errno || '\0' != *end || 0 == value || value > SIZE_MAX / unit)
+    {
+        return ZFALSE;
+    }
+    *bytes = (size_t)(value * unit);
+    return ZTRUE;
+}
 
-    char* buffer = (char*)malloc(fileSize + 1);
-    if (NULL == buffer)
+// a whole number from 'minimum' up, ZFALSE for anything else
+static ZBool parseCount(const char* text, ZInt32 minimum, ZInt32* count)
+{
+    if (!isdigit((unsigned char)text[0]))
     {
-        fprintf(stderr, "Mémoire insuffisante pour lire \"%s\".\n", path);
-        exit(74);
+        return ZFALSE;
     }
-    
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-    if (bytesRead < fileSize)
+    char* end = NULL;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (0 != errno || '\0' != *end || value < minimum || value > INT32_MAX)
     {
-        fprintf(stderr, "Impossible de lire le fichier \"%s\".\n", path);
-        exit(74);
+        return ZFALSE;
     }
-    
-    buffer[bytesRead] = '\0';
+    *count = (ZInt32)value;
+    return ZTRUE;
+}
 
-    fclose(file);
-    return buffer;
+// a finite factor of at least 1, ZFALSE for anything else
+static ZBool parseFactor(const char* text, ZReal64* factor)
+{
+    char* end = NULL;
+    errno = 0;
+    ZReal64 value = strtod(text, &end);
+    if (0 != errno || end == text || '\0' != *end || !isfinite(value) || value < 1.0)
+    {
+        return ZFALSE;
+    }
+    *factor = value;
+    return ZTRUE;
 }
 
-static void runFile(const char* path)
+static void printMainGcStats()
 {
-    char* source = readFile(path);
-    InterpretResult result = interpret(source);
-    free(source);
+    printGcStats(&mainVM);
+}
 
-    if (result == INTERPRET_COMPILE_ERROR)
+/*
+@Note: Collector settings, read from the environment and then from the
+       command line, which wins:
+         ZIA_GC_HEAP    --gc-heap=<octets>[k|m]  first full collection threshold
+         ZIA_GC_GROWTH  --gc-growth=<facteur>    heap growth between full collections
+         ZIA_GC_STEP    --gc-step=<n>            objects marked per allocation, 0 for stop-the-world
+         ZIA_GC_THREADS --gc-threads=<n>         threads marking the heap together
+         ZIA_GC_STATS   --gc-stats               collector telemetry on stderr at exit
+       A value that does not parse whole, is negative or out of range is
+       refused with the usage, never applied.
+*/
+static ZBool setGcOption(const char* name, const char* value)
+{
+    if (0 == strcmp(name, "heap"))
+    {
+        if (NULL == value || !parseBytes(value, &mainVM.gcInitialHeap))
+        {
+            return ZFALSE;
+        }
+        mainVM.nextGC = mainVM.gcInitialHeap;
+    }
+    else if (0 == strcmp(name, "growth"))
+    {
+        return NULL != value && parseFactor(value, &mainVM.gcGrowthFactor);
+    }
+    else if (0 == strcmp(name, "step"))
+    {
+        return NULL != value && parseCount(value, 0, &mainVM.gcStepBudget);
+    }
+    else if (0 == strcmp(name, "threads"))
+    {
+        return NULL != value && parseCount(value, 1, &mainVM.gcThreads);
+    }
+    else if (0 == strcmp(name, "stats"))
+    {
+        static ZBool registered = ZFALSE;
+        if (ZFALSE == registered && (NULL == value || 0 != strcmp(value, "0")))
+        {
+            // runFile() exits directly on errors, the figures are still wanted then
+            atexit(printMainGcStats);
+            registered = ZTRUE;
+        }
+    }
+    else
     {
-        exit(65);
+        return ZFALSE;
     }
-    if (result == INTERPRET_RUNTIME_ERROR)
+    return ZTRUE;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Utilisage: zia [options] [path]\n");
+    fprintf(stderr, "           zia --batch [options] <path|@liste>...\n");
+    fprintf(stderr, "  --gc-heap=<octets>[k|m]  seuil de la première collection complète\n");
+    fprintf(stderr, "  --gc-growth=<facteur>    croissance du tas entre deux collections complètes (>= 1)\n");
+    fprintf(stderr, "  --gc-step=<n>            objets marqués par allocation, 0 pour tout marquer d'un coup\n");
+    fprintf(stderr, "  --gc-threads=<n>         threads qui marquent le tas ensemble (>= 1)\n");
+    fprintf(stderr, "  --gc-stats               statistiques du ramasse-miettes sur stderr à la sortie\n");
+    fprintf(stderr, "  --no-cache               ni lire ni écrire le bytecode compilé (fichier .ziac)\n");
+    fprintf(stderr, "  --batch                  exécuter tous les scripts en parallèle, chacun dans sa VM\n");
+    fprintf(stderr, "  --jobs=<n>               threads du mode --batch (par défaut: un par cœur)\n");
+    fprintf(stderr, "  @liste                   en mode --batch, un fichier qui liste un script par ligne\n");
+    fprintf(stderr, "  --image=<fichier.ziai>   après le script, écrire son tas dans une image, que zia <fichier.ziai> relance\n");
+    fprintf(stderr, "  --entry=<nom>            fonction globale sans paramètres par où l'image reprend (par défaut: %s)\n", IMAGE_ENTRY);
+    exit(64);
+}
+
+static void readGcEnvironment()
+{
+    const char* names[] = {"heap", "growth", "step", "threads", "stats"};
+    const char* variables[] = {"ZIA_GC_HEAP", "ZIA_GC_GROWTH", "ZIA_GC_STEP", "ZIA_GC_THREADS", "ZIA_GC_STATS"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
     {
-        exit(70);
-    }  
+        const char* value = getenv(variables[i]);
+        if (NULL != value && !setGcOption(names[i], value))
+        {
+            fprintf(stderr, "Valeur invalide pour %s: \"%s\".\n", variables[i], value);
+            usage();
+        }
+    }
 }
 
 int main(int argc, const char* argv[])
 {
-    initVM();
+    initVM(&mainVM);
+    readGcEnvironment();
 
-    if (argc == 1)
+    BatchList paths;
+    initBatchList(&paths);
+    ZBool batch = ZFALSE;
+    ZInt32 jobs = (ZInt32)sysconf(_SC_NPROCESSORS_ONLN);
+    for (ZInt32 i = 1; i < argc; i++)
     {
-        repl();
+        if (0 == strncmp(argv[i], "--gc-", 5))
+        {
+            char name[32];
+            const char* equals = strchr(argv[i], '=');
+            size_t length = (NULL != equals) ? (size_t)(equals - argv[i]) - 5 : strlen(argv[i]) - 5;
+            if (length >= sizeof(name))
+            {
+                usage();
+            }
+            memcpy(name, argv[i] + 5, length);
+            name[length] = '\0';
+            if (!setGcOption(name, (NULL != equals) ? equals + 1 : NULL))
+            {
+                fprintf(stderr, "Option invalide: \"%s\".\n", argv[i]);
+                usage();
+            }
+        }
+        else if (0 == strcmp(argv[i], "--no-cache"))
+        {
+            useCache = ZFALSE;
+        }
+        else if (0 == strcmp(argv[i], "--batch"))
+        {
+            batch = ZTRUE;
+        }
+        else if (0 == strncmp(argv[i], "--jobs=", 7) && atoi(argv[i] + 7) > 0)
+        {
+            jobs = atoi(argv[i] + 7);
+        }
+        else if (0 == strncmp(argv[i], "--image=", 8) && isImagePath(argv[i] + 8))
+        {
+            imagePath = argv[i] + 8;
+        }
+        else if (0 == strncmp(argv[i], "--entry=", 8) && '\0' != argv[i][8])
+        {
+            imageEntry = argv[i] + 8;
+        }
+        else if (0 == strncmp(argv[i], "--", 2))
+        {
+            usage();
+        }
+        else
+        {
+            addBatchPath(&paths, argv[i]);
+        }
     }
-    else if(argc == 2)
+
+#ifdef PROFILE_OPCODES
+    // runFile() exits directly on errors, the profile is still wanted then
+    atexit(dumpOpcodeProfile);
+#endif
+
+    ZInt32 status = 0;
+    if (ZTRUE == batch && NULL != imagePath)
     {
-        runFile(argv[1]);
+        // each script of a batch has a heap of its own, there is no single one to write
+        usage();
+    }
+    else if (ZTRUE == batch)
+    {
+        // the lists named with '@' are replaced by the scripts they hold
+        BatchList scripts;
+        initBatchList(&scripts);
+        for (ZInt32 i = 0; i < paths.count; i++)
+        {
+            if ('@' != paths.paths[i][0])
+            {
+                addBatchPath(&scripts, paths.paths[i]);
+            }
+            else if (!addBatchManifest(&scripts, paths.paths[i] + 1))
+            {
+                exit(74);
+            }
+        }
+        status = runBatch(&scripts, jobs, &mainVM, useCache);
+        freeBatchList(&scripts);
+    }
+    else if (paths.count > 1 || (NULL != imagePath && 0 == paths.count))
+    {
+        usage();
+    }
+    else if (0 == paths.count)
+    {
+        repl();
     }
     else
     {
-        fprintf(stderr, "Utilisage: zia [path]\n");
-        exit(64);
+        runFile(paths.paths[0]);
     }
 
-    freeVM();
+    freeBatchList(&paths);
+    freeVM(&mainVM);
 
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""
+Batch mode against sequential runs: every test script is run on its own,
+then all of them at once through zia --batch --jobs=N @liste, for a few N.
+The batch must print the same output, in the order of the list, followed
+by a report giving each script the exit code it had on its own.
+"""
+import os
+import re
+import sys
+import subprocess
+import tempfile
+
+JOBS = (1, 2, 8)
+REPORT_START = "-- lot: "
+REPORT_LINE = re.compile(r"^\s*(\d+)\s+[\d.]+ ms  (.*)$")
+
+def find_scripts(root_dir):
+    scripts = []
+    for dirpath, _, filenames in os.walk(root_dir):
+        if "expected" in dirpath:
+            continue
+        scripts += [os.path.join(dirpath, f) for f in filenames if f.endswith('.zia')]
+    return sorted(scripts)
+
+def run(command, timeout):
+    return subprocess.run(command, capture_output=True, timeout=timeout)
+
+def check_batch(binary, scripts, sequential, list_path, jobs):
+    batch = run([binary, "--no-cache", "--batch", f"--jobs={jobs}", "@" + list_path], 60)
+    failures = []
+    expected_out = b"".join(result.stdout for result in sequential)
+    if batch.stdout != expected_out:
+        failures.append("the output differs from the sequential runs")
+
+    errors, _, report = batch.stderr.partition(REPORT_START.encode())
+    if errors != b"".join(result.stderr for result in sequential):
+        failures.append("the error output differs from the sequential runs")
+    statuses = {}
+    for line in report.decode('utf-8').splitlines():
+        match = REPORT_LINE.match(line)
+        if match:
+            statuses[match.group(2)] = int(match.group(1))
+    for path, result in zip(scripts, sequential):
+        if statuses.get(path) != result.returncode:
+            failures.append(f"{path}: exit {statuses.get(path)} in the batch, {result.returncode} on its own")
+
+    expected_status = max(result.returncode for result in sequential)
+    if batch.returncode != expected_status:
+        failures.append(f"the batch exits with {batch.returncode}, expected {expected_status}")
+    return failures
+
+def main():
+    if len(sys.argv) != 3:
+        print(f"usage: {sys.argv[0]} <zia binary> <tests directory>")
+        sys.exit(2)
+    binary, tests_dir = sys.argv[1], sys.argv[2]
+    scripts = find_scripts(tests_dir)
+    sequential = [run([binary, "--no-cache", path], 5) for path in scripts]
+
+    failed = 0
+    with tempfile.TemporaryDirectory() as work_dir:
+        list_path = os.path.join(work_dir, "liste")
+        with open(list_path, 'w', encoding='utf-8') as f:
+            f.write("\n".join(scripts) + "\n")
+        for jobs in JOBS:
+            failures = check_batch(binary, scripts, sequential, list_path, jobs)
+            if failures:
+                failed += 1
+                print(f"FAIL --jobs={jobs}")
+                for failure in failures:
+                    print("  " + failure)
+            else:
+                print(f"PASS --jobs={jobs} ({len(scripts)} scripts)")
+    print(f"PASSED: {len(JOBS) - failed} FAILED: {failed}")
+    sys.exit(1 if failed else 0)
+
+if __name__ == "__main__":
+    main()
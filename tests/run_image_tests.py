@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""
+Round trip of heap images: for every tests/image/x.zia,
+  zia --image=x.ziai x.zia   must print tests/expected/image/x.out
+  zia x.ziai                 must print tests/expected/image/x.image.out
+and every truncated copy of x.ziai must be refused with exit code 74.
+"""
+import os
+import sys
+import subprocess
+import tempfile
+from glob import glob
+
+IMAGE_REFUSED = 74
+
+def run(command):
+    return subprocess.run(command, capture_output=True, text=True, timeout=5)
+
+def read_expected(path):
+    with open(path, 'r', encoding='utf-8') as f:
+        return f.read()
+
+def check_image(binary, test_path, work_dir):
+    name = os.path.splitext(os.path.basename(test_path))[0]
+    expected_dir = os.path.join("tests", "expected", "image")
+    image_path = os.path.join(work_dir, name + ".ziai")
+    failures = []
+
+    written = run([binary, "--no-cache", "--image=" + image_path, test_path])
+    if written.returncode != 0 or written.stdout != read_expected(os.path.join(expected_dir, name + ".out")):
+        return [f"writing the image: exit {written.returncode}\n{written.stdout}{written.stderr}"]
+
+    restarted = run([binary, image_path])
+    if restarted.returncode != 0 or restarted.stdout != read_expected(os.path.join(expected_dir, name + ".image.out")):
+        failures.append(f"running the image: exit {restarted.returncode}\n{restarted.stdout}{restarted.stderr}")
+
+    with open(image_path, 'rb') as f:
+        image = f.read()
+    # inside the header, inside the records, and one byte short
+    for length in (0, 12, len(image) // 2, len(image) - 1):
+        truncated_path = os.path.join(work_dir, f"{name}-{length}.ziai")
+        with open(truncated_path, 'wb') as f:
+            f.write(image[:length])
+        truncated = run([binary, truncated_path])
+        if truncated.returncode != IMAGE_REFUSED or truncated.stdout != "":
+            failures.append(f"image cut to {length} bytes: exit {truncated.returncode}, expected {IMAGE_REFUSED}\n{truncated.stdout}{truncated.stderr}")
+    return failures
+
+def main():
+    if len(sys.argv) != 3:
+        print(f"usage: {sys.argv[0]} <zia binary> <tests directory>")
+        sys.exit(2)
+    binary, tests_dir = sys.argv[1], sys.argv[2]
+    tests = sorted(glob(os.path.join(tests_dir, "image", "*.zia")))
+    failed = 0
+    with tempfile.TemporaryDirectory() as work_dir:
+        for test_path in tests:
+            failures = check_image(binary, test_path, work_dir)
+            if failures:
+                failed += 1
+                print(f"FAIL {test_path}")
+                for failure in failures:
+                    print("  " + failure.replace("\n", "\n  "))
+            else:
+                print(f"PASS {test_path}")
+    print(f"PASSED: {len(tests) - failed} FAILED: {failed}")
+    sys.exit(1 if failed else 0)
+
+if __name__ == "__main__":
+    main()
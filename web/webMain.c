@@ -14,9 +14,23 @@
 #include "../src/chunk/chunk.h"
 #include "../debug/debug.h"
 #include "../src/vm/vm.h"
+#include "../src/embed/embed.h"
 
 #define COMPILE_TIME_EXIT_CODE  65
 #define RUN_TIME_EXIT_CODE      70
+#define WEB_GLOBALS_LIMIT       4096  // global slots a page VM may hold before it starts over
+
+/*
+@Note: One VM for the page, and the last program compiled in it: running
+       the same source again only resets the globals and runs the code.
+       Every new source leaves its global names behind, slots and
+       interned strings the VM never gives back, so once they pass
+       WEB_GLOBALS_LIMIT the VM is freed and set up again.
+*/
+static VM webVM;
+static ZBool ready = ZFALSE;
+static Program* program = NULL;
+static ZChar* programSource = NULL;   // the source 'program' was compiled from
 
 EMSCRIPTEN_KEEPALIVE
 ZInt32 runCompiler(ZChar* sourceCode, ZBool activateBC, ZBool activateTE, ZBool activateGC)
@@ -46,11 +60,51 @@ ZInt32 runCompiler(ZChar* sourceCode, ZBool activateBC, ZBool activateTE, ZBool
     }
 #endif
 
-    initVM();
-    InterpretResult result = interpret(sourceCode);
+    ZBool sameSource = NULL != program && 0 == strcmp(programSource, sourceCode);
+#ifdef DEBUG_PRINT_CODE
+    // the bytecode is only printed while compiling
+    sameSource = sameSource && ZFALSE == FLAG_PRINT_CODE;
+#endif
+    if (ZFALSE == sameSource)
+    {
+        if (NULL != program)
+        {
+            freeProgram(&webVM, program);
+            program = NULL;
+        }
+        free(programSource);
+        programSource = NULL;
+        if (ZTRUE == ready && webVM.globalNames.count > WEB_GLOBALS_LIMIT)
+        {
+            freeVM(&webVM);
+            ready = ZFALSE;
+        }
+    }
+    if (ZFALSE == ready)
+    {
+        initVM(&webVM);
+        ready = ZTRUE;
+    }
+    resetGlobals(&webVM);
+
+    if (ZFALSE == sameSource)
+    {
+        program = compileProgram(&webVM, sourceCode);
+        if (NULL != program)
+        {
+            // kept to recognise the next run, freed with the program
+            programSource = sourceCode;
+            sourceCode = NULL;
+        }
+    }
+
+    InterpretResult result = INTERPRET_COMPILE_ERROR;
+    if (NULL != program)
+    {
+        result = runProgram(&webVM, program);
+    }
     printf("\n");
     free(sourceCode);
-    freeVM();
 
     if (INTERPRET_COMPILE_ERROR == result)
     {